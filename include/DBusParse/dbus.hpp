@@ -19,7 +19,12 @@
 
 #include "error.hpp"
 #include "parse.hpp"
+#include "utils.hpp"
+#include <array>
 #include <functional>
+#include <stdexcept>
+#include <unordered_map>
+#include <variant>
 
 enum MessageType {
   MSGTYPE_INVALID = 0,
@@ -130,7 +135,33 @@ class DBusObjectDictEntry;
 class DBusObjectArray;
 class DBusObjectStruct;
 
+// Deleter for `std::unique_ptr<DBusObject>`, which doesn't delete objects
+// that are in a `ParseArena` (see `DBusObject::mkInArena`), because their
+// memory is freed with the arena. That makes deleting a tree of objects in
+// an arena O(1), rather than recursive. It has to be declared before
+// `std::unique_ptr<DBusObject>` is used, and it is defined after
+// `DBusObject`.
+namespace std {
+template <> struct default_delete<DBusObject> {
+  constexpr default_delete() noexcept = default;
+
+  // So that a `std::unique_ptr<DBusObjectChar>` (for example) can be
+  // converted to a `std::unique_ptr<DBusObject>`.
+  template <class T, class = typename enable_if<
+                         is_convertible<T *, DBusObject *>::value>::type>
+  default_delete(const default_delete<T> &) noexcept {}
+
+  void operator()(DBusObject *p) const;
+};
+} // namespace std
+
 class DBusType {
+  // See `typeCode`.
+  const char typeCode_;
+
+  // See `isInterned`.
+  const bool interned_;
+
 public:
   // Visitor interface
   class Visitor {
@@ -155,7 +186,7 @@ public:
   };
 
   // Continuation for parsing a type.
-  class ParseTypeCont {
+  class ParseTypeCont : public ParseAlloc {
   public:
     virtual ~ParseTypeCont() {}
     virtual std::unique_ptr<Parse::Cont>
@@ -167,13 +198,60 @@ public:
   };
 
   // Continuation for parsing an object of this type.
-  template <Endianness endianness> class ParseObjectCont {
+  template <Endianness endianness> class ParseObjectCont : public ParseAlloc {
   public:
     virtual ~ParseObjectCont() {}
     virtual std::unique_ptr<Parse::Cont>
     parse(const Parse::State &p, std::unique_ptr<DBusObject> &&obj) = 0;
   };
 
+  // Handler interface for the streaming parse mode (see `mkEventParser`).
+  // Rather than building a `DBusObject`, the parser calls these methods
+  // as the values arrive. The default implementations do nothing, so a
+  // handler only needs to override the events that it is interested in.
+  // The `std::string_view` arguments are only valid for the duration of
+  // the call.
+  class EventHandler {
+  public:
+    virtual ~EventHandler() {}
+
+    virtual void onChar(char) {}
+    virtual void onBoolean(bool) {}
+    virtual void onUint16(uint16_t) {}
+    virtual void onInt16(int16_t) {}
+    virtual void onUint32(uint32_t) {}
+    virtual void onInt32(int32_t) {}
+    virtual void onUint64(uint64_t) {}
+    virtual void onInt64(int64_t) {}
+    virtual void onDouble(double) {}
+    virtual void onUnixFD(uint32_t) {}
+    virtual void onString(std::string_view) {}
+    virtual void onPath(std::string_view) {}
+    virtual void onSignature(std::string_view) {}
+
+    // The type is only valid until the matching `endVariant`.
+    virtual void beginVariant(const DBusType &) {}
+    virtual void endVariant() {}
+
+    virtual void beginDictEntry() {}
+    virtual void endDictEntry() {}
+
+    // `len` is the size of the array in bytes, as specified on the wire.
+    virtual void beginArray(const DBusType &, uint32_t) {}
+    virtual void endArray() {}
+
+    virtual void beginStruct() {}
+    virtual void endStruct() {}
+  };
+
+  // Continuation for the streaming parse mode. It is invoked when the
+  // value has been completely parsed.
+  class ParseEventCont : public ParseAlloc {
+  public:
+    virtual ~ParseEventCont() {}
+    virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p) = 0;
+  };
+
   virtual ~DBusType() {}
 
   // When D-Bus objects are serialized, they are aligned. For example
@@ -189,19 +267,62 @@ public:
 
   std::string toString() const;
 
+  // Structural equality: two types are equal if they have the same
+  // signature. Types from the same `DBusTypeStorage` are compared by
+  // address, so this is usually cheap.
+  bool equals(const DBusType &other) const;
+
+  // Hash of the signature, which is consistent with `equals`. It doesn't
+  // depend on addresses or on the host, so it is stable across runs.
+  uint64_t hash() const;
+
   // Create a parser for this type. The parameter is a continuation
   // function, which will receive the `DBusObject` which was parsed.
   // This method uses the template method design pattern to delegate
   // most of the work to `mkObjectParserImpl` (below). But this
   // wrapper takes care of alignment.
+  //
+  // Lifetime: the type only needs to stay alive until parsing is
+  // complete. If the type is interned (see `isInterned`), then the
+  // arrays, structs and dict entries created by the parser refer to it
+  // rather than copying it. Otherwise, each of them gets its own copy of
+  // its type, like an object created with `mk`.
   template <Endianness endianness>
   std::unique_ptr<Parse::Cont>
   mkObjectParser(const Parse::State &p,
                  std::unique_ptr<ParseObjectCont<endianness>> &&cont) const;
 
+  // Create a parser for this type in streaming mode: no `DBusObject` is
+  // created, instead the values are reported to `handler` as they are
+  // parsed. The handler isn't owned by the parser, so it needs to stay
+  // alive until parsing is complete. Like `mkObjectParser`, this takes
+  // care of alignment.
+  template <Endianness endianness>
+  std::unique_ptr<Parse::Cont>
+  mkEventParser(const Parse::State &p, EventHandler &handler,
+                std::unique_ptr<ParseEventCont> &&cont) const;
+
   virtual void accept(Visitor &visitor) const = 0;
 
+  // True if the owner of this type has promised to keep it (and its
+  // subtypes) alive for as long as any object that is parsed with it, so
+  // the parsed objects can share it. That is the case for the types in
+  // `DBusSignatureCache` (a message body holds a `shared_ptr` to its
+  // entry), the header type, and the types that a variant parses from its
+  // signature.
+  bool isInterned() const { return interned_; }
+
+  // The character which represents the type in a signature, for example
+  // 'u' for UINT32. For a container type, it is the first character of
+  // its signature: 'a', '(' or '{'. This lets code like
+  // `SerializeVisitor` dispatch on the type without a virtual call. It is
+  // '\0' for subclasses which are defined outside this file.
+  char typeCode() const { return typeCode_; }
+
 protected:
+  explicit DBusType(char typeCode = '\0', bool interned = false)
+      : typeCode_(typeCode), interned_(interned) {}
+
   // Little endian parser.
   virtual std::unique_ptr<Parse::Cont> mkObjectParserImpl(
       const Parse::State &p,
@@ -215,6 +336,8 @@ protected:
 
 class DBusTypeChar final : public DBusType {
 public:
+  DBusTypeChar() : DBusType('y') {}
+
   virtual size_t alignment() const override { return sizeof(char); }
 
   // DBusTypeChar is constant and doesn't have any parameters,
@@ -241,6 +364,8 @@ protected:
 
 class DBusTypeBoolean final : public DBusType {
 public:
+  DBusTypeBoolean() : DBusType('b') {}
+
   // D-Bus Booleans are 32 bits.
   // https://dbus.freedesktop.org/doc/dbus-specification.html#idm694
   virtual size_t alignment() const override { return sizeof(uint32_t); }
@@ -269,6 +394,8 @@ protected:
 
 class DBusTypeUint16 final : public DBusType {
 public:
+  DBusTypeUint16() : DBusType('q') {}
+
   virtual size_t alignment() const override { return sizeof(uint16_t); }
 
   // DBusTypeUint16 is constant and doesn't have any parameters,
@@ -295,6 +422,8 @@ protected:
 
 class DBusTypeInt16 final : public DBusType {
 public:
+  DBusTypeInt16() : DBusType('n') {}
+
   virtual size_t alignment() const override { return sizeof(int16_t); }
 
   // DBusTypeInt16 is constant and doesn't have any parameters,
@@ -321,6 +450,8 @@ protected:
 
 class DBusTypeUint32 final : public DBusType {
 public:
+  DBusTypeUint32() : DBusType('u') {}
+
   virtual size_t alignment() const override { return sizeof(uint32_t); }
 
   // DBusTypeUint32 is constant and doesn't have any parameters,
@@ -347,6 +478,8 @@ protected:
 
 class DBusTypeInt32 final : public DBusType {
 public:
+  DBusTypeInt32() : DBusType('i') {}
+
   virtual size_t alignment() const override { return sizeof(int32_t); }
 
   // DBusTypeInt32 is constant and doesn't have any parameters,
@@ -373,6 +506,8 @@ protected:
 
 class DBusTypeUint64 final : public DBusType {
 public:
+  DBusTypeUint64() : DBusType('t') {}
+
   virtual size_t alignment() const override { return sizeof(uint64_t); }
 
   // DBusTypeUint64 is constant and doesn't have any parameters,
@@ -399,6 +534,8 @@ protected:
 
 class DBusTypeInt64 final : public DBusType {
 public:
+  DBusTypeInt64() : DBusType('x') {}
+
   virtual size_t alignment() const override { return sizeof(int64_t); }
 
   // DBusTypeInt64 is constant and doesn't have any parameters,
@@ -425,6 +562,8 @@ protected:
 
 class DBusTypeDouble final : public DBusType {
 public:
+  DBusTypeDouble() : DBusType('d') {}
+
   virtual size_t alignment() const override { return sizeof(int32_t); }
 
   // DBusTypeDouble is constant and doesn't have any parameters,
@@ -451,6 +590,8 @@ protected:
 
 class DBusTypeUnixFD final : public DBusType {
 public:
+  DBusTypeUnixFD() : DBusType('h') {}
+
   virtual size_t alignment() const override { return sizeof(int32_t); }
 
   // DBusTypeUnixFD is constant and doesn't have any parameters,
@@ -477,6 +618,8 @@ protected:
 
 class DBusTypeString final : public DBusType {
 public:
+  DBusTypeString() : DBusType('s') {}
+
   virtual size_t alignment() const override {
     return sizeof(uint32_t); // For the length
   }
@@ -505,6 +648,8 @@ protected:
 
 class DBusTypePath final : public DBusType {
 public:
+  DBusTypePath() : DBusType('o') {}
+
   virtual size_t alignment() const override {
     return sizeof(uint32_t); // For the length
   }
@@ -533,6 +678,8 @@ protected:
 
 class DBusTypeSignature final : public DBusType {
 public:
+  DBusTypeSignature() : DBusType('g') {}
+
   virtual size_t alignment() const override {
     return sizeof(char); // The length of a signature fits in a char
   }
@@ -561,6 +708,8 @@ protected:
 
 class DBusTypeVariant final : public DBusType {
 public:
+  DBusTypeVariant() : DBusType('v') {}
+
   virtual size_t alignment() const override {
     // A serialized variant starts with a signature, which has a 1-byte
     // alignment.
@@ -598,9 +747,10 @@ class DBusTypeDictEntry : public DBusType {
 
 public:
   // We keep references to `keyType` and `valueType`, but do not take
-  // ownership of them.
-  DBusTypeDictEntry(const DBusType &keyType, const DBusType &valueType)
-      : keyType_(keyType), valueType_(valueType) {}
+  // ownership of them. (See `isInterned` for `interned`.)
+  DBusTypeDictEntry(const DBusType &keyType, const DBusType &valueType,
+                    bool interned = false)
+      : DBusType('{', interned), keyType_(keyType), valueType_(valueType) {}
 
   const DBusType &getKeyType() const { return keyType_; }
   const DBusType &getValueType() const { return valueType_; }
@@ -644,7 +794,9 @@ class DBusTypeArray : public DBusType {
 
 public:
   // We keep a reference to the baseType, but do not take ownership of it.
-  explicit DBusTypeArray(const DBusType &baseType) : baseType_(baseType) {}
+  // (See `isInterned` for `interned`.)
+  explicit DBusTypeArray(const DBusType &baseType, bool interned = false)
+      : DBusType('a', interned), baseType_(baseType) {}
 
   const DBusType &getBaseType() const { return baseType_; }
 
@@ -684,10 +836,11 @@ class DBusTypeStruct : public DBusType {
 
 public:
   // We take ownership of the vector, but not the field types which it
-  // references.
+  // references. (See `isInterned` for `interned`.)
   explicit DBusTypeStruct(
-      std::vector<std::reference_wrapper<const DBusType>> &&fieldTypes)
-      : fieldTypes_(std::move(fieldTypes)) {}
+      std::vector<std::reference_wrapper<const DBusType>> &&fieldTypes,
+      bool interned = false)
+      : DBusType('(', interned), fieldTypes_(std::move(fieldTypes)) {}
 
   const std::vector<std::reference_wrapper<const DBusType>> &
   getFieldTypes() const {
@@ -737,61 +890,96 @@ protected:
 //
 // Leaf types like `DBusTypeChar` do not need to be allocated because they
 // have a global constant instance. So we only need to allocate memory for
-// array and struct types, which are the only non-leaf types. This class
-// allocates and stores objects of type `DBusTypeArray` and
-// `DBusTypeStruct`. It is unlikely to be used much, so it just uses a pair
-// of simply linked lists.
+// array, dict entry, and struct types, which are the only non-leaf types.
+// This class allocates and stores objects of type `DBusTypeArray`,
+// `DBusTypeDictEntry`, and `DBusTypeStruct`.
+//
+// The types are hash-consed: asking for the same type twice returns the
+// same object. The lookup is keyed on the addresses of the sub-types, so
+// if the sub-types were also allocated by this storage (or are leaf
+// types), then two types from this storage are structurally equal if and
+// only if they are the same object. That means the memory used is
+// proportional to the number of distinct types, rather than the number of
+// times that they are allocated.
 class DBusTypeStorage final {
-  class ArrayLink final : public DBusTypeArray {
-    const std::unique_ptr<ArrayLink> next_;
-
-  public:
-    ArrayLink(const DBusType &baseType, std::unique_ptr<ArrayLink> &&next)
-        : DBusTypeArray(baseType), next_(std::move(next)) {}
+  struct PairHash {
+    size_t operator()(
+        const std::pair<const DBusType *, const DBusType *> &k) const {
+      const std::hash<const DBusType *> h;
+      return h(k.first) * 31 + h(k.second);
+    }
   };
 
-  class DictEntryLink final : public DBusTypeDictEntry {
-    const std::unique_ptr<DictEntryLink> next_;
-
-  public:
-    DictEntryLink(const DBusType &keyType, const DBusType &valueType,
-                  std::unique_ptr<DictEntryLink> &&next)
-        : DBusTypeDictEntry(keyType, valueType), next_(std::move(next)) {}
+  // Key for `structs_`. It refers to a vector of field types without
+  // owning it: the stored keys refer to the field types of the
+  // `DBusTypeStruct` itself, and the key for a lookup refers to the
+  // caller's vector, so that a lookup doesn't need to allocate.
+  struct FieldTypesKey {
+    const std::reference_wrapper<const DBusType> *data_;
+    size_t size_;
+
+    explicit FieldTypesKey(
+        const std::vector<std::reference_wrapper<const DBusType>> &v)
+        : data_(v.data()), size_(v.size()) {}
   };
 
-  class StructLink final : public DBusTypeStruct {
-    const std::unique_ptr<StructLink> next_;
+  struct FieldTypesHash {
+    size_t operator()(const FieldTypesKey &k) const {
+      const std::hash<const DBusType *> h;
+      size_t result = k.size_;
+      for (size_t i = 0; i < k.size_; i++) {
+        result = result * 31 + h(&k.data_[i].get());
+      }
+      return result;
+    }
+  };
 
-  public:
-    StructLink(std::vector<std::reference_wrapper<const DBusType>> &&fieldTypes,
-               std::unique_ptr<StructLink> &&next)
-        : DBusTypeStruct(std::move(fieldTypes)), next_(std::move(next)) {}
+  struct FieldTypesEqual {
+    bool operator()(const FieldTypesKey &a, const FieldTypesKey &b) const {
+      if (a.size_ != b.size_) {
+        return false;
+      }
+      for (size_t i = 0; i < a.size_; i++) {
+        if (&a.data_[i].get() != &b.data_[i].get()) {
+          return false;
+        }
+      }
+      return true;
+    }
   };
 
-  std::unique_ptr<ArrayLink> arrays_;
-  std::unique_ptr<DictEntryLink> dict_entries_;
-  std::unique_ptr<StructLink> structs_;
+  // The nodes are individually allocated, so their addresses are stable
+  // when the tables are rehashed or the storage is moved.
+  std::unordered_map<const DBusType *, std::unique_ptr<DBusTypeArray>>
+      arrays_;
+  std::unordered_map<std::pair<const DBusType *, const DBusType *>,
+                     std::unique_ptr<DBusTypeDictEntry>, PairHash>
+      dict_entries_;
+  std::unordered_map<FieldTypesKey, std::unique_ptr<DBusTypeStruct>,
+                     FieldTypesHash, FieldTypesEqual>
+      structs_;
+
+  // Whether the allocated types are interned (see `DBusType::isInterned`).
+  bool interned_;
 
 public:
-  DBusTypeStorage() {}
+  // If `interned` is true, then the owner of the storage promises to keep
+  // it alive for as long as any object that is parsed with its types.
+  explicit DBusTypeStorage(bool interned = false) : interned_(interned) {}
 
-  const DBusTypeArray &allocArray(const DBusType &baseType) {
-    arrays_ = std::make_unique<ArrayLink>(baseType, std::move(arrays_));
-    return *arrays_;
-  }
+  DBusTypeStorage(DBusTypeStorage &&) = default;
+
+  const DBusTypeArray &allocArray(const DBusType &baseType);
 
   const DBusTypeDictEntry &allocDictEntry(const DBusType &keyType,
-                                          const DBusType &valueType) {
-    dict_entries_ = std::make_unique<DictEntryLink>(keyType, valueType,
-                                                    std::move(dict_entries_));
-    return *dict_entries_;
-  }
+                                          const DBusType &valueType);
 
   const DBusTypeStruct &allocStruct(
-      std::vector<std::reference_wrapper<const DBusType>> &&fieldTypes) {
-    structs_ = std::make_unique<StructLink>(std::move(fieldTypes),
-                                            std::move(structs_));
-    return *structs_;
+      std::vector<std::reference_wrapper<const DBusType>> &&fieldTypes);
+
+  // The number of distinct types in the storage.
+  size_t size() const {
+    return arrays_.size() + dict_entries_.size() + structs_.size();
   }
 };
 
@@ -802,6 +990,12 @@ public:
 };
 
 class DBusObject {
+  // True if the object was created by `mkInArena`.
+  bool inArena_ = false;
+
+  // See `typeCode`.
+  const char typeCode_;
+
 public:
   // Visitor interface
   class Visitor {
@@ -825,9 +1019,35 @@ public:
     virtual void visitStruct(const DBusObjectStruct &) = 0;
   };
 
-  DBusObject() {}
+  DBusObject() : typeCode_('\0') {}
   virtual ~DBusObject() = default;
 
+  // Create an object of type `T` in `arena`. The memory is freed when the
+  // arena is deleted, but the object's destructor is never called, so it
+  // mustn't own anything outside of the arena. The classes with members
+  // that would otherwise own memory, such as `DBusObjectStruct`, have a
+  // constructor which takes the arena as its first argument.
+  //
+  // The result is a `std::unique_ptr<DBusObject>`, rather than a
+  // `std::unique_ptr<T>`, because only the former knows not to delete an
+  // object in an arena. (See `std::default_delete<DBusObject>`.)
+  template <class T, class... Args>
+  static std::unique_ptr<DBusObject> mkInArena(ParseArena &arena,
+                                               Args &&...args) {
+    static_assert(std::is_base_of<DBusObject, T>::value,
+                  "mkInArena is only for subclasses of DBusObject");
+    T *obj = ::new (arena.alloc(sizeof(T), alignof(T)))
+        T(std::forward<Args>(args)...);
+    obj->DBusObject::inArena_ = true;
+    return std::unique_ptr<DBusObject>(obj);
+  }
+
+  bool isInArena() const { return inArena_; }
+
+  // Same as `getType().typeCode()`, but without a virtual call. It is
+  // '\0' for subclasses which are defined outside this file.
+  char typeCode() const { return typeCode_; }
+
   virtual const DBusType &getType() const = 0;
 
   // Always call serializePadding before calling this method.
@@ -837,6 +1057,19 @@ public:
 
   virtual void accept(Visitor &visitor) const = 0;
 
+  // Structural equality: two objects are equal if they have the same
+  // type and the same values, regardless of how they are stored. (For
+  // example, a packed array is equal to the same array of individual
+  // objects.) Doubles are compared by their bits, so a NaN is equal to
+  // itself. The comparison uses an explicit stack rather than recursion,
+  // so it is safe to use on deeply nested objects.
+  bool equals(const DBusObject &other) const;
+
+  // Hash which is consistent with `equals`. Like `equals`, it isn't
+  // recursive. It doesn't depend on addresses or on the host, so it is
+  // stable across runs.
+  uint64_t hash() const;
+
   virtual const DBusObjectChar &toChar() const {
     throw ObjectCastError("Char");
   }
@@ -900,8 +1133,18 @@ public:
   }
 
   size_t serializedSize() const;
+
+protected:
+  // `typeCode` is the `DBusType::typeCode` of the object's type.
+  explicit DBusObject(char typeCode) : typeCode_(typeCode) {}
 };
 
+inline void std::default_delete<DBusObject>::operator()(DBusObject *p) const {
+  if (!p->isInArena()) {
+    delete p;
+  }
+}
+
 class DBusObjectChar final : public DBusObject {
   const char c_;
 
@@ -1196,24 +1439,93 @@ public:
   uint32_t getValue() const { return i_; }
 };
 
+// The value of a string-like object (`DBusObjectString`, `DBusObjectPath`,
+// or `DBusObjectSignature`). It either owns a copy of the string or, if
+// the object was created by a parser in zero-copy mode, it is a view into
+// the parser's input buffer, which it keeps alive. If the object is in a
+// `ParseArena`, then it is a view of a copy in the arena. In all cases,
+// the string is followed by a zero byte in memory.
+class DBusStringRef final {
+  // A view into a zero-copy parser's input buffer.
+  struct BufferView {
+    std::shared_ptr<const char> buffer_;
+    std::string_view view_;
+  };
+
+  // Only one of the representations is stored, so that an owned string,
+  // which is the default, isn't any bigger than it needs to be. A
+  // `std::string_view` is a copy in an arena.
+  const std::variant<std::string, std::string_view, BufferView> str_;
+
+public:
+  explicit DBusStringRef(std::string &&str) : str_(std::move(str)) {}
+
+  // `view` must lie inside `buffer` and be followed by a zero byte. The
+  // size of the buffer isn't known here, so only its start is checked.
+  DBusStringRef(const std::shared_ptr<const char> &buffer,
+                std::string_view view)
+      : str_(BufferView{buffer, view}) {
+    assert(buffer && view.data() >= buffer.get());
+    assert(view.data()[view.size()] == '\0');
+  }
+
+  // Copy `str` into `arena`.
+  DBusStringRef(ParseArena &arena, std::string_view str)
+      : str_(arena.copyString(str)) {}
+
+  std::string_view get() const {
+    if (const std::string *str = std::get_if<std::string>(&str_)) {
+      return *str;
+    }
+    if (const BufferView *v = std::get_if<BufferView>(&str_)) {
+      return v->view_;
+    }
+    return std::get<std::string_view>(str_);
+  }
+
+  // Throws an `Error` if the string is a view, because then there isn't
+  // a `std::string` to return.
+  const std::string &getString() const {
+    if (const std::string *str = std::get_if<std::string>(&str_)) {
+      return *str;
+    }
+    throw Error("The string is a view, so use getView() to read it.");
+  }
+
+  size_t size() const { return get().size(); }
+};
+
 class DBusObjectString final : public DBusObject {
-  const std::string str_;
+  const DBusStringRef str_;
 
 public:
   explicit DBusObjectString(std::string &&str);
 
+  // Constructor for objects in an arena. `str` is copied into `arena`.
+  DBusObjectString(ParseArena &arena, std::string_view str);
+
+  // Zero-copy constructor. `str` must point into `buffer`.
+  DBusObjectString(const std::shared_ptr<const char> &buffer,
+                   std::string_view str);
+
   static std::unique_ptr<DBusObjectString> mk(std::string &&str) {
     return std::make_unique<DBusObjectString>(std::move(str));
   }
 
+  static std::unique_ptr<DBusObjectString>
+  mk(const std::shared_ptr<const char> &buffer, std::string_view str) {
+    return std::make_unique<DBusObjectString>(buffer, str);
+  }
+
   virtual const DBusType &getType() const override {
     return DBusTypeString::instance_;
   }
 
   virtual void serializeAfterPadding(Serializer &s) const override {
-    uint32_t len = str_.size();
+    const std::string_view str = str_.get();
+    uint32_t len = str.size();
     s.writeUint32(len);
-    s.writeBytes(str_.c_str(), len + 1);
+    s.writeBytes(str.data(), len + 1);
   }
 
   virtual void print(Printer &p, size_t) const override;
@@ -1224,30 +1536,53 @@ public:
 
   const DBusObjectString &toString() const override { return *this; }
 
-  const std::string &getValue() const { return str_; }
+  // Only objects which own their string have a `std::string`, so this
+  // throws an `Error` if the object was created by a parser in zero-copy
+  // or arena mode (see `DBusStringRef`). Use `getView()` in code that
+  // might see such objects.
+  const std::string &getValue() const { return str_.getString(); }
+
+  // The value in any mode. It is only valid for the lifetime of the
+  // object.
+  std::string_view getView() const { return str_.get(); }
 };
 
 class DBusObjectPath final : public DBusObject {
-  const std::string str_;
+  const DBusStringRef str_;
 
 public:
   explicit DBusObjectPath(std::string &&str);
 
+  // Constructor for objects in an arena. `str` is copied into `arena`.
+  DBusObjectPath(ParseArena &arena, std::string_view str);
+
+  // Zero-copy constructor. `str` must point into `buffer`.
+  DBusObjectPath(const std::shared_ptr<const char> &buffer,
+                 std::string_view str);
+
   static std::unique_ptr<DBusObjectPath> mk(std::string &&str) {
     return std::make_unique<DBusObjectPath>(std::move(str));
   }
 
+  static std::unique_ptr<DBusObjectPath>
+  mk(const std::shared_ptr<const char> &buffer, std::string_view str) {
+    return std::make_unique<DBusObjectPath>(buffer, str);
+  }
+
   virtual const DBusType &getType() const override {
     return DBusTypePath::instance_;
   }
 
   virtual void serializeAfterPadding(Serializer &s) const override {
-    uint32_t len = str_.size();
+    const std::string_view str = str_.get();
+    uint32_t len = str.size();
     s.writeUint32(len);
-    s.writeBytes(str_.c_str(), len + 1);
+    s.writeBytes(str.data(), len + 1);
   }
 
-  virtual void print(Printer &p, size_t) const override { p.printString(str_); }
+  virtual void print(Printer &p, size_t) const override {
+    p.printString(std::string(str_.get()));
+  }
 
   virtual void accept(Visitor &visitor) const override {
     visitor.visitPath(*this);
@@ -1255,30 +1590,45 @@ public:
 
   const DBusObjectPath &toPath() const override { return *this; }
 
-  const std::string &getValue() const { return str_; }
+  // See `DBusObjectString::getValue` and `DBusObjectString::getView`.
+  const std::string &getValue() const { return str_.getString(); }
+  std::string_view getView() const { return str_.get(); }
 };
 
 // Almost identical to DBusObjectString and DBusObjectPath, except that a
 // single byte is used to serialize the length. (The maximum length of a
 // signature is 255.)
 class DBusObjectSignature final : public DBusObject {
-  const std::string str_;
+  const DBusStringRef str_;
 
 public:
   explicit DBusObjectSignature(std::string &&str);
 
+  // Constructor for objects in an arena. `str` is copied into `arena`.
+  DBusObjectSignature(ParseArena &arena, std::string_view str);
+
+  // Zero-copy constructor. `str` must point into `buffer`.
+  DBusObjectSignature(const std::shared_ptr<const char> &buffer,
+                      std::string_view str);
+
   static std::unique_ptr<DBusObjectSignature> mk(std::string &&str) {
     return std::make_unique<DBusObjectSignature>(std::move(str));
   }
 
+  static std::unique_ptr<DBusObjectSignature>
+  mk(const std::shared_ptr<const char> &buffer, std::string_view str) {
+    return std::make_unique<DBusObjectSignature>(buffer, str);
+  }
+
   virtual const DBusType &getType() const override {
     return DBusTypeSignature::instance_;
   }
 
   virtual void serializeAfterPadding(Serializer &s) const override {
-    uint8_t len = str_.size();
+    const std::string_view str = str_.get();
+    uint8_t len = str.size();
     s.writeByte(len);
-    s.writeBytes(str_.c_str(), len + 1);
+    s.writeBytes(str.data(), len + 1);
   }
 
   virtual void print(Printer &p, size_t) const override;
@@ -1289,7 +1639,9 @@ public:
 
   const DBusObjectSignature &toSignature() const override { return *this; }
 
-  const std::string &getValue() const { return str_; }
+  // See `DBusObjectString::getValue` and `DBusObjectString::getView`.
+  const std::string &getValue() const { return str_.getString(); }
+  std::string_view getView() const { return str_.get(); }
 
   // Parse the sequence of types from the signature string. You need to
   // supply a `DBusTypeStorage` so that the parser can allocate new
@@ -1299,29 +1651,148 @@ public:
   std::vector<std::reference_wrapper<const DBusType>>
   toTypes(DBusTypeStorage &typeStorage // Type allocator
   ) const;
+
+  // Same as the above, but for a signature string that isn't wrapped in a
+  // `DBusObjectSignature`.
+  static std::vector<std::reference_wrapper<const DBusType>>
+  toTypes(DBusTypeStorage &typeStorage, // Type allocator
+          std::string_view signature);
+};
+
+// The sequence of types described by a signature string, together with
+// the storage that they were allocated in. It is immutable once it has
+// been constructed, so it can be shared by any number of parsers.
+class DBusSignatureTypes final {
+  const std::string signature_;
+
+  // The storage may be shared with other `DBusSignatureTypes`, so that
+  // they share the nodes for any types that they have in common.
+  const std::shared_ptr<DBusTypeStorage> typeStorage_;
+
+  const std::vector<std::reference_wrapper<const DBusType>> types_;
+
+public:
+  // Throws a `ParseError` if the signature is invalid. The empty
+  // signature is valid and contains zero types.
+  explicit DBusSignatureTypes(std::string_view signature);
+
+  // Same as the above, but allocates the types in `typeStorage`. The
+  // types are only interned (see `DBusType::isInterned`) if the storage
+  // is.
+  DBusSignatureTypes(std::string_view signature,
+                     const std::shared_ptr<DBusTypeStorage> &typeStorage);
+
+  DBusSignatureTypes(const DBusSignatureTypes &) = delete;
+  DBusSignatureTypes &operator=(const DBusSignatureTypes &) = delete;
+
+  std::string_view getSignature() const { return signature_; }
+
+  const std::vector<std::reference_wrapper<const DBusType>> &getTypes() const {
+    return types_;
+  }
+};
+
+// Cache which maps a signature string to its `DBusSignatureTypes`, so that
+// a signature which has been seen before doesn't need to be parsed again.
+// All the entries allocate their types in the same `DBusTypeStorage`, so
+// types are shared between entries and two types from the cache are equal
+// if and only if they are the same object. Most programs only use a small
+// number of distinct signatures, so the cache is simply cleared (and
+// starts using a new `DBusTypeStorage`) if it grows beyond `maxEntries`.
+// Entries are reference counted, so clearing the cache doesn't invalidate
+// the types which are still in use.
+//
+// The cache is not thread-safe. `threadLocal()` returns a per-thread
+// instance, which is what the message parsers use.
+class DBusSignatureCache final {
+  // The keys point into the signature string owned by the value.
+  std::unordered_map<std::string_view,
+                     std::shared_ptr<const DBusSignatureTypes>>
+      entries_;
+
+  std::shared_ptr<DBusTypeStorage> typeStorage_;
+
+  const size_t maxEntries_;
+
+public:
+  explicit DBusSignatureCache(size_t maxEntries = 1024)
+      : typeStorage_(std::make_shared<DBusTypeStorage>(true)),
+        maxEntries_(maxEntries) {}
+
+  DBusSignatureCache(const DBusSignatureCache &) = delete;
+  DBusSignatureCache &operator=(const DBusSignatureCache &) = delete;
+
+  // Throws a `ParseError` if the signature is invalid. Invalid signatures
+  // are not added to the cache.
+  std::shared_ptr<const DBusSignatureTypes> lookup(std::string_view signature);
+
+  size_t size() const { return entries_.size(); }
+
+  void clear() {
+    entries_.clear();
+    typeStorage_ = std::make_shared<DBusTypeStorage>(true);
+  }
+
+  static DBusSignatureCache &threadLocal();
 };
 
 class DBusObjectVariant final : public DBusObject {
+  // If the variant was created by the parser, then this owns the types
+  // that were parsed from its signature, which `object_` refers to. It
+  // is null if the type is a basic type. It is declared before `object_`
+  // so that it is destroyed after it.
+  const std::unique_ptr<const DBusTypeStorage> typeStorage_;
+
   const std::unique_ptr<DBusObject> object_;
-  const DBusObjectSignature signature_;
+
+  // The signature is derived from the type of `object_`, so it isn't
+  // created until the first call to `getSignature()`. Serialization
+  // writes the signature directly from the type, so it doesn't need it.
+  // It is always a `DBusObjectSignature`, but it might be in the arena, so
+  // it needs the deleter of `std::unique_ptr<DBusObject>`.
+  mutable std::unique_ptr<DBusObject> signature_;
+
+  // If the variant is in an arena, then the signature is created in it.
+  ParseArena *const arena_;
 
 public:
   explicit DBusObjectVariant(std::unique_ptr<DBusObject> &&object);
 
+  // Constructor for variants in an arena. If `object` refers to types
+  // which were parsed from the variant's signature, then their storage
+  // needs to be owned by the arena.
+  DBusObjectVariant(ParseArena &arena, std::unique_ptr<DBusObject> &&object);
+
+  // Constructor for a variant whose object refers to types in
+  // `typeStorage`.
+  DBusObjectVariant(std::unique_ptr<DBusObject> &&object,
+                    std::unique_ptr<const DBusTypeStorage> &&typeStorage);
+
   static std::unique_ptr<DBusObjectVariant>
   mk(std::unique_ptr<DBusObject> &&object) {
     return std::make_unique<DBusObjectVariant>(std::move(object));
   }
 
+  static std::unique_ptr<DBusObjectVariant>
+  mk(std::unique_ptr<DBusObject> &&object,
+     std::unique_ptr<const DBusTypeStorage> &&typeStorage) {
+    return std::make_unique<DBusObjectVariant>(std::move(object),
+                                               std::move(typeStorage));
+  }
+
   virtual const DBusType &getType() const override {
     return DBusTypeVariant::instance_;
   }
 
   virtual void serializeAfterPadding(Serializer &s) const override {
-    signature_.serialize(s);
+    serializeSignature(s);
     object_->serialize(s);
   }
 
+  // Serialize the signature of the variant (which doesn't need any
+  // padding) without creating a `DBusObjectSignature`.
+  void serializeSignature(Serializer &s) const;
+
   virtual void print(Printer &p, size_t indent) const override;
 
   virtual void accept(Visitor &visitor) const override {
@@ -1331,23 +1802,49 @@ public:
   const DBusObjectVariant &toVariant() const override { return *this; }
 
   const std::unique_ptr<DBusObject> &getValue() const { return object_; }
+
+  // The signature is created by the first call, so this isn't
+  // thread-safe: if several threads read the same message, then they
+  // need to synchronize their calls to `getSignature()`, or one thread
+  // needs to call it before the message is shared.
+  const DBusObjectSignature &getSignature() const;
 };
 
 class DBusObjectDictEntry : public DBusObject {
   const std::unique_ptr<DBusObject> key_;
   const std::unique_ptr<DBusObject> value_;
-  const DBusTypeDictEntry dictEntryType_;
+
+  // Null if the type is shared. (See `dictEntryType_`.)
+  const std::unique_ptr<const DBusTypeDictEntry> ownedType_;
+
+  // Objects which are created by the parser share the type that the
+  // parser already has, so that a large `a{sv}` doesn't contain a copy of
+  // the type for every entry. Otherwise, this refers to `ownedType_`.
+  const DBusTypeDictEntry &dictEntryType_;
 
 public:
   DBusObjectDictEntry(std::unique_ptr<DBusObject> &&key,
                       std::unique_ptr<DBusObject> &&value);
 
+  // Constructor with a shared type, which must outlive the object.
+  DBusObjectDictEntry(std::unique_ptr<DBusObject> &&key,
+                      std::unique_ptr<DBusObject> &&value,
+                      const DBusTypeDictEntry &dictEntryType);
+
   static std::unique_ptr<DBusObjectDictEntry>
   mk(std::unique_ptr<DBusObject> &&key, std::unique_ptr<DBusObject> &&value) {
     return std::make_unique<DBusObjectDictEntry>(std::move(key),
                                                  std::move(value));
   }
 
+  static std::unique_ptr<DBusObjectDictEntry>
+  mkWithType(std::unique_ptr<DBusObject> &&key,
+             std::unique_ptr<DBusObject> &&value,
+             const DBusTypeDictEntry &dictEntryType) {
+    return std::make_unique<DBusObjectDictEntry>(
+        std::move(key), std::move(value), dictEntryType);
+  }
+
   virtual const DBusType &getType() const final override {
     return dictEntryType_;
   }
@@ -1367,21 +1864,35 @@ public:
 
   const std::unique_ptr<DBusObject> &getKey() const { return key_; }
   const std::unique_ptr<DBusObject> &getValue() const { return value_; }
+
+  // Same as `getType`, but without a virtual call.
+  const DBusTypeDictEntry &getDictEntryType() const { return dictEntryType_; }
 };
 
 class DBusObjectSeq final {
+  // Empty if the sequence is in an arena.
   const std::vector<std::unique_ptr<DBusObject>> elements_;
 
+  // Points to the elements, which are either in `elements_` or in an
+  // array in the arena. The array is never destroyed, so the elements
+  // need to be in the arena too.
+  const std::unique_ptr<DBusObject> *const data_;
+  const size_t size_;
+
 public:
   explicit DBusObjectSeq(std::vector<std::unique_ptr<DBusObject>> &&elements);
 
-  size_t length() const { return elements_.size(); }
+  // Constructor for sequences in an arena.
+  DBusObjectSeq(ParseArena &arena,
+                std::vector<std::unique_ptr<DBusObject>> &&elements);
+
+  size_t length() const { return size_; }
 
   std::vector<std::reference_wrapper<const DBusType>> elementTypes() const {
     std::vector<std::reference_wrapper<const DBusType>> types;
-    types.reserve(elements_.size());
-    for (auto &element : elements_) {
-      types.push_back(std::cref(element->getType()));
+    types.reserve(size_);
+    for (size_t i = 0; i < size_; i++) {
+      types.push_back(std::cref(data_[i]->getType()));
     }
     return types;
   }
@@ -1389,19 +1900,24 @@ public:
   void print(Printer &p, size_t indent, char lbracket, char rbracket) const;
 
   void serialize(Serializer &s) const {
-    for (auto &p : elements_) {
-      p->serialize(s);
+    for (size_t i = 0; i < size_; i++) {
+      data_[i]->serialize(s);
     }
   }
 
   const std::unique_ptr<DBusObject> &getElement(size_t i) const {
-    return elements_.at(i);
+    if (i >= size_) {
+      throw std::out_of_range("DBusObjectSeq::getElement");
+    }
+    return data_[i];
   }
 };
 
 class DBusObjectArray : public DBusObject {
   const DBusObjectSeq seq_;
 
+  // Null if the type is shared. (See `arrayType_`.)
+  //
   // Note: this type contains a reference to the base type of the array
   // type. It doesn't own the base type, so we need to make sure that it
   // cannot become a dangling pointer. That's easy when the array has
@@ -1410,7 +1926,29 @@ class DBusObjectArray : public DBusObject {
   // to make sure that we own the base type. This problem is solved by
   // DBusObjectArray0, which owns any struct or array types that are used
   // in the base type.
-  const DBusTypeArray arrayType_;
+  const std::unique_ptr<const DBusTypeArray> ownedType_;
+
+  // Objects which are created by the parser share the type that the
+  // parser already has. Otherwise, this refers to `ownedType_`.
+  const DBusTypeArray &arrayType_;
+
+  // Set by `DBusObjectArrayPacked`. (See `getPackedValues`.)
+  const void *packedValues_ = nullptr;
+  size_t numPackedValues_ = 0;
+
+protected:
+  // Constructor for subclasses which store their elements differently.
+  // (See DBusObjectArrayPacked.)
+  explicit DBusObjectArray(const DBusType &baseType);
+
+  void setPackedValues(const void *values, size_t n) {
+    packedValues_ = values;
+    numPackedValues_ = n;
+  }
+
+  // Serialize the elements. This is called after the length and the
+  // alignment padding have been written.
+  virtual void serializeElements(Serializer &s) const { seq_.serialize(s); }
 
 public:
   // DBusObjectArray keeps a reference to baseType, so the
@@ -1418,6 +1956,15 @@ public:
   DBusObjectArray(const DBusType &baseType,
                   std::vector<std::unique_ptr<DBusObject>> &&elements);
 
+  // Constructor with a shared type, which must outlive the object.
+  DBusObjectArray(std::vector<std::unique_ptr<DBusObject>> &&elements,
+                  const DBusTypeArray &arrayType);
+
+  // Constructor for arrays in an arena. The type is shared.
+  DBusObjectArray(ParseArena &arena,
+                  std::vector<std::unique_ptr<DBusObject>> &&elements,
+                  const DBusTypeArray &arrayType);
+
   // Constructing an array with zero elements needs to be handled as
   // a special case to avoid the `arrayType_` field containing a dangling
   // pointer. See the comment on `arrayType_`.
@@ -1441,6 +1988,14 @@ public:
     }
   }
 
+  // The array type is shared, so this doesn't need the special case for
+  // zero elements.
+  static std::unique_ptr<DBusObjectArray>
+  mkWithType(const DBusTypeArray &arrayType,
+             std::vector<std::unique_ptr<DBusObject>> &&elements) {
+    return std::make_unique<DBusObjectArray>(std::move(elements), arrayType);
+  }
+
   virtual const DBusType &getType() const final override { return arrayType_; }
 
   virtual void serializeAfterPadding(Serializer &s) const final override {
@@ -1448,13 +2003,13 @@ public:
       s.writeUint32(arraySize);
       s.insertPadding(arrayType_.getBaseType().alignment());
       const size_t posBefore = s.getPos();
-      seq_.serialize(s);
+      serializeElements(s);
       const size_t posAfter = s.getPos();
       return posAfter - posBefore;
     });
   }
 
-  virtual void print(Printer &p, size_t indent) const override final;
+  virtual void print(Printer &p, size_t indent) const override;
 
   virtual void accept(Visitor &visitor) const override {
     visitor.visitArray(*this);
@@ -1462,11 +2017,36 @@ public:
 
   const DBusObjectArray &toArray() const override { return *this; }
 
-  size_t numElements() const { return seq_.length(); }
+  virtual size_t numElements() const { return seq_.length(); }
 
-  const std::unique_ptr<DBusObject> &getElement(size_t i) const {
+  virtual const std::unique_ptr<DBusObject> &getElement(size_t i) const {
     return seq_.getElement(i);
   }
+
+  // If the array is a `DBusObjectArrayPacked`, then this returns a pointer
+  // to its `numElements()` values, which are stored in host byte order
+  // and are `valueSize` bytes each, the same as on the wire. Otherwise it
+  // returns nullptr.
+  virtual const void *packedValues(size_t &valueSize) const {
+    (void)valueSize;
+    return nullptr;
+  }
+
+  // Same as `getType`, but without a virtual call.
+  const DBusTypeArray &getArrayType() const { return arrayType_; }
+
+  // The elements, unless the array is a `DBusObjectArrayPacked`, in which
+  // case the sequence is empty. Unlike `getElement`, this doesn't need a
+  // virtual call.
+  const DBusObjectSeq &getSeq() const { return seq_; }
+
+  // Same as `packedValues`, except that it sets `n` to the number of
+  // values, and the size of a value is implied by the element type. It
+  // may return nullptr if there are zero values.
+  const void *getPackedValues(size_t &n) const {
+    n = numPackedValues_;
+    return packedValues_;
+  }
 };
 
 // An array with zero elements.
@@ -1479,19 +2059,163 @@ public:
                    DBusTypeStorage &&typeStorage);
 };
 
+// An array whose elements are a fixed-size basic type (`y`, `b`, `n`,
+// `q`, `i`, `u`, `x`, `t`, `d`, or `h`), stored as a contiguous vector of
+// values rather than as a vector of individually allocated objects. The
+// parser creates these for arrays of fixed-size types, which makes large
+// arrays like `ay` much cheaper to parse. `Elem` is the corresponding
+// object class, for example DBusObjectUint32, and `T` is the type used to
+// represent a single element on the wire, for example `uint32_t`. (Note
+// that booleans are 32 bits on the wire.)
+template <class Elem, typename T>
+class DBusObjectArrayPacked final : public DBusObjectArray {
+  // Unused if the array is in an arena, in which case `values_` and
+  // `elements_` refer to vectors which are owned by the arena.
+  const std::vector<T> ownedValues_;
+  mutable std::vector<std::unique_ptr<DBusObject>> ownedElements_;
+
+  const std::vector<T> &values_;
+
+  // Objects for the elements are only created if `getElement` is called.
+  std::vector<std::unique_ptr<DBusObject>> &elements_;
+
+protected:
+  virtual void serializeElements(Serializer &s) const override {
+    if constexpr (sizeof(T) == sizeof(char)) {
+      // `data()` may be null if the vector is empty.
+      if (!values_.empty()) {
+        s.writeBytes(reinterpret_cast<const char *>(values_.data()),
+                     values_.size());
+      }
+    } else {
+      for (const T x : values_) {
+        if constexpr (std::is_same<T, double>::value) {
+          s.writeDouble(x);
+        } else if constexpr (sizeof(T) == sizeof(uint16_t)) {
+          s.writeUint16(static_cast<uint16_t>(x));
+        } else if constexpr (sizeof(T) == sizeof(uint32_t)) {
+          s.writeUint32(static_cast<uint32_t>(x));
+        } else {
+          static_assert(sizeof(T) == sizeof(uint64_t));
+          s.writeUint64(static_cast<uint64_t>(x));
+        }
+      }
+    }
+  }
+
+public:
+  // `baseType` is normally the `instance_` of the element type, so it
+  // can't become a dangling reference.
+  DBusObjectArrayPacked(const DBusType &baseType, std::vector<T> &&values)
+      : DBusObjectArray(baseType), ownedValues_(std::move(values)),
+        values_(ownedValues_), elements_(ownedElements_) {
+    setPackedValues(values_.data(), values_.size());
+  }
+
+  // Constructor with a shared type, which must outlive the object.
+  DBusObjectArrayPacked(std::vector<T> &&values, const DBusTypeArray &arrayType)
+      : DBusObjectArray(std::vector<std::unique_ptr<DBusObject>>(), arrayType),
+        ownedValues_(std::move(values)), values_(ownedValues_),
+        elements_(ownedElements_) {
+    setPackedValues(values_.data(), values_.size());
+  }
+
+  // Constructor for arrays in an arena. The type is shared.
+  DBusObjectArrayPacked(ParseArena &arena, std::vector<T> &&values,
+                        const DBusTypeArray &arrayType)
+      : DBusObjectArray(std::vector<std::unique_ptr<DBusObject>>(), arrayType),
+        values_(*arena.mk<std::vector<T>>(std::move(values))),
+        elements_(*arena.mk<std::vector<std::unique_ptr<DBusObject>>>()) {
+    setPackedValues(values_.data(), values_.size());
+  }
+
+  static std::unique_ptr<DBusObjectArrayPacked>
+  mk(const DBusType &baseType, std::vector<T> &&values) {
+    return std::make_unique<DBusObjectArrayPacked>(baseType,
+                                                   std::move(values));
+  }
+
+  static std::unique_ptr<DBusObjectArrayPacked>
+  mkWithType(const DBusTypeArray &arrayType, std::vector<T> &&values) {
+    return std::make_unique<DBusObjectArrayPacked>(std::move(values),
+                                                   arrayType);
+  }
+
+  virtual void print(Printer &p, size_t indent) const override {
+    p.printChar('[');
+    ++indent;
+    const size_t n = values_.size();
+    for (size_t i = 0; i < n; i++) {
+      if (i > 0) {
+        p.printChar(',');
+      }
+      p.printNewline(indent);
+      Elem(values_[i]).print(p, indent);
+    }
+    --indent;
+    p.printNewline(indent);
+    p.printChar(']');
+  }
+
+  virtual size_t numElements() const override { return values_.size(); }
+
+  // Note: the first call to this method creates the element objects, so
+  // it isn't safe to call it concurrently from multiple threads.
+  virtual const std::unique_ptr<DBusObject> &
+  getElement(size_t i) const override {
+    if (elements_.size() != values_.size()) {
+      elements_.reserve(values_.size());
+      for (const T x : values_) {
+        elements_.push_back(Elem::mk(x));
+      }
+    }
+    return elements_.at(i);
+  }
+
+  virtual const void *packedValues(size_t &valueSize) const override {
+    valueSize = sizeof(T);
+    return values_.data();
+  }
+
+  const std::vector<T> &getValues() const { return values_; }
+};
+
 class DBusObjectStruct : public DBusObject {
   const DBusObjectSeq seq_;
-  const DBusTypeStruct structType_;
+
+  // Null if the type is shared. (See `structType_`.)
+  const std::unique_ptr<const DBusTypeStruct> ownedType_;
+
+  // Objects which are created by the parser share the type that the
+  // parser already has, which saves allocating a vector of field types
+  // for every struct. Otherwise, this refers to `ownedType_`.
+  const DBusTypeStruct &structType_;
 
 public:
   explicit DBusObjectStruct(
       std::vector<std::unique_ptr<DBusObject>> &&elements);
 
+  // Constructor with a shared type, which must outlive the object.
+  DBusObjectStruct(std::vector<std::unique_ptr<DBusObject>> &&elements,
+                   const DBusTypeStruct &structType);
+
+  // Constructor for structs in an arena. The type is shared.
+  DBusObjectStruct(ParseArena &arena,
+                   std::vector<std::unique_ptr<DBusObject>> &&elements,
+                   const DBusTypeStruct &structType);
+
   static std::unique_ptr<DBusObjectStruct>
   mk(std::vector<std::unique_ptr<DBusObject>> &&elements) {
     return std::make_unique<DBusObjectStruct>(std::move(elements));
   }
 
+  static std::unique_ptr<DBusObjectStruct>
+  mkWithType(const DBusTypeStruct &structType,
+             std::vector<std::unique_ptr<DBusObject>> &&elements) {
+    return std::make_unique<DBusObjectStruct>(std::move(elements),
+                                              structType);
+  }
+
   virtual const DBusType &getType() const final override { return structType_; }
 
   virtual void serializeAfterPadding(Serializer &s) const final override {
@@ -1506,6 +2230,9 @@ public:
 
   const DBusObjectStruct &toStruct() const override { return *this; }
 
+  // Same as `getType`, but without a virtual call.
+  const DBusTypeStruct &getStructType() const { return structType_; }
+
   size_t numFields() const { return seq_.length(); }
 
   const std::unique_ptr<DBusObject> &getElement(size_t i) const {
@@ -1525,11 +2252,26 @@ public:
 };
 
 class DBusMessageBody {
+  // If the body was created by the parser, then this owns the types that
+  // the elements refer to. It is declared before `seq_` so that it is
+  // destroyed after it.
+  const std::shared_ptr<const DBusSignatureTypes> types_;
+
   const DBusObjectSeq seq_;
 
 public:
   explicit DBusMessageBody(std::vector<std::unique_ptr<DBusObject>> &&elements);
 
+  // Constructor for a body whose elements refer to the types in `types`.
+  DBusMessageBody(std::vector<std::unique_ptr<DBusObject>> &&elements,
+                  const std::shared_ptr<const DBusSignatureTypes> &types);
+
+  // Same as above, but the elements are in an arena. The parser also
+  // creates the body itself in the arena, with `ParseArena::mk`.
+  DBusMessageBody(ParseArena &arena,
+                  std::vector<std::unique_ptr<DBusObject>> &&elements,
+                  const std::shared_ptr<const DBusSignatureTypes> &types);
+
   // Create an empty message body.
   static std::unique_ptr<DBusMessageBody> mk0();
 
@@ -1541,6 +2283,10 @@ public:
   static std::unique_ptr<DBusMessageBody>
   mk(std::vector<std::unique_ptr<DBusObject>> &&elements);
 
+  static std::unique_ptr<DBusMessageBody>
+  mk(std::vector<std::unique_ptr<DBusObject>> &&elements,
+     const std::shared_ptr<const DBusSignatureTypes> &types);
+
   std::string signature() const;
 
   void serialize(Serializer &s) const;
@@ -1551,19 +2297,88 @@ public:
 
   size_t numElements() const { return seq_.length(); }
 
+  // Same as `DBusObject::equals` and `DBusObject::hash`, applied to the
+  // sequence of elements.
+  bool equals(const DBusMessageBody &other) const;
+  uint64_t hash() const;
+
   const std::unique_ptr<DBusObject> &getElement(size_t i) const {
     return seq_.getElement(i);
   }
 };
 
 class DBusMessage {
+  // If the message was parsed with an arena (see the arena constructor of
+  // `Parse`), then the header and the body are in it. It is declared
+  // first so that it is deleted last. Nothing in the arena is deleted
+  // individually (see `std::default_delete<DBusObject>`), so deleting the
+  // message doesn't recurse over its objects: the arena frees them all at
+  // once.
+  std::shared_ptr<ParseArena> arena_;
+
   std::unique_ptr<DBusObject> header_;
-  std::unique_ptr<DBusMessageBody> body_;
+
+  // Null if the body is in the arena. (See `body_`.)
+  mutable std::unique_ptr<DBusMessageBody> ownedBody_;
+
+  // Refers to `ownedBody_` or to a body in the arena. If the message was
+  // parsed by `parseLazy`, then it is null until the first call to
+  // `getBody()`, which parses it from `rawBody_`.
+  mutable const DBusMessageBody *body_;
+
+  // The serialized bytes of the body, if the message was parsed by
+  // `parseLazy`. Otherwise null. The length is `getHeader_bodySize()`.
+  std::shared_ptr<const char> rawBody_;
+
+  // Parse `rawBody_` into `body_`.
+  void parseRawBody() const;
+
+  // Set the body. It is allocated in the arena, if the message has one.
+  void setBody(std::vector<std::unique_ptr<DBusObject>> &&elements,
+               const std::shared_ptr<const DBusSignatureTypes> &types) const;
+
+  // Index of the header fields, keyed by `HeaderFieldName`, so that a
+  // field can be found without searching the header. The entry is null
+  // if the field isn't in the header. Fields with unknown names aren't
+  // indexed.
+  std::array<const DBusObjectVariant *, MSGHDR_UNIX_FDS + 1> fieldIndex_;
+
+  // False if the header doesn't have the standard type (`headerType`), in
+  // which case `fieldIndex_` is empty and the fields are found by
+  // searching the header.
+  bool headerIndexed_;
+
+  // True if a field occurs more than once in the header, in which case
+  // the first occurrence is indexed.
+  bool duplicateHeaderField_;
+
+  // Build `fieldIndex_` and set `duplicateHeaderField_`.
+  void indexHeaderFields();
+
+  // Used by the parsers to check that the header doesn't have duplicate
+  // fields and has the fields which the spec requires for its message
+  // type. Throws a `ParseError` at position `pos` if not.
+  void checkHeaderFields(size_t pos) const;
+
+  // File descriptors which were received with the message (SCM_RIGHTS).
+  // The values of the `DBusObjectUnixFD` objects in the body are indices
+  // into this vector.
+  std::vector<AutoCloseFD> fds_;
 
 public:
   DBusMessage(std::unique_ptr<DBusObject> &&header,
               std::unique_ptr<DBusMessageBody> &&body)
-      : header_(std::move(header)), body_(std::move(body)) {}
+      : header_(std::move(header)), ownedBody_(std::move(body)),
+        body_(ownedBody_.get()) {
+    indexHeaderFields();
+  }
+
+  // Constructor for a message whose body hasn't been parsed yet.
+  DBusMessage(std::unique_ptr<DBusObject> &&header,
+              const std::shared_ptr<const char> &rawBody)
+      : header_(std::move(header)), body_(nullptr), rawBody_(rawBody) {
+    indexHeaderFields();
+  }
 
   static std::unique_ptr<DBusMessage>
   mk(std::unique_ptr<DBusObject> &&header,
@@ -1571,9 +2386,57 @@ public:
     return std::make_unique<DBusMessage>(std::move(header), std::move(body));
   }
 
+  // The arena that the message was parsed into, or null.
+  const std::shared_ptr<ParseArena> &getArena() const { return arena_; }
+
   const DBusObjectStruct &getHeader() const { return header_->toStruct(); }
 
-  const DBusMessageBody &getBody() const { return *body_; }
+  // If the message was parsed by `parseLazy`, then the first call to this
+  // method parses the body, so it can throw a `ParseError`. It also means
+  // that it isn't safe to call this method concurrently from multiple
+  // threads until the body has been parsed.
+  const DBusMessageBody &getBody() const {
+    if (!body_ && rawBody_) {
+      parseRawBody();
+    }
+    return *body_;
+  }
+
+  bool hasBody() const { return body_ || rawBody_; }
+
+  // Attach the file descriptors which were received with the message.
+  // The message takes ownership of them.
+  void attachFds(std::vector<AutoCloseFD> &&fds) { fds_ = std::move(fds); }
+
+  const std::vector<AutoCloseFD> &getFds() const { return fds_; }
+
+  // Get the file descriptor that a `DBusObjectUnixFD` refers to. The
+  // message still owns it, so it is closed when the message is deleted.
+  int getFd(const uint32_t index) const {
+    if (index >= fds_.size()) {
+      throw Error("DBusMessage::getFd: index out of range");
+    }
+    return fds_[index].get();
+  }
+
+  // Transfer ownership of the file descriptors to the caller.
+  std::vector<AutoCloseFD> takeFds() {
+    std::vector<AutoCloseFD> fds(std::move(fds_));
+    fds_.clear();
+    return fds;
+  }
+
+  // The serialized bytes of the body, if the message was parsed by
+  // `parseLazy`. This is useful for forwarding the message without
+  // parsing the body. The bytes are in the byte order given by
+  // `getHeader_endianness()`. If the message wasn't parsed by
+  // `parseLazy`, then the result is empty.
+  std::string_view getRawBody() const {
+    if (!rawBody_) {
+      return std::string_view();
+    }
+    return std::string_view(rawBody_.get(), getHeader_bodySize());
+  }
 
   // Read the endianness value in the header.
   char getHeader_endianness() const {
@@ -1607,23 +2470,52 @@ public:
     return getHeader().getElement(5)->toUint32().getValue();
   }
 
-  const DBusObjectVariant &getHeader_lookupField(HeaderFieldName name) const {
+  // Find a header field. Returns null if the field isn't in the header.
+  // The name is a `uint8_t` rather than a `HeaderFieldName` so that
+  // fields with unknown names can be found too.
+  const DBusObjectVariant *getHeader_findField(uint8_t name) const {
+    if (headerIndexed_ && name < fieldIndex_.size()) {
+      return fieldIndex_[name];
+    }
+    // Search the header. This throws an `ObjectCastError` if the header
+    // doesn't have the standard type.
     const DBusObjectArray &fields = getHeader().getElement(6)->toArray();
     const size_t n = fields.numElements();
     for (size_t i = 0; i < n; i++) {
       const DBusObjectStruct &field = fields.getElement(i)->toStruct();
-      if (field.getElement(0)->toChar().getValue() == name) {
-        return field.getElement(1)->toVariant();
+      if (static_cast<uint8_t>(field.getElement(0)->toChar().getValue()) ==
+          name) {
+        return &field.getElement(1)->toVariant();
       }
     }
-    throw ObjectCastError("DBusMessage::getHeader_lookupField");
+    return nullptr;
+  }
+
+  const DBusObjectVariant &getHeader_lookupField(HeaderFieldName name) const {
+    const DBusObjectVariant *field = getHeader_findField(name);
+    if (!field) {
+      throw ObjectCastError("DBusMessage::getHeader_lookupField");
+    }
+    return *field;
+  }
+
+  // Read the UNIX_FDS header field, which is the number of file
+  // descriptors that were sent with the message. Returns zero if the
+  // field is absent.
+  uint32_t getHeader_unixFds() const {
+    const DBusObjectVariant *field = getHeader_findField(MSGHDR_UNIX_FDS);
+    return field ? field->getValue()->toUint32().getValue() : 0;
   }
 
   // Parse a `DBusMessage`. On success the message is assigned
-  // to `result`.
+  // to `result`. `p` is the initial state of the parser. If the parser
+  // has an arena, then pass the state that the arena constructor of
+  // `Parse` gives to its `mkCont` argument, so that the message is
+  // created in the arena.
   template <Endianness endianness>
   static std::unique_ptr<Parse::Cont>
-  parse(std::unique_ptr<DBusMessage> &result);
+  parse(std::unique_ptr<DBusMessage> &result,
+        const Parse::State &p = Parse::State::initialState_);
 
   // Shorthand for `parse<LittleEndian>`.
   static std::unique_ptr<Parse::Cont>
@@ -1633,6 +2525,46 @@ public:
   static std::unique_ptr<Parse::Cont>
   parseBE(std::unique_ptr<DBusMessage> &result);
 
+  // Parse a `DBusMessage` in either byte order. The first byte of the
+  // message is the endianness byte ('l' or 'B'), which is used to choose
+  // between `parse<LittleEndian>` and `parse<BigEndian>`. The byte is
+  // handed straight to the chosen parser, so nothing is parsed twice.
+  static std::unique_ptr<Parse::Cont>
+  parseAuto(std::unique_ptr<DBusMessage> &result);
+
+  // Like `parse`, except that only the header is parsed into objects.
+  // The body is stored as raw bytes and is parsed on the first call to
+  // `getBody()`. In zero-copy mode, the raw body is a view into the
+  // parser's input buffer.
+  template <Endianness endianness>
+  static std::unique_ptr<Parse::Cont>
+  parseLazy(std::unique_ptr<DBusMessage> &result,
+            const Parse::State &p = Parse::State::initialState_);
+
+  // Version of `parseLazy` which detects the byte order like `parseAuto`.
+  static std::unique_ptr<Parse::Cont>
+  parseLazyAuto(std::unique_ptr<DBusMessage> &result);
+
+  // Handler for `parseEvents`. The header is reported as a struct, and
+  // then the elements of the body are reported in sequence.
+  class EventHandler : public DBusType::EventHandler {
+  public:
+    // Called when the header is complete, before the body is parsed.
+    virtual void endHeader() {}
+
+    // Called when the whole message has been parsed.
+    virtual void endMessage() {}
+  };
+
+  // Parse a message in streaming mode, without creating a `DBusMessage`.
+  // (See `DBusType::mkEventParser`.)
+  template <Endianness endianness>
+  static std::unique_ptr<Parse::Cont> parseEvents(EventHandler &handler);
+
+  // Version of `parseEvents` which detects the byte order like
+  // `parseAuto`.
+  static std::unique_ptr<Parse::Cont> parseEventsAuto(EventHandler &handler);
+
   void serialize(Serializer &s) const;
 
   void print(Printer &p, size_t indent) const;
@@ -1641,6 +2573,30 @@ public:
 // The type of the header of a DBus message.
 extern const DBusTypeStruct headerType;
 
+inline bool operator==(const DBusType &a, const DBusType &b) {
+  return a.equals(b);
+}
+
+inline bool operator!=(const DBusType &a, const DBusType &b) {
+  return !a.equals(b);
+}
+
+inline bool operator==(const DBusObject &a, const DBusObject &b) {
+  return a.equals(b);
+}
+
+inline bool operator!=(const DBusObject &a, const DBusObject &b) {
+  return !a.equals(b);
+}
+
+inline bool operator==(const DBusMessageBody &a, const DBusMessageBody &b) {
+  return a.equals(b);
+}
+
+inline bool operator!=(const DBusMessageBody &a, const DBusMessageBody &b) {
+  return !a.equals(b);
+}
+
 // Utility for downcasting to std::unique_ptr<DBusObject>.
 inline std::unique_ptr<DBusObject> _obj(std::unique_ptr<DBusObject> &&o) {
   return std::unique_ptr<DBusObject>(std::move(o));
@@ -19,6 +19,7 @@
 
 #include "dbus.hpp"
 #include <string.h>
+#include <sys/uio.h>
 
 // Round pos up to a multiple of alignment.
 inline size_t alignup(size_t pos, size_t alignment) {
@@ -27,6 +28,33 @@ inline size_t alignup(size_t pos, size_t alignment) {
   return (pos + alignment - 1) & ~(alignment - 1);
 }
 
+// Same as `DBusType::alignment`, but for a `DBusType::typeCode`, so it
+// doesn't need a virtual call. The type code mustn't be '\0'.
+inline size_t typeCodeAlignment(char typeCode) {
+  switch (typeCode) {
+  case 'n':
+  case 'q':
+    return sizeof(uint16_t);
+  case 'b':
+  case 'i':
+  case 'u':
+  case 'd':
+  case 'h':
+  case 's':
+  case 'o':
+  case 'a':
+    return sizeof(uint32_t);
+  case 't':
+  case 'x':
+  case '(':
+  case '{':
+    return sizeof(uint64_t);
+  default:
+    assert(typeCode == 'y' || typeCode == 'g' || typeCode == 'v');
+    return sizeof(char);
+  }
+}
+
 // This implementation of the Serializer interface is
 // used to count how many bytes the output buffer will need.
 class SerializerDryRunBase : public Serializer {
@@ -47,6 +75,13 @@ public:
   virtual void insertPadding(size_t alignment) override;
 
   virtual size_t getPos() const override { return pos_; }
+
+  // Array hooks for `SerializeVisitor`.
+  size_t beginArray() {
+    pos_ += sizeof(uint32_t);
+    return 0;
+  }
+  void endArray(size_t, uint32_t) {}
 };
 
 // This implementation of the Serializer interface is
@@ -61,6 +96,11 @@ public:
 
   virtual void
   recordArraySize(const std::function<uint32_t(uint32_t)> &f) override;
+
+  size_t beginArray() {
+    ++arrayCount_;
+    return SerializerDryRunBase::beginArray();
+  }
 };
 
 class SerializerInitArraySizes final : public SerializerDryRunBase {
@@ -72,6 +112,15 @@ public:
 
   virtual void
   recordArraySize(const std::function<uint32_t(uint32_t)> &f) override;
+
+  // Array hooks for `SerializeVisitor`. The token is the index of the
+  // slot in `arraySizes_`.
+  size_t beginArray() {
+    SerializerDryRunBase::beginArray();
+    arraySizes_.push_back(0xDEADBEEF);
+    return arraySizes_.size() - 1;
+  }
+  void endArray(size_t i, uint32_t arraySize) { arraySizes_[i] = arraySize; }
 };
 
 class SerializeToBufferBase : public Serializer {
@@ -86,14 +135,39 @@ public:
   recordArraySize(const std::function<uint32_t(uint32_t)> &f) override;
 };
 
+// Write `x` to `buf` in the byte order given by `endianness`. `buf`
+// needn't be aligned.
+template <Endianness endianness, typename T>
+inline void writeWireValue(char *buf, T x) {
+  static_assert(endianness == LittleEndian || endianness == BigEndian);
+  if constexpr (sizeof(T) == sizeof(uint16_t)) {
+    x = endianness == LittleEndian ? htole16(x) : htobe16(x);
+  } else if constexpr (sizeof(T) == sizeof(uint32_t)) {
+    x = endianness == LittleEndian ? htole32(x) : htobe32(x);
+  } else {
+    static_assert(sizeof(T) == sizeof(uint64_t));
+    x = endianness == LittleEndian ? htole64(x) : htobe64(x);
+  }
+  memcpy(buf, &x, sizeof(x));
+}
+
+// Serializes into a buffer which is big enough for the output, for
+// example because its size was computed by `SerializerDryRun`. Like
+// `SerializeToVector`, it writes a placeholder for the length of each
+// array and patches it when the array is complete, so it doesn't need the
+// array sizes to be computed in advance.
 template <Endianness endianness>
-class SerializeToBuffer final : public SerializeToBufferBase {
+class SerializeToBuffer final : public Serializer {
   size_t pos_;
   char *buf_; // Not owned by this class
 
+  template <typename T> void write(T x) {
+    writeWireValue<endianness>(&buf_[pos_], x);
+    pos_ += sizeof(T);
+  }
+
 public:
-  SerializeToBuffer(const std::vector<uint32_t> &arraySizes, char *buf)
-      : SerializeToBufferBase(arraySizes), pos_(0), buf_(buf) {}
+  explicit SerializeToBuffer(char *buf) : pos_(0), buf_(buf) {}
 
   virtual void writeByte(char c) override {
     buf_[pos_] = c;
@@ -105,58 +179,685 @@ public:
     pos_ += bufsize;
   }
 
-  virtual void writeUint16(uint16_t x) override {
-    static_assert(endianness == LittleEndian || endianness == BigEndian);
-    if (endianness == LittleEndian) {
-      *(uint16_t *)&buf_[pos_] = htole16(x);
-    } else {
-      *(uint16_t *)&buf_[pos_] = htobe16(x);
-    }
-    pos_ += sizeof(uint16_t);
+  virtual void writeUint16(uint16_t x) override { write(x); }
+  virtual void writeUint32(uint32_t x) override { write(x); }
+  virtual void writeUint64(uint64_t x) override { write(x); }
+
+  virtual void writeDouble(double d) override {
+    // double is the same size as uint64_t, so we cast the value
+    // to uint64_t and use writeUint64.
+    static_assert(sizeof(double) == sizeof(uint64_t));
+    uint64_t x;
+    memcpy(&x, &d, sizeof(x));
+    writeUint64(x);
   }
 
-  virtual void writeUint32(uint32_t x) override {
-    static_assert(endianness == LittleEndian || endianness == BigEndian);
-    if (endianness == LittleEndian) {
-      *(uint32_t *)&buf_[pos_] = htole32(x);
-    } else {
-      *(uint32_t *)&buf_[pos_] = htobe32(x);
-    }
-    pos_ += sizeof(uint32_t);
+  virtual void insertPadding(size_t alignment) override {
+    // Calculate the new position.
+    const size_t newpos = alignup(pos_, alignment);
+    // Insert zero bytes.
+    memset(&buf_[pos_], 0, newpos - pos_);
+    pos_ = newpos;
   }
 
-  virtual void writeUint64(uint64_t x) override {
-    static_assert(endianness == LittleEndian || endianness == BigEndian);
-    if (endianness == LittleEndian) {
-      *(uint64_t *)&buf_[pos_] = htole64(x);
+  virtual size_t getPos() const override { return pos_; }
+
+  // `f` starts by writing the array size as a `uint32_t`, so we pass it a
+  // placeholder value and then overwrite it with the size that `f`
+  // returns.
+  virtual void
+  recordArraySize(const std::function<uint32_t(uint32_t)> &f) override {
+    const size_t pos = pos_;
+    endArray(pos, f(0));
+  }
+
+  // Array hooks for `SerializeVisitor`. The token is the position of the
+  // placeholder.
+  size_t beginArray() {
+    const size_t pos = pos_;
+    write(static_cast<uint32_t>(0));
+    return pos;
+  }
+  void endArray(size_t pos, uint32_t arraySize) {
+    writeWireValue<endianness>(&buf_[pos], arraySize);
+  }
+};
+
+// Single-pass serializer, which appends to a growable buffer. Unlike
+// `SerializeToBuffer`, it doesn't need the size of the output to be
+// computed in advance. It writes a placeholder for the length of each
+// array and patches it when the array is complete.
+template <Endianness endianness>
+class SerializeToVector final : public Serializer {
+  std::vector<char> &buf_; // Not owned
+
+  template <typename T> void writeAt(size_t pos, T x) {
+    writeWireValue<endianness>(&buf_[pos], x);
+  }
+
+  template <typename T> void write(T x) {
+    const size_t pos = buf_.size();
+    buf_.resize(pos + sizeof(T));
+    writeAt(pos, x);
+  }
+
+public:
+  // The output is appended to `buf`, which needn't be empty. Note that
+  // the alignment is relative to the start of `buf`.
+  explicit SerializeToVector(std::vector<char> &buf) : buf_(buf) {}
+
+  virtual void writeByte(char c) override { buf_.push_back(c); }
+
+  virtual void writeBytes(const char *buf, size_t bufsize) override {
+    buf_.insert(buf_.end(), buf, buf + bufsize);
+  }
+
+  virtual void writeUint16(uint16_t x) override { write(x); }
+  virtual void writeUint32(uint32_t x) override { write(x); }
+  virtual void writeUint64(uint64_t x) override { write(x); }
+
+  virtual void writeDouble(double d) override {
+    // double is the same size as uint64_t, so we cast the value
+    // to uint64_t and use writeUint64.
+    static_assert(sizeof(double) == sizeof(uint64_t));
+    uint64_t x;
+    memcpy(&x, &d, sizeof(x));
+    writeUint64(x);
+  }
+
+  virtual void insertPadding(size_t alignment) override {
+    buf_.resize(alignup(buf_.size(), alignment), '\0');
+  }
+
+  virtual size_t getPos() const override { return buf_.size(); }
+
+  // `f` starts by writing the array size as a `uint32_t`, so we pass it a
+  // placeholder value and then overwrite it with the size that `f`
+  // returns.
+  virtual void
+  recordArraySize(const std::function<uint32_t(uint32_t)> &f) override {
+    const size_t pos = buf_.size();
+    const uint32_t arraySize = f(0);
+    writeAt(pos, arraySize);
+  }
+
+  // Array hooks for `SerializeVisitor`. The token is the position of the
+  // placeholder.
+  size_t beginArray() {
+    const size_t pos = buf_.size();
+    write(static_cast<uint32_t>(0));
+    return pos;
+  }
+  void endArray(size_t pos, uint32_t arraySize) { writeAt(pos, arraySize); }
+};
+
+// Single-pass serializer which produces a list of `iovec`s, so that the
+// message can be sent with `writev` or `sendmsg` without first copying it
+// into one contiguous buffer. Most of the output is written to an
+// internal scratch buffer, but large byte strings (such as the contents
+// of long strings and `ay` arrays) are referenced in place. That means
+// the object which is being serialized must not be modified or destroyed
+// until the `iovec`s have been sent.
+template <Endianness endianness>
+class SerializeToIovec final : public Serializer {
+  // A byte string which is referenced in place. It comes immediately
+  // before byte `scratchPos_` of the scratch buffer.
+  struct External {
+    size_t scratchPos_;
+    const char *buf_;
+    size_t bufsize_;
+  };
+
+  std::vector<char> scratch_;
+  std::vector<External> externals_;
+
+  // Total size of `externals_`.
+  size_t externalBytes_;
+
+  template <typename T> void write(T x) {
+    const size_t pos = scratch_.size();
+    scratch_.resize(pos + sizeof(T));
+    writeWireValue<endianness>(&scratch_[pos], x);
+  }
+
+public:
+  // Byte strings at least this big are referenced rather than copied.
+  static const size_t minExternalSize_ = 256;
+
+  // Limit on the number of byte strings that are referenced in place, to
+  // stay well within `IOV_MAX`. Further byte strings are copied.
+  static const size_t maxExternals_ = 256;
+
+  SerializeToIovec() : externalBytes_(0) {}
+
+  // Discard the output, so that the serializer can be reused. The
+  // capacity of the internal buffers is retained, so that reusing the
+  // serializer doesn't need to allocate memory.
+  void reset() {
+    scratch_.clear();
+    externals_.clear();
+    externalBytes_ = 0;
+  }
+
+  virtual void writeByte(char c) override { scratch_.push_back(c); }
+
+  virtual void writeBytes(const char *buf, size_t bufsize) override {
+    if (bufsize >= minExternalSize_ && externals_.size() < maxExternals_) {
+      externals_.push_back(External{scratch_.size(), buf, bufsize});
+      externalBytes_ += bufsize;
     } else {
-      *(uint64_t *)&buf_[pos_] = htobe64(x);
+      scratch_.insert(scratch_.end(), buf, buf + bufsize);
     }
-    pos_ += sizeof(uint64_t);
   }
 
+  virtual void writeUint16(uint16_t x) override { write(x); }
+  virtual void writeUint32(uint32_t x) override { write(x); }
+  virtual void writeUint64(uint64_t x) override { write(x); }
+
   virtual void writeDouble(double d) override {
     // double is the same size as uint64_t, so we cast the value
     // to uint64_t and use writeUint64.
     static_assert(sizeof(double) == sizeof(uint64_t));
-    union Cast {
-      double d_;
-      uint64_t x_;
-    };
-    Cast c;
-    c.d_ = d;
-    writeUint64(c.x_);
+    uint64_t x;
+    memcpy(&x, &d, sizeof(x));
+    writeUint64(x);
   }
 
   virtual void insertPadding(size_t alignment) override {
-    // Calculate the new position.
-    const size_t newpos = alignup(pos_, alignment);
-    // Insert zero bytes.
-    memset(&buf_[pos_], 0, newpos - pos_);
-    pos_ = newpos;
+    const size_t pos = getPos();
+    scratch_.resize(scratch_.size() + (alignup(pos, alignment) - pos), '\0');
   }
 
-  virtual size_t getPos() const override { return pos_; }
+  virtual size_t getPos() const override {
+    return scratch_.size() + externalBytes_;
+  }
+
+  // `f` starts by writing the array size as a `uint32_t`, which always
+  // goes into the scratch buffer, so we can patch it afterwards.
+  virtual void
+  recordArraySize(const std::function<uint32_t(uint32_t)> &f) override {
+    const size_t pos = scratch_.size();
+    const uint32_t arraySize = f(0);
+    writeWireValue<endianness>(&scratch_[pos], arraySize);
+  }
+
+  // Array hooks for `SerializeVisitor`. The token is the position of the
+  // placeholder in the scratch buffer.
+  size_t beginArray() {
+    const size_t pos = scratch_.size();
+    write(static_cast<uint32_t>(0));
+    return pos;
+  }
+  void endArray(size_t pos, uint32_t arraySize) {
+    writeWireValue<endianness>(&scratch_[pos], arraySize);
+  }
+
+  // The `iovec`s point into this object and into the serialized objects,
+  // so they are invalidated if either is modified.
+  std::vector<struct iovec> getIovecs() const {
+    std::vector<struct iovec> result;
+    getIovecs(result);
+    return result;
+  }
+
+  // Same as the above, but replaces the contents of `result`, so that its
+  // memory can be reused.
+  void getIovecs(std::vector<struct iovec> &result) const {
+    result.clear();
+    result.reserve(2 * externals_.size() + 1);
+    size_t scratchPos = 0;
+    auto add = [&result](const char *buf, size_t bufsize) {
+      if (bufsize > 0) {
+        result.push_back(iovec{const_cast<char *>(buf), bufsize});
+      }
+    };
+    for (const External &e : externals_) {
+      add(scratch_.data() + scratchPos, e.scratchPos_ - scratchPos);
+      add(e.buf_, e.bufsize_);
+      scratchPos = e.scratchPos_;
+    }
+    add(scratch_.data() + scratchPos, scratch_.size() - scratchPos);
+  }
+};
+
+// Statically dispatched alternative to `DBusObject::serialize`. `Sink` is
+// normally one of the final implementations of `Serializer` in this file,
+// such as `SerializeToBuffer<LittleEndian>`, so the compiler can inline
+// calls like `writeUint32`. The objects are dispatched on their
+// `typeCode`, so there are no virtual calls, except for objects and types
+// of classes which are defined outside this library, which don't have a
+// type code. The virtual `serialize` methods remain available for other
+// `Serializer` implementations.
+//
+// As well as the `Serializer` methods, `Sink` needs two non-virtual hooks
+// for arrays: `beginArray()` writes a placeholder for the array size and
+// returns a token, such as the position of the placeholder, and
+// `endArray(token, arraySize)` replaces the placeholder with the size.
+template <class Sink> class SerializeVisitor final {
+  Sink &s_; // Not owned
+
+  // The size of a value in a `DBusObjectArrayPacked`, whose element type
+  // is `typeCode`.
+  static size_t packedValueSize(char typeCode) {
+    switch (typeCode) {
+    case 'y':
+      return sizeof(uint8_t);
+    case 'n':
+    case 'q':
+      return sizeof(uint16_t);
+    case 'b':
+    case 'i':
+    case 'u':
+    case 'h':
+      return sizeof(uint32_t);
+    default:
+      assert(typeCode == 'x' || typeCode == 't' || typeCode == 'd');
+      return sizeof(uint64_t);
+    }
+  }
+
+  // Same as `obj.getType()`, but only needs a virtual call if the object
+  // doesn't have a type code.
+  static const DBusType &typeOf(const DBusObject &obj) {
+    switch (obj.typeCode()) {
+    case 'y':
+      return DBusTypeChar::instance_;
+    case 'b':
+      return DBusTypeBoolean::instance_;
+    case 'q':
+      return DBusTypeUint16::instance_;
+    case 'n':
+      return DBusTypeInt16::instance_;
+    case 'u':
+      return DBusTypeUint32::instance_;
+    case 'i':
+      return DBusTypeInt32::instance_;
+    case 't':
+      return DBusTypeUint64::instance_;
+    case 'x':
+      return DBusTypeInt64::instance_;
+    case 'd':
+      return DBusTypeDouble::instance_;
+    case 'h':
+      return DBusTypeUnixFD::instance_;
+    case 's':
+      return DBusTypeString::instance_;
+    case 'o':
+      return DBusTypePath::instance_;
+    case 'g':
+      return DBusTypeSignature::instance_;
+    case 'v':
+      return DBusTypeVariant::instance_;
+    case '{':
+      return static_cast<const DBusObjectDictEntry &>(obj).getDictEntryType();
+    case 'a':
+      return static_cast<const DBusObjectArray &>(obj).getArrayType();
+    case '(':
+      return static_cast<const DBusObjectStruct &>(obj).getStructType();
+    default:
+      return obj.getType();
+    }
+  }
+
+  // The length of the signature of `t`.
+  static size_t signatureSize(const DBusType &t) {
+    switch (t.typeCode()) {
+    case '\0': {
+      SerializerDryRun s;
+      t.serialize(s);
+      return s.getPos();
+    }
+    case '{': {
+      const DBusTypeDictEntry &d = static_cast<const DBusTypeDictEntry &>(t);
+      return 2 + signatureSize(d.getKeyType()) +
+             signatureSize(d.getValueType());
+    }
+    case 'a':
+      return 1 + signatureSize(
+                     static_cast<const DBusTypeArray &>(t).getBaseType());
+    case '(': {
+      size_t size = 2;
+      for (const DBusType &field :
+           static_cast<const DBusTypeStruct &>(t).getFieldTypes()) {
+        size += signatureSize(field);
+      }
+      return size;
+    }
+    default:
+      return 1;
+    }
+  }
+
+  // Same as `t.serialize(s_)`.
+  void writeSignature(const DBusType &t) {
+    switch (t.typeCode()) {
+    case '\0':
+      t.serialize(s_);
+      break;
+    case '{': {
+      const DBusTypeDictEntry &d = static_cast<const DBusTypeDictEntry &>(t);
+      s_.writeByte('{');
+      writeSignature(d.getKeyType());
+      writeSignature(d.getValueType());
+      s_.writeByte('}');
+      break;
+    }
+    case 'a':
+      s_.writeByte('a');
+      writeSignature(static_cast<const DBusTypeArray &>(t).getBaseType());
+      break;
+    case '(':
+      s_.writeByte('(');
+      for (const DBusType &field :
+           static_cast<const DBusTypeStruct &>(t).getFieldTypes()) {
+        writeSignature(field);
+      }
+      s_.writeByte(')');
+      break;
+    default:
+      s_.writeByte(t.typeCode());
+      break;
+    }
+  }
+
+  void writeString(std::string_view str) {
+    const uint32_t len = str.size();
+    s_.writeUint32(len);
+    // Include the terminating zero byte.
+    s_.writeBytes(str.data(), len + 1);
+  }
+
+  template <typename T> void writePacked(const char *values, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+      T x;
+      memcpy(&x, &values[i * sizeof(T)], sizeof(T));
+      if constexpr (sizeof(T) == sizeof(uint16_t)) {
+        s_.writeUint16(x);
+      } else if constexpr (sizeof(T) == sizeof(uint32_t)) {
+        s_.writeUint32(x);
+      } else {
+        s_.writeUint64(x);
+      }
+    }
+  }
+
+  void serializeElements(const DBusObjectArray &arr, char baseTypeCode) {
+    size_t n = 0;
+    const char *values = static_cast<const char *>(arr.getPackedValues(n));
+    if (!values) {
+      const DBusObjectSeq &seq = arr.getSeq();
+      n = seq.length();
+      for (size_t i = 0; i < n; i++) {
+        serialize(*seq.getElement(i));
+      }
+      return;
+    }
+    switch (packedValueSize(baseTypeCode)) {
+    case sizeof(uint8_t):
+      s_.writeBytes(values, n);
+      break;
+    case sizeof(uint16_t):
+      writePacked<uint16_t>(values, n);
+      break;
+    case sizeof(uint32_t):
+      writePacked<uint32_t>(values, n);
+      break;
+    default:
+      writePacked<uint64_t>(values, n);
+      break;
+    }
+  }
+
+  void serializeVariant(const DBusObjectVariant &obj) {
+    const DBusObject &value = *obj.getValue();
+    const DBusType &t = typeOf(value);
+    const uint8_t len = signatureSize(t);
+    s_.writeByte(len);
+    writeSignature(t);
+    s_.writeByte('\0');
+    serialize(value);
+  }
+
+  void serializeArray(const DBusObjectArray &obj) {
+    const DBusType &baseType = obj.getArrayType().getBaseType();
+    const char baseTypeCode = baseType.typeCode();
+    const size_t token = s_.beginArray();
+    s_.insertPadding(baseTypeCode ? typeCodeAlignment(baseTypeCode)
+                                  : baseType.alignment());
+    const size_t posBefore = s_.getPos();
+    serializeElements(obj, baseTypeCode);
+    s_.endArray(token, s_.getPos() - posBefore);
+  }
+
+public:
+  explicit SerializeVisitor(Sink &s) : s_(s) {}
+
+  void serialize(const DBusObject &obj) {
+    const char typeCode = obj.typeCode();
+    if (typeCode == '\0') {
+      obj.serialize(s_);
+      return;
+    }
+    s_.insertPadding(typeCodeAlignment(typeCode));
+    switch (typeCode) {
+    case 'y':
+      s_.writeByte(static_cast<const DBusObjectChar &>(obj).getValue());
+      break;
+    case 'b':
+      // D-Bus Booleans are 32 bits.
+      s_.writeUint32(static_cast<uint32_t>(
+          static_cast<const DBusObjectBoolean &>(obj).getValue()));
+      break;
+    case 'q':
+      s_.writeUint16(static_cast<const DBusObjectUint16 &>(obj).getValue());
+      break;
+    case 'n':
+      s_.writeUint16(static_cast<uint16_t>(
+          static_cast<const DBusObjectInt16 &>(obj).getValue()));
+      break;
+    case 'u':
+      s_.writeUint32(static_cast<const DBusObjectUint32 &>(obj).getValue());
+      break;
+    case 'i':
+      s_.writeUint32(static_cast<uint32_t>(
+          static_cast<const DBusObjectInt32 &>(obj).getValue()));
+      break;
+    case 't':
+      s_.writeUint64(static_cast<const DBusObjectUint64 &>(obj).getValue());
+      break;
+    case 'x':
+      s_.writeUint64(static_cast<uint64_t>(
+          static_cast<const DBusObjectInt64 &>(obj).getValue()));
+      break;
+    case 'd':
+      s_.writeDouble(static_cast<const DBusObjectDouble &>(obj).getValue());
+      break;
+    case 'h':
+      s_.writeUint32(static_cast<const DBusObjectUnixFD &>(obj).getValue());
+      break;
+    case 's':
+      writeString(static_cast<const DBusObjectString &>(obj).getView());
+      break;
+    case 'o':
+      writeString(static_cast<const DBusObjectPath &>(obj).getView());
+      break;
+    case 'g': {
+      const std::string_view str =
+          static_cast<const DBusObjectSignature &>(obj).getView();
+      const uint8_t len = str.size();
+      s_.writeByte(len);
+      // Include the terminating zero byte.
+      s_.writeBytes(str.data(), len + 1);
+      break;
+    }
+    case 'v':
+      serializeVariant(static_cast<const DBusObjectVariant &>(obj));
+      break;
+    case '{': {
+      const DBusObjectDictEntry &d =
+          static_cast<const DBusObjectDictEntry &>(obj);
+      serialize(*d.getKey());
+      serialize(*d.getValue());
+      break;
+    }
+    case 'a':
+      serializeArray(static_cast<const DBusObjectArray &>(obj));
+      break;
+    default: {
+      assert(typeCode == '(');
+      const DBusObjectStruct &st = static_cast<const DBusObjectStruct &>(obj);
+      const size_t n = st.numFields();
+      for (size_t i = 0; i < n; i++) {
+        serialize(*st.getElement(i));
+      }
+      break;
+    }
+    }
+  }
+};
+
+template <class Sink> void serializeTo(Sink &s, const DBusObject &obj) {
+  SerializeVisitor<Sink> visitor(s);
+  visitor.serialize(obj);
+}
+
+// Same as `DBusMessage::serialize`, but uses `SerializeVisitor`.
+template <class Sink> void serializeTo(Sink &s, const DBusMessage &message) {
+  SerializeVisitor<Sink> visitor(s);
+  visitor.serialize(message.getHeader());
+  if (message.hasBody()) {
+    // The body should be 8-byte aligned.
+    s.insertPadding(DBusTypeUint64::instance_.alignment());
+    const DBusMessageBody &body = message.getBody();
+    const size_t n = body.numElements();
+    for (size_t i = 0; i < n; i++) {
+      visitor.serialize(*body.getElement(i));
+    }
+  }
+}
+
+// Serialize `message` in a single pass, appending the bytes to `buf`.
+template <Endianness endianness>
+void serializeMessage(std::vector<char> &buf, const DBusMessage &message) {
+  SerializeToVector<endianness> s(buf);
+  serializeTo(s, message);
+}
+
+// Writes a message straight into a byte vector, without building a
+// `DBusObject` tree for the header. The header fields are written one at
+// a time, and the two sizes which aren't known in advance (of the header
+// fields array and of the body) are patched in afterwards, so nothing is
+// serialized twice. Usage: add the header fields, then call `writeBody()`
+// or `finish()`. The output is identical to `serializeMessage` on the
+// equivalent `DBusMessage`, including the alignment being relative to
+// the start of the vector.
+template <Endianness endianness> class DBusMessageWriter final {
+  std::vector<char> &buf_; // Not owned
+  SerializeToVector<endianness> s_;
+
+  // Position of the body size in the fixed part of the header.
+  const size_t bodySizePos_;
+
+  // Position of the header fields array size, and of its first element.
+  const size_t fieldsSizePos_;
+  const size_t fieldsStart_;
+
+  template <typename T> void writeAt(size_t pos, T x) {
+    writeWireValue<endianness>(&buf_[pos], x);
+  }
+
+  // Start a header field, which is a `(yv)` struct, up to the value of
+  // the variant. `typeCode` is the signature of the variant.
+  void beginField(const HeaderFieldName name, const char typeCode) {
+    s_.insertPadding(8);
+    s_.writeByte(name);
+    s_.writeByte(1);
+    s_.writeByte(typeCode);
+    s_.writeByte('\0');
+  }
+
+  // Patch the header fields array size and pad the header, which is
+  // followed by the body.
+  void finishHeader() {
+    writeAt(fieldsSizePos_, static_cast<uint32_t>(buf_.size() - fieldsStart_));
+    s_.insertPadding(8);
+  }
+
+public:
+  DBusMessageWriter(std::vector<char> &buf, const MessageType type,
+                    const MessageFlags flags, const uint32_t serialNumber)
+      : buf_(buf), s_(buf), bodySizePos_(alignup(buf.size(), 8) + 4),
+        fieldsSizePos_(bodySizePos_ + 8), fieldsStart_(fieldsSizePos_ + 4) {
+    // The header is a `(yyyyuua(yv))` struct, so it is 8-byte aligned.
+    s_.insertPadding(8);
+    s_.writeByte(endianness == LittleEndian ? 'l' : 'B');
+    s_.writeByte(type);
+    s_.writeByte(flags);
+    s_.writeByte(1); // Major protocol version
+    s_.writeUint32(0); // Body size, which is patched later
+    s_.writeUint32(serialNumber);
+    s_.writeUint32(0); // Header fields array size, which is patched later
+    // The array elements are 8-byte aligned, which `fieldsStart_`
+    // already is, so no padding is needed here.
+  }
+
+  DBusMessageWriter(const DBusMessageWriter &) = delete;
+  DBusMessageWriter &operator=(const DBusMessageWriter &) = delete;
+
+  void addStringField(const HeaderFieldName name, std::string_view str) {
+    beginField(name, 's');
+    s_.insertPadding(4);
+    s_.writeUint32(str.size());
+    s_.writeBytes(str.data(), str.size());
+    s_.writeByte('\0');
+  }
+
+  void addPathField(const HeaderFieldName name, std::string_view path) {
+    beginField(name, 'o');
+    s_.insertPadding(4);
+    s_.writeUint32(path.size());
+    s_.writeBytes(path.data(), path.size());
+    s_.writeByte('\0');
+  }
+
+  void addUint32Field(const HeaderFieldName name, const uint32_t x) {
+    beginField(name, 'u');
+    s_.insertPadding(4);
+    s_.writeUint32(x);
+  }
+
+  // Add the SIGNATURE field. The signature is written directly from the
+  // types of the body elements.
+  void addSignatureField(const DBusMessageBody &body) {
+    beginField(MSGHDR_SIGNATURE, 'g');
+    const size_t sizePos = buf_.size();
+    s_.writeByte(0); // Signature length, which is patched below
+    const size_t n = body.numElements();
+    for (size_t i = 0; i < n; i++) {
+      body.getElement(i)->getType().serialize(s_);
+    }
+    const size_t size = buf_.size() - sizePos - 1;
+    if (size > 0xFF) {
+      throw Error("Message body signature is too long.");
+    }
+    buf_[sizePos] = static_cast<char>(size);
+    s_.writeByte('\0');
+  }
+
+  // Finish a message which has no body.
+  void finish() { finishHeader(); }
+
+  // Finish the header and then serialize the body.
+  void writeBody(const DBusMessageBody &body) {
+    finishHeader();
+    const size_t bodyStart = buf_.size();
+    SerializeVisitor<SerializeToVector<endianness>> visitor(s_);
+    const size_t n = body.numElements();
+    for (size_t i = 0; i < n; i++) {
+      visitor.serialize(*body.getElement(i));
+    }
+    writeAt(bodySizePos_, static_cast<uint32_t>(buf_.size() - bodyStart));
+  }
 };
 
 // Warning: this serializer is only suitable for serializing types, not
@@ -0,0 +1,282 @@
+// Copyright 2020-2024 Kevin Backhouse.
+//
+// This file is part of DBusParse.
+//
+// DBusParse is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// DBusParse is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with DBusParse.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "dbus.hpp"
+#include <string.h>
+
+// Flat representation of a parsed message, which is an alternative to
+// the tree of `DBusObject`s for code that only needs to read the
+// message. The values are stored in pre-order in a single vector of
+// fixed-size nodes (the "tape"), and the bytes of the strings are stored
+// in a separate buffer. A container node records its number of elements
+// and the index of the node after its last descendant, so a `Cursor` can
+// step over a container without visiting its contents. A variant has two
+// elements: its signature and its value, in the same order as on the
+// wire.
+//
+// The tape is filled by the streaming parser (see
+// `DBusMessage::parseEvents`), so it isn't owned by the parser and needs
+// to stay alive, at the same address, until parsing is complete. Parsing
+// a new message into the same tape reuses its memory, so a tape which is
+// reused for every message doesn't allocate in the steady state.
+class DBusTape final : private DBusMessage::EventHandler {
+public:
+  struct Node {
+    // Scalars: the value, zero-extended to 64 bits. A double is stored
+    // as its bit pattern. Strings: the offset of the string in the
+    // string buffer. Containers: the index of the node after the
+    // container's last descendant.
+    uint64_t value_;
+
+    // Containers: the number of elements. Strings: the length.
+    uint32_t size_;
+
+    // The D-Bus type code, for example 'u' or 's'. Containers use 'a',
+    // '(', '{' and 'v'.
+    char code_;
+  };
+
+  // Lightweight reference to a node of the tape, which is used to
+  // navigate the tape. It is only valid while the tape is unchanged. A
+  // cursor also knows where the enclosing container ends, so that it can
+  // step through the elements of the container with `next()` until
+  // `atEnd()` returns true.
+  class Cursor final {
+    const DBusTape *tape_;
+    size_t index_;
+    size_t end_;
+
+    const Node &node() const { return tape_->nodes_[index_]; }
+
+    const Node &checkNotAtEnd() const {
+      if (atEnd()) {
+        throw std::out_of_range("DBusTape::Cursor");
+      }
+      return node();
+    }
+
+    const Node &checkCode(char code, const char *name) const {
+      if (atEnd() || node().code_ != code) {
+        throw ObjectCastError(name);
+      }
+      return node();
+    }
+
+    const Node &checkContainer() const {
+      if (!isContainer()) {
+        throw ObjectCastError("Container");
+      }
+      return node();
+    }
+
+  public:
+    Cursor(const DBusTape &tape, size_t index, size_t end)
+        : tape_(&tape), index_(index), end_(end) {}
+
+    bool atEnd() const { return index_ >= end_; }
+
+    size_t getIndex() const { return index_; }
+
+    char getTypeCode() const { return checkNotAtEnd().code_; }
+
+    bool isContainer() const {
+      if (atEnd()) {
+        return false;
+      }
+      const char code = node().code_;
+      return code == 'a' || code == '(' || code == '{' || code == 'v';
+    }
+
+    // The next element of the enclosing container. Steps over the
+    // contents of a container in constant time.
+    Cursor next() const {
+      const Node &n = checkNotAtEnd();
+      const size_t index =
+          n.code_ == 'a' || n.code_ == '(' || n.code_ == '{' || n.code_ == 'v'
+              ? n.value_
+              : index_ + 1;
+      return Cursor(*tape_, index, end_);
+    }
+
+    // Number of elements of a container.
+    size_t numElements() const { return checkContainer().size_; }
+
+    // Cursor for the first element of a container. It is at the end if
+    // the container is empty.
+    Cursor getFirstElement() const {
+      const Node &n = checkContainer();
+      return Cursor(*tape_, index_ + 1, n.value_);
+    }
+
+    // Cursor for element `i` of a container. This steps over the
+    // preceding elements, so it takes time proportional to `i`.
+    Cursor getElement(size_t i) const {
+      if (i >= numElements()) {
+        throw std::out_of_range("DBusTape::Cursor::getElement");
+      }
+      Cursor c = getFirstElement();
+      for (; i > 0; --i) {
+        c = c.next();
+      }
+      return c;
+    }
+
+    std::string_view getVariantSignature() const {
+      checkCode('v', "Variant");
+      return Cursor(*tape_, index_ + 1, end_).getString();
+    }
+
+    Cursor getVariantValue() const {
+      checkCode('v', "Variant");
+      return getFirstElement().next();
+    }
+
+    char getChar() const { return checkCode('y', "Char").value_; }
+    bool getBoolean() const { return checkCode('b', "Boolean").value_; }
+    uint16_t getUint16() const { return checkCode('q', "Uint16").value_; }
+    int16_t getInt16() const { return checkCode('n', "Int16").value_; }
+    uint32_t getUint32() const { return checkCode('u', "Uint32").value_; }
+    int32_t getInt32() const { return checkCode('i', "Int32").value_; }
+    uint64_t getUint64() const { return checkCode('t', "Uint64").value_; }
+    int64_t getInt64() const { return checkCode('x', "Int64").value_; }
+    uint32_t getUnixFD() const { return checkCode('h', "UnixFD").value_; }
+
+    double getDouble() const {
+      const uint64_t x = checkCode('d', "Double").value_;
+      double d;
+      memcpy(&d, &x, sizeof(d));
+      return d;
+    }
+
+    // Works for strings, object paths and signatures. The string is
+    // followed by a NUL byte, like on the wire.
+    std::string_view getString() const {
+      if (!atEnd()) {
+        const Node &n = node();
+        if (n.code_ == 's' || n.code_ == 'o' || n.code_ == 'g') {
+          return std::string_view(tape_->strings_.data() + n.value_, n.size_);
+        }
+      }
+      throw ObjectCastError("String");
+    }
+  };
+
+private:
+  std::vector<Node> nodes_;
+  std::string strings_;
+
+  // Indices of the containers which haven't been closed yet.
+  std::vector<size_t> open_;
+
+  // Index of the first node of the body, if the tape contains a message.
+  size_t bodyIndex_;
+
+  void add(char code, uint64_t value, uint32_t size) {
+    if (!open_.empty()) {
+      ++nodes_[open_.back()].size_;
+    }
+    nodes_.push_back(Node{value, size, code});
+  }
+
+  void addString(char code, std::string_view str) {
+    const size_t offset = strings_.size();
+    strings_.append(str);
+    strings_.push_back('\0');
+    add(code, offset, str.size());
+  }
+
+  void begin(char code) {
+    add(code, 0, 0);
+    open_.push_back(nodes_.size() - 1);
+  }
+
+  void end() {
+    nodes_[open_.back()].value_ = nodes_.size();
+    open_.pop_back();
+  }
+
+  void onChar(char c) override { add('y', static_cast<uint8_t>(c), 0); }
+  void onBoolean(bool b) override { add('b', b, 0); }
+  void onUint16(uint16_t x) override { add('q', x, 0); }
+  void onInt16(int16_t x) override { add('n', static_cast<uint16_t>(x), 0); }
+  void onUint32(uint32_t x) override { add('u', x, 0); }
+  void onInt32(int32_t x) override { add('i', static_cast<uint32_t>(x), 0); }
+  void onUint64(uint64_t x) override { add('t', x, 0); }
+  void onInt64(int64_t x) override { add('x', static_cast<uint64_t>(x), 0); }
+  void onDouble(double d) override {
+    uint64_t x;
+    memcpy(&x, &d, sizeof(x));
+    add('d', x, 0);
+  }
+  void onUnixFD(uint32_t i) override { add('h', i, 0); }
+  void onString(std::string_view str) override { addString('s', str); }
+  void onPath(std::string_view str) override { addString('o', str); }
+  void onSignature(std::string_view str) override { addString('g', str); }
+  void beginVariant(const DBusType &t) override;
+  void endVariant() override { end(); }
+  void beginDictEntry() override { begin('{'); }
+  void endDictEntry() override { end(); }
+  void beginArray(const DBusType &, uint32_t) override { begin('a'); }
+  void endArray() override { end(); }
+  void beginStruct() override { begin('('); }
+  void endStruct() override { end(); }
+  void endHeader() override { bodyIndex_ = nodes_.size(); }
+
+public:
+  DBusTape() : bodyIndex_(0) {}
+
+  DBusTape(const DBusTape &) = delete;
+  DBusTape &operator=(const DBusTape &) = delete;
+
+  // Remove the contents of the tape, but keep its memory.
+  void clear();
+
+  // Parse a message into `tape`, replacing its previous contents. The
+  // header is the first value on the tape, and it is followed by the
+  // values of the body.
+  template <Endianness endianness>
+  static std::unique_ptr<Parse::Cont> parseMessage(DBusTape &tape);
+
+  // Version of `parseMessage` which detects the byte order like
+  // `DBusMessage::parseAuto`.
+  static std::unique_ptr<Parse::Cont> parseMessageAuto(DBusTape &tape);
+
+  // Parse a single value of type `t` into `tape`, replacing its previous
+  // contents.
+  template <Endianness endianness>
+  static std::unique_ptr<Parse::Cont> parseObject(DBusTape &tape,
+                                                  const DBusType &t);
+
+  const std::vector<Node> &getNodes() const { return nodes_; }
+
+  // Cursor for the first value on the tape.
+  Cursor begin() const { return Cursor(*this, 0, nodes_.size()); }
+
+  // Cursor for the header of a message. The header has the same layout
+  // as `headerType`.
+  Cursor getHeader() const { return Cursor(*this, 0, bodyIndex_); }
+
+  // Cursor for the first value of the body of a message. It is at the
+  // end if the body is empty.
+  Cursor getBody() const { return Cursor(*this, bodyIndex_, nodes_.size()); }
+
+  // Find the value of a header field of a message. The result is at the
+  // end if the field isn't present.
+  Cursor findHeaderField(HeaderFieldName name) const;
+};
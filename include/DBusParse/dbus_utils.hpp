@@ -18,8 +18,191 @@
 #pragma once
 
 #include "dbus.hpp"
+#include "dbus_serialize.hpp"
+#include "utils.hpp"
+#include <deque>
+#include <functional>
 #include <memory>
 
+// Sends messages to a file descriptor. Its buffers are reused from one
+// message to the next, so once they have grown to the size of the
+// largest message, sending a message doesn't allocate any memory.
+// Like `send_dbus_message`, errors are reported on stderr.
+class DBusConnectionWriter final {
+  const int fd_; // Not owned
+  SerializeToIovec<LittleEndian> serializer_;
+  std::vector<struct iovec> iov_;
+  std::vector<char> control_;
+
+  // Serialize the message into `serializer_` and `iov_`. Returns the
+  // size of the message.
+  size_t serialize(const DBusMessage &message);
+
+public:
+  explicit DBusConnectionWriter(const int fd) : fd_(fd) {}
+
+  DBusConnectionWriter(const DBusConnectionWriter &) = delete;
+  DBusConnectionWriter &operator=(const DBusConnectionWriter &) = delete;
+
+  void send(const DBusMessage &message);
+
+  void sendWithFds(const DBusMessage &message, const size_t nfds,
+                   const int *fds);
+};
+
+// Outgoing message queue for a non-blocking socket, for use in an event
+// loop. Messages are serialized when they are pushed, so the caller
+// doesn't need to keep them alive. `flush()` sends as much of the queue as
+// the socket will accept, so it should be called again when the socket
+// becomes writable (`EPOLLOUT`) until it returns true. File descriptors
+// which are attached to a message are duplicated when the message is
+// pushed, sent with the first chunk of the message, and then closed.
+class DBusSendQueue final {
+  struct Entry {
+    std::vector<char> bytes_;
+    std::vector<AutoCloseFD> fds_;
+  };
+
+  const int fd_; // Not owned
+  std::deque<Entry> queue_;
+
+  // Number of bytes of the message at the front of the queue which have
+  // already been sent.
+  size_t offset_;
+
+  // Total number of bytes in the queue which haven't been sent yet.
+  size_t pendingBytes_;
+
+  // Buffers which are reused to avoid allocating memory in steady state.
+  std::vector<std::vector<char>> spareBuffers_;
+  std::vector<struct iovec> iov_;
+  std::vector<char> control_;
+
+  // Remove `n` bytes from the front of the queue after they've been sent.
+  void consume(size_t n);
+
+public:
+  // Maximum number of messages which are sent in one `sendmsg` call.
+  static const size_t maxIovecs_ = 64;
+
+  // Maximum number of buffers which are kept in `spareBuffers_`.
+  static const size_t maxSpareBuffers_ = 16;
+
+  // Buffers with a larger capacity than this are freed rather than
+  // reused, so that one unusually large message doesn't pin its memory
+  // for the lifetime of the queue.
+  static const size_t maxSpareBufferSize_ = 64 * 1024;
+
+  explicit DBusSendQueue(const int fd)
+      : fd_(fd), offset_(0), pendingBytes_(0) {}
+
+  DBusSendQueue(const DBusSendQueue &) = delete;
+  DBusSendQueue &operator=(const DBusSendQueue &) = delete;
+
+  void push(const DBusMessage &message) { pushWithFds(message, 0, nullptr); }
+
+  void pushWithFds(const DBusMessage &message, const size_t nfds,
+                   const int *fds);
+
+  // Send as much of the queue as possible without blocking. Returns true
+  // if the queue is now empty, or false if the socket is full. Throws an
+  // `ErrorWithErrno` if `sendmsg` fails for any other reason.
+  bool flush();
+
+  bool empty() const { return queue_.empty(); }
+
+  size_t pendingBytes() const { return pendingBytes_; }
+};
+
+// Incoming message reader for a non-blocking socket, for use in an event
+// loop. When the socket is readable (`EPOLLIN`), call `receive()`, which
+// reads until the socket would block and returns every message that has
+// been completed. A message which is split across several reads is
+// parsed incrementally, so no bytes are ever read twice. File descriptors
+// which are passed with SCM_RIGHTS are attached to their message.
+//
+// Every read is as large as the buffer, so a batch of small messages
+// (for example, a flood of signals) costs one syscall rather than one
+// per message. `receiveOnce()` does exactly one read, which makes it
+// suitable for blocking sockets too.
+class DBusMessageReader final {
+  const int fd_; // Not owned
+
+  // The parser copies the bytes that it needs, so the buffer is
+  // completely consumed after every read.
+  std::vector<char> buf_;
+
+  // Ancillary data buffer for `recvmsg`.
+  std::vector<char> control_;
+
+  // File descriptors which have been received, but not yet attached to a
+  // message. They arrive with the first byte of their message, so they
+  // are attached (in order) when the message is complete.
+  std::deque<AutoCloseFD> pendingFds_;
+
+  // The message which is currently being parsed.
+  std::unique_ptr<DBusMessage> message_;
+  std::unique_ptr<Parse> parse_;
+
+  // Chunk size of the arena for each message, or 0 if messages are
+  // allocated on the heap.
+  size_t arenaChunkSize_;
+
+public:
+  // Callback which receives each message as soon as it is complete.
+  typedef std::function<void(std::unique_ptr<DBusMessage> &&)> Handler;
+
+private:
+  // Create the parser for the next message, with an arena if
+  // `useArenas()` has been called.
+  std::unique_ptr<Parse> mkParser();
+
+  void feed(const char *buf, size_t bufsize, const Handler &handler);
+
+  // Do a single `recvmsg` (retrying if it is interrupted) and pass the
+  // completed messages to `handler`. Returns the number of bytes that
+  // were read, 0 if the peer has closed the connection, or -1 if the
+  // socket would block.
+  ssize_t readOnce(const Handler &handler);
+
+public:
+  explicit DBusMessageReader(const int fd, const size_t bufsize = 0x10000);
+
+  DBusMessageReader(const DBusMessageReader &) = delete;
+  DBusMessageReader &operator=(const DBusMessageReader &) = delete;
+
+  // Allocate each message that is received from now on in its own
+  // `ParseArena` (see the arena constructor of `Parse`), which is freed
+  // when the message is deleted. If a message has already been partially
+  // received, then it is still allocated on the heap.
+  void useArenas(const size_t chunkSize = 4096);
+
+  // Read from the socket until it would block and append the completed
+  // messages to `messages`. Returns false if the peer has closed the
+  // connection. Throws a `ParseError` if a message is invalid, or if the
+  // connection is closed in the middle of a message, and an
+  // `ErrorWithErrno` if `recvmsg` fails for a reason other than `EAGAIN`.
+  bool receive(std::vector<std::unique_ptr<DBusMessage>> &messages);
+
+  // Same as above, but messages are passed to `handler` instead of being
+  // collected in a vector.
+  bool receive(const Handler &handler);
+
+  // Do a single read, which blocks if the socket is blocking and no data
+  // is available, and append the completed messages to `messages`. An
+  // incomplete message is carried over to the next call. Returns false
+  // if the peer has closed the connection. Throws the same errors as
+  // `receive()`.
+  bool receiveOnce(std::vector<std::unique_ptr<DBusMessage>> &messages);
+
+  // Same as above, but messages are passed to `handler`.
+  bool receiveOnce(const Handler &handler);
+};
+
+// These construct a temporary `DBusConnectionWriter`, so they allocate
+// new buffers every time they're called. To send several messages to the
+// same file descriptor without allocating, keep a `DBusConnectionWriter`
+// and use it for all of them.
 void send_dbus_message_with_fds(const int fd, const DBusMessage &message,
                                 const size_t nfds, const int *fds);
 
@@ -29,6 +212,8 @@ void print_dbus_object(const int fd, const DBusObject &obj);
 
 void print_dbus_message(const int fd, const DBusMessage &message);
 
+// Blocking receive of a single message. If `fd` is a socket, then any
+// file descriptors which were sent with the message are attached to it.
 std::unique_ptr<DBusMessage> receive_dbus_message(const int fd);
 
 std::unique_ptr<DBusMessage> mk_dbus_method_call_msg(
@@ -46,6 +231,27 @@ std::unique_ptr<DBusMessage> mk_dbus_method_error_reply_msg(
     const uint32_t replySerialNumber, // serial number that we are replying to
     std::string &&destination, std::string &&errmsg);
 
+// Serialize a message straight into `buf`, without creating a
+// `DBusMessage`. The bytes are the same as serializing the message which
+// is created by the corresponding `mk_dbus_method_*_msg` function, but
+// the header isn't built as a tree of `DBusObject`s and the body is only
+// traversed once.
+void serialize_dbus_method_call_msg(
+    std::vector<char> &buf, const uint32_t serialNumber,
+    const DBusMessageBody &body, std::string_view path,
+    std::string_view interface, std::string_view destination,
+    std::string_view member, const size_t nfds, const MessageFlags flags);
+
+void serialize_dbus_method_reply_msg(
+    std::vector<char> &buf, const uint32_t serialNumber,
+    const uint32_t replySerialNumber, // serial number that we are replying to
+    const DBusMessageBody &body, std::string_view destination);
+
+void serialize_dbus_method_error_reply_msg(
+    std::vector<char> &buf, const uint32_t serialNumber,
+    const uint32_t replySerialNumber, // serial number that we are replying to
+    std::string_view destination, std::string_view errmsg);
+
 void dbus_method_call_with_fds(const int fd, const uint32_t serialNumber,
                                std::unique_ptr<DBusMessageBody> &&body,
                                std::string &&path, std::string &&interface,
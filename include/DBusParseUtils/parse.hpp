@@ -19,8 +19,15 @@
 
 #include "endianness.hpp"
 #include <assert.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <memory>
+#include <new>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 
 // Continuation-passing-style parser implementation. The main class
 // is `Parse`. You initialize the parser with a continuation of
@@ -62,6 +69,95 @@ public:
   const char *what() const noexcept override { return msg_.c_str(); }
 };
 
+// Continuations are allocated and freed at a very high rate: parsing a
+// single message header creates dozens of them, and each one is
+// typically freed as soon as it has been invoked. The continuation base
+// classes inherit from this class, which gives them a class-specific
+// `operator new` that recycles memory through per-thread free lists
+// (one per size class). In the steady state, the parser doesn't need to
+// call malloc for its continuations at all.
+class ParseAlloc {
+public:
+  static void *operator new(size_t size);
+  static void operator delete(void *p, size_t size);
+};
+
+// Bump allocator for objects which all have the same lifetime, such as
+// the objects of a parsed message (see the arena constructor of `Parse`).
+// Memory is carved out of large chunks and is only freed when the arena
+// is deleted, so deleting the arena is cheap regardless of how many
+// objects were allocated in it. Nothing which is allocated with `alloc`
+// is ever destroyed, so it mustn't own any memory outside of the arena.
+// Objects which do, such as a `std::vector`, can be allocated with `mk`
+// instead, which runs their destructor when the arena is deleted. The
+// arena is not thread-safe.
+class ParseArena final {
+  struct Chunk {
+    Chunk *next_;
+  };
+
+  // Linked list of destructors for the objects created by `mk`. The
+  // nodes are allocated in the arena.
+  struct Cleanup {
+    Cleanup *next_;
+    void (*destroy_)(void *);
+    void *p_;
+  };
+
+  Chunk *chunks_;
+  Cleanup *cleanups_;
+
+  // The unused part of the current chunk.
+  uintptr_t pos_;
+  uintptr_t end_;
+
+  // The size of the next chunk. It doubles every time a chunk is
+  // allocated, up to `maxChunkSize_`.
+  size_t chunkSize_;
+  static const size_t maxChunkSize_ = 0x100000;
+
+  // Allocate a chunk of `size` bytes and add it to `chunks_`.
+  Chunk *newChunk(size_t size);
+
+  void *allocSlow(size_t size, size_t alignment);
+
+  void addCleanup(void (*destroy)(void *), void *p);
+
+public:
+  explicit ParseArena(size_t chunkSize = 4096);
+  ~ParseArena();
+
+  ParseArena(const ParseArena &) = delete;
+  ParseArena &operator=(const ParseArena &) = delete;
+
+  // Allocate `size` bytes. The alignment must be a power of two, no
+  // bigger than `alignof(std::max_align_t)`.
+  void *alloc(size_t size, size_t alignment) {
+    const uintptr_t p = (pos_ + alignment - 1) & ~(alignment - 1);
+    if (p <= end_ && size <= end_ - p) {
+      pos_ = p + size;
+      return reinterpret_cast<void *>(p);
+    }
+    return allocSlow(size, alignment);
+  }
+
+  // Create an object of type `T` in the arena. Its destructor is called
+  // when the arena is deleted.
+  template <class T, class... Args> T *mk(Args &&...args) {
+    T *p = ::new (alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    if constexpr (!std::is_trivially_destructible<T>::value) {
+      addCleanup([](void *x) { static_cast<T *>(x)->~T(); }, p);
+    }
+    return p;
+  }
+
+  // Copy `str` into the arena. The copy is followed by a zero byte.
+  std::string_view copyString(std::string_view str);
+
+  // The number of chunks that have been allocated.
+  size_t numChunks() const;
+};
+
 class Parse final {
 public:
   // This class has a virtual method which is the continuation function.
@@ -79,11 +175,39 @@ public:
   protected:
     // The number of bytes parsed so far.
     // This is used for calculating alignments.
-    size_t pos_;
+    mutable size_t pos_;
+
+    // The complete input, if the parser is in zero-copy mode. Otherwise
+    // null. See the comment on the zero-copy constructor of `Parse`.
+    std::shared_ptr<const char> buffer_;
+
+    // The arena for the parsed objects, if there is one. See the arena
+    // constructor of `Parse`.
+    std::shared_ptr<ParseArena> arena_;
+
+    // The input that follows the bytes which were passed to the current
+    // continuation, if it is already in the buffer that `feed()` is
+    // processing. Otherwise both are null. `takeLookahead` consumes bytes
+    // from it, so these (and `pos_`) are mutable.
+    mutable const char *lookahead_ = nullptr;
+    mutable const char *lookaheadEnd_ = nullptr;
 
     explicit State(size_t pos) : pos_(pos) {}
 
-    void reset() { pos_ = 0; }
+    State(size_t pos, const std::shared_ptr<const char> &buffer)
+        : pos_(pos), buffer_(buffer) {}
+
+    State(size_t pos, const std::shared_ptr<const char> &buffer,
+          const std::shared_ptr<ParseArena> &arena)
+        : pos_(pos), buffer_(buffer), arena_(arena) {}
+
+    void reset() {
+      pos_ = 0;
+      buffer_.reset();
+      arena_.reset();
+      lookahead_ = nullptr;
+      lookaheadEnd_ = nullptr;
+    }
 
   public:
     // No copy constructor
@@ -91,6 +215,25 @@ public:
 
     size_t getPos() const { return pos_; }
 
+    const std::shared_ptr<const char> &getBuffer() const { return buffer_; }
+
+    const std::shared_ptr<ParseArena> &getArena() const { return arena_; }
+
+    // If the next `n` bytes of the input are already in the buffer that
+    // `feed()` is processing, then consume them and return a pointer to
+    // them. Otherwise return null. This is how a continuation can consume
+    // a few bytes that it knows about in advance, such as padding (see
+    // `ParseZeros::skip`), without creating another continuation.
+    const char *takeLookahead(size_t n) const {
+      if (static_cast<size_t>(lookaheadEnd_ - lookahead_) < n) {
+        return nullptr;
+      }
+      const char *result = lookahead_;
+      lookahead_ += n;
+      pos_ += n;
+      return result;
+    }
+
     static const State initialState_;
   };
 
@@ -98,17 +241,73 @@ private:
   State state_;
   std::unique_ptr<Parse::Cont> cont_;
 
+  // Used by `feed()` to hold the bytes of a partially received field,
+  // when the end of the input buffer leaves fewer than
+  // `minRequiredBytes()` bytes. The result of `minRequiredBytes()` is a
+  // `uint8_t`, so 255 bytes is always enough.
+  char pending_[255];
+  uint8_t pendingSize_;
+
+  // Same as `parse()`, but the continuations can also consume input from
+  // `[next, end)` with `Parse::State::takeLookahead`. Returns the first
+  // byte which wasn't consumed.
+  const char *parseWithLookahead(const char *buf, size_t bufsize,
+                                 const char *next, const char *end);
+
 public:
   // No copy constructor
   Parse(const Parse &) = delete;
 
   // For initializing the parser.
   explicit Parse(std::unique_ptr<Parse::Cont> &&cont)
-      : state_(0), cont_(std::move(cont)) {}
+      : state_(0), cont_(std::move(cont)), pendingSize_(0) {}
+
+  // For initializing the parser in zero-copy mode. The caller promises
+  // that `buffer` contains the complete input: the bytes fed to the
+  // parser must be the contents of `buffer`, starting at offset zero.
+  // Strings are then not copied out of the input. Instead, the
+  // continuations receive a `std::string_view` into `buffer` (see
+  // `ParseNChars::Cont::parseView`) and can share ownership of the buffer
+  // via `Parse::State::getBuffer()`.
+  Parse(const std::shared_ptr<const char> &buffer,
+        std::unique_ptr<Parse::Cont> &&cont)
+      : state_(0, buffer), cont_(std::move(cont)), pendingSize_(0) {}
+
+  // For initializing the parser with an arena, so that the parsed objects
+  // are allocated in `arena` rather than individually on the heap. (The
+  // parser decides which objects are created in the arena. For example,
+  // `DBusMessage::parse` creates the whole message in it, and the message
+  // then shares ownership of the arena.) If `buffer` isn't null, then the
+  // parser is in zero-copy mode, as above.
+  //
+  // Some parsers create objects as soon as they are constructed (for
+  // example, an empty struct doesn't need any input), so the initial
+  // continuation is created by calling `mkCont` with the initial state,
+  // which already has the arena: `mkCont(const Parse::State &)` must
+  // return a `std::unique_ptr<Parse::Cont>`.
+  //
+  // If the parser is deleted before parsing is complete, then the
+  // partially parsed objects are deleted first, so the arena must outlive
+  // the parser unless the parser owns the only reference to it. `reset()`
+  // removes the arena.
+  template <class F>
+  Parse(const std::shared_ptr<ParseArena> &arena,
+        const std::shared_ptr<const char> &buffer, F &&mkCont)
+      : state_(0, buffer, arena), cont_(mkCont(state_)), pendingSize_(0) {}
 
   void reset(std::unique_ptr<Parse::Cont> &&cont) {
-    state_.reset();
+    // The old continuation is deleted first, because it may own objects
+    // which are in the old arena.
     cont_ = std::move(cont);
+    state_.reset();
+    pendingSize_ = 0;
+  }
+
+  // Reset the parser in zero-copy mode.
+  void reset(const std::shared_ptr<const char> &buffer,
+             std::unique_ptr<Parse::Cont> &&cont) {
+    reset(std::move(cont));
+    state_.buffer_ = buffer;
   }
 
   // Before calling this method, you should call `minRequiredBytes()`
@@ -126,6 +325,21 @@ public:
   // is complete.
   void parse(const char *buf, size_t bufsize);
 
+  // Feed the parser an arbitrary amount of input. This is a convenience
+  // wrapper around `parse()`, which loops over the buffer so that the
+  // caller doesn't need to worry about `minRequiredBytes()` and
+  // `maxRequiredBytes()`. If the buffer ends in the middle of a field,
+  // then the leftover bytes are stashed internally and the field is
+  // completed by the next call to `feed()`. The result is the number of
+  // bytes consumed, which is less than `bufsize` only if parsing
+  // finished before the end of the buffer. (The remaining bytes belong
+  // to whatever comes next, for example the next message.)
+  size_t feed(const char *buf, size_t bufsize);
+
+  // The number of bytes stashed by `feed()` which haven't been parsed
+  // yet. They are not included in `getPos()`.
+  size_t getPendingSize() const { return pendingSize_; }
+
   // The number of bytes parsed so far.
   size_t getPos() const { return state_.pos_; }
 
@@ -145,7 +359,7 @@ public:
   size_t maxRequiredBytes() const;
 };
 
-class Parse::Cont {
+class Parse::Cont : public ParseAlloc {
 public:
   virtual ~Cont() {}
   virtual std::unique_ptr<Parse::Cont>
@@ -180,7 +394,7 @@ public:
 
 class ParseChar final : public Parse::Cont {
 public:
-  class Cont {
+  class Cont : public ParseAlloc {
   public:
     virtual ~Cont() {}
     virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p,
@@ -208,7 +422,7 @@ public:
 
 template <Endianness endianness> class ParseUint16 final : public Parse::Cont {
 public:
-  class Cont {
+  class Cont : public ParseAlloc {
   public:
     virtual ~Cont() {}
     virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p,
@@ -229,8 +443,11 @@ public:
     (void)bufsize;
     assert(bufsize == sizeof(uint16_t));
     static_assert(endianness == LittleEndian || endianness == BigEndian);
-    const uint16_t x = endianness == LittleEndian ? le16toh(*(uint16_t *)buf)
-                                                  : be16toh(*(uint16_t *)buf);
+    // `buf` isn't necessarily aligned, so copy it into a local.
+    uint16_t raw;
+    memcpy(&raw, buf, sizeof(raw));
+    const uint16_t x =
+        endianness == LittleEndian ? le16toh(raw) : be16toh(raw);
     return cont_->parse(p, x);
   }
 
@@ -245,7 +462,7 @@ public:
 
 template <Endianness endianness> class ParseUint32 final : public Parse::Cont {
 public:
-  class Cont {
+  class Cont : public ParseAlloc {
   public:
     virtual ~Cont() {}
     virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p,
@@ -266,8 +483,10 @@ public:
     (void)bufsize;
     assert(bufsize == sizeof(uint32_t));
     static_assert(endianness == LittleEndian || endianness == BigEndian);
-    const uint32_t x = endianness == LittleEndian ? le32toh(*(uint32_t *)buf)
-                                                  : be32toh(*(uint32_t *)buf);
+    uint32_t raw;
+    memcpy(&raw, buf, sizeof(raw));
+    const uint32_t x =
+        endianness == LittleEndian ? le32toh(raw) : be32toh(raw);
     return cont_->parse(p, x);
   }
 
@@ -282,7 +501,7 @@ public:
 
 template <Endianness endianness> class ParseUint64 final : public Parse::Cont {
 public:
-  class Cont {
+  class Cont : public ParseAlloc {
   public:
     virtual ~Cont() {}
     virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p,
@@ -303,8 +522,10 @@ public:
     (void)bufsize;
     assert(bufsize == sizeof(uint64_t));
     static_assert(endianness == LittleEndian || endianness == BigEndian);
-    const uint64_t x = endianness == LittleEndian ? le64toh(*(uint64_t *)buf)
-                                                  : be64toh(*(uint64_t *)buf);
+    uint64_t raw;
+    memcpy(&raw, buf, sizeof(raw));
+    const uint64_t x =
+        endianness == LittleEndian ? le64toh(raw) : be64toh(raw);
     return cont_->parse(p, x);
   }
 
@@ -320,29 +541,48 @@ public:
 // Parser for a std::string with a known length.
 class ParseNChars final : public Parse::Cont {
 public:
-  class Cont {
+  class Cont : public ParseAlloc {
   public:
     virtual ~Cont() {}
     virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p,
                                                std::string &&str) = 0;
+
+    // Called instead of `parse()` when the parser is in zero-copy mode.
+    // `str` points into `p.getBuffer()`. The default implementation
+    // copies the string, so only the continuations which can make use
+    // of the view need to override this method.
+    virtual std::unique_ptr<Parse::Cont> parseView(const Parse::State &p,
+                                                   std::string_view str) {
+      return parse(p, std::string(str));
+    }
   };
 
 private:
   // Buffer for the bytes. (May already contain some bytes
   // which were already received on a previous iteration.)
+  // Not used in zero-copy mode.
   std::string str_;
 
+  // Byte position of the start of the string.
+  const size_t start_;
+
   // Number of bytes we expect to receive.
   const size_t n_;
 
   // Continuation
   std::unique_ptr<Cont> cont_;
 
+  static std::unique_ptr<Parse::Cont> mk(const Parse::State &p,
+                                         std::string &&str, size_t start,
+                                         size_t n,
+                                         std::unique_ptr<Cont> &&cont);
+
 public:
   // This constructor is only public for std::make_unique's benefit.
   // Use factory method `mk()` to construct.
-  ParseNChars(std::string &&str, size_t n, std::unique_ptr<Cont> &&cont)
-      : str_(std::move(str)), n_(n), cont_(std::move(cont)) {}
+  ParseNChars(std::string &&str, size_t start, size_t n,
+              std::unique_ptr<Cont> &&cont)
+      : str_(std::move(str)), start_(start), n_(n), cont_(std::move(cont)) {}
 
   virtual std::unique_ptr<Parse::Cont>
   parse(const Parse::State &p, const char *buf, size_t bufsize) override;
@@ -350,7 +590,10 @@ public:
   // Factory method.
   static std::unique_ptr<Parse::Cont> mk(const Parse::State &p,
                                          std::string &&str, size_t n,
-                                         std::unique_ptr<Cont> &&cont);
+                                         std::unique_ptr<Cont> &&cont) {
+    const size_t start = p.getPos() - str.size();
+    return mk(p, std::move(str), start, n, std::move(cont));
+  }
 
   uint8_t minRequiredBytes() const override { return 0; }
   size_t maxRequiredBytes() const override { return n_; }
@@ -359,7 +602,7 @@ public:
 // Parse N bytes and check that they are all zero bytes.
 class ParseZeros final : public Parse::Cont {
 public:
-  class Cont {
+  class Cont : public ParseAlloc {
   public:
     virtual ~Cont() {}
     virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p) = 0;
@@ -382,10 +625,27 @@ public:
   parse(const Parse::State &p, const char *buf, size_t bufsize) override;
 
   // Factory method.
-  // Note: if `n == 0` then this will invoke the continuation immediately.
+  // Note: if `n == 0`, or if `skip` succeeds, then this will invoke the
+  // continuation immediately.
   static std::unique_ptr<Parse::Cont> mk(const Parse::State &p, size_t n,
                                          std::unique_ptr<Cont> &&cont);
 
+  // If the next `n` bytes are already in the input buffer (see
+  // `Parse::State::takeLookahead`), then check them with `check` and
+  // return true. Otherwise return false, in which case the caller needs
+  // to create a `ParseZeros` continuation for them. Padding is usually
+  // in the buffer already, so parsers call this where they align, to
+  // avoid allocating a continuation for the padding.
+  static bool skip(const Parse::State &p, size_t n);
+
+  // Check that the `bufsize` bytes in `buf` are all zero, and throw a
+  // `ParseError` if not. `pos` is the byte position of `buf[0]`, which is
+  // used to report the position of the first non-zero byte. The bytes are
+  // checked a word at a time, without a branch per byte. This doesn't
+  // create a continuation, so it can be called directly by parsers that
+  // already have the bytes in their buffer.
+  static void check(size_t pos, const char *buf, size_t bufsize);
+
   uint8_t minRequiredBytes() const override { return 0; }
   size_t maxRequiredBytes() const override { return n_; }
 };
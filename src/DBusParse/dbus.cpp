@@ -37,58 +37,176 @@ const DBusTypePath DBusTypePath::instance_;
 const DBusTypeSignature DBusTypeSignature::instance_;
 const DBusTypeVariant DBusTypeVariant::instance_;
 
-DBusObjectChar::DBusObjectChar(char c) : c_(c) {}
+DBusObjectChar::DBusObjectChar(char c) : DBusObject('y'), c_(c) {}
 
-DBusObjectBoolean::DBusObjectBoolean(bool b) : b_(b) {}
+DBusObjectBoolean::DBusObjectBoolean(bool b) : DBusObject('b'), b_(b) {}
 
-DBusObjectUint16::DBusObjectUint16(uint16_t x) : x_(x) {}
+DBusObjectUint16::DBusObjectUint16(uint16_t x) : DBusObject('q'), x_(x) {}
 
-DBusObjectInt16::DBusObjectInt16(int16_t x) : x_(x) {}
+DBusObjectInt16::DBusObjectInt16(int16_t x) : DBusObject('n'), x_(x) {}
 
-DBusObjectUint32::DBusObjectUint32(uint32_t x) : x_(x) {}
+DBusObjectUint32::DBusObjectUint32(uint32_t x) : DBusObject('u'), x_(x) {}
 
-DBusObjectInt32::DBusObjectInt32(int32_t x) : x_(x) {}
+DBusObjectInt32::DBusObjectInt32(int32_t x) : DBusObject('i'), x_(x) {}
 
-DBusObjectUint64::DBusObjectUint64(uint64_t x) : x_(x) {}
+DBusObjectUint64::DBusObjectUint64(uint64_t x) : DBusObject('t'), x_(x) {}
 
-DBusObjectInt64::DBusObjectInt64(int64_t x) : x_(x) {}
+DBusObjectInt64::DBusObjectInt64(int64_t x) : DBusObject('x'), x_(x) {}
 
-DBusObjectDouble::DBusObjectDouble(double d) : d_(d) {}
+DBusObjectDouble::DBusObjectDouble(double d) : DBusObject('d'), d_(d) {}
 
-DBusObjectUnixFD::DBusObjectUnixFD(uint32_t i) : i_(i) {}
+DBusObjectUnixFD::DBusObjectUnixFD(uint32_t i) : DBusObject('h'), i_(i) {}
 
-DBusObjectString::DBusObjectString(std::string &&str) : str_(std::move(str)) {
+DBusObjectString::DBusObjectString(std::string &&str)
+    : DBusObject('s'), str_(std::move(str)) {
   // String length must fit in a `uint32_t`.
   assert((str_.size() >> 32) == 0);
 }
 
-DBusObjectPath::DBusObjectPath(std::string &&str) : str_(std::move(str)) {
+DBusObjectString::DBusObjectString(ParseArena &arena, std::string_view str)
+    : DBusObject('s'), str_(arena, str) {
+  // String length must fit in a `uint32_t`.
+  assert((str_.size() >> 32) == 0);
+}
+
+DBusObjectString::DBusObjectString(const std::shared_ptr<const char> &buffer,
+                                   std::string_view str)
+    : DBusObject('s'), str_(buffer, str) {
+  // String length must fit in a `uint32_t`.
+  assert((str_.size() >> 32) == 0);
+}
+
+DBusObjectPath::DBusObjectPath(std::string &&str)
+    : DBusObject('o'), str_(std::move(str)) {
+  // String length must fit in a `uint32_t`.
+  assert((str_.size() >> 32) == 0);
+}
+
+DBusObjectPath::DBusObjectPath(ParseArena &arena, std::string_view str)
+    : DBusObject('o'), str_(arena, str) {
+  // String length must fit in a `uint32_t`.
+  assert((str_.size() >> 32) == 0);
+}
+
+DBusObjectPath::DBusObjectPath(const std::shared_ptr<const char> &buffer,
+                               std::string_view str)
+    : DBusObject('o'), str_(buffer, str) {
   // String length must fit in a `uint32_t`.
   assert((str_.size() >> 32) == 0);
 }
 
 DBusObjectSignature::DBusObjectSignature(std::string &&str)
-    : str_(std::move(str)) {
+    : DBusObject('g'), str_(std::move(str)) {
+  // String length must fit in a `uint8_t`.
+  assert((str_.size() >> 8) == 0);
+}
+
+DBusObjectSignature::DBusObjectSignature(ParseArena &arena,
+                                         std::string_view str)
+    : DBusObject('g'), str_(arena, str) {
+  // String length must fit in a `uint8_t`.
+  assert((str_.size() >> 8) == 0);
+}
+
+DBusObjectSignature::DBusObjectSignature(
+    const std::shared_ptr<const char> &buffer, std::string_view str)
+    : DBusObject('g'), str_(buffer, str) {
   // String length must fit in a `uint8_t`.
   assert((str_.size() >> 8) == 0);
 }
 
 DBusObjectVariant::DBusObjectVariant(std::unique_ptr<DBusObject> &&object)
-    : object_(std::move(object)), signature_(object_->getType().toString()) {}
+    : DBusObject('v'), object_(std::move(object)), arena_(nullptr) {}
+
+DBusObjectVariant::DBusObjectVariant(
+    std::unique_ptr<DBusObject> &&object,
+    std::unique_ptr<const DBusTypeStorage> &&typeStorage)
+    : DBusObject('v'), typeStorage_(std::move(typeStorage)),
+      object_(std::move(object)), arena_(nullptr) {}
+
+DBusObjectVariant::DBusObjectVariant(ParseArena &arena,
+                                     std::unique_ptr<DBusObject> &&object)
+    : DBusObject('v'), object_(std::move(object)), arena_(&arena) {
+  assert(object_->isInArena());
+}
+
+const DBusObjectSignature &DBusObjectVariant::getSignature() const {
+  if (!signature_) {
+    if (arena_) {
+      signature_ = DBusObject::mkInArena<DBusObjectSignature>(
+          *arena_, *arena_, object_->getType().toString());
+    } else {
+      signature_ = DBusObjectSignature::mk(object_->getType().toString());
+    }
+  }
+  return static_cast<const DBusObjectSignature &>(*signature_);
+}
 
 DBusObjectDictEntry::DBusObjectDictEntry(std::unique_ptr<DBusObject> &&key,
                                          std::unique_ptr<DBusObject> &&value)
-    : key_(std::move(key)), value_(std::move(value)),
-      dictEntryType_(key_->getType(), value_->getType()) {}
+    : DBusObject('{'), key_(std::move(key)), value_(std::move(value)),
+      ownedType_(std::make_unique<DBusTypeDictEntry>(key_->getType(),
+                                                     value_->getType())),
+      dictEntryType_(*ownedType_) {}
+
+DBusObjectDictEntry::DBusObjectDictEntry(std::unique_ptr<DBusObject> &&key,
+                                         std::unique_ptr<DBusObject> &&value,
+                                         const DBusTypeDictEntry &dictEntryType)
+    : DBusObject('{'), key_(std::move(key)), value_(std::move(value)),
+      dictEntryType_(dictEntryType) {}
 
 DBusObjectSeq::DBusObjectSeq(
     std::vector<std::unique_ptr<DBusObject>> &&elements)
-    : elements_(std::move(elements)) {}
+    : elements_(std::move(elements)), data_(elements_.data()),
+      size_(elements_.size()) {}
+
+// Move the elements into an array in `arena`.
+static const std::unique_ptr<DBusObject> *
+moveToArena(ParseArena &arena,
+            std::vector<std::unique_ptr<DBusObject>> &elements) {
+  const size_t n = elements.size();
+  if (n == 0) {
+    return nullptr;
+  }
+  std::unique_ptr<DBusObject> *data =
+      static_cast<std::unique_ptr<DBusObject> *>(
+          arena.alloc(n * sizeof(std::unique_ptr<DBusObject>),
+                      alignof(std::unique_ptr<DBusObject>)));
+  for (size_t i = 0; i < n; i++) {
+    // A sequence in an arena is never destroyed, so it mustn't own an
+    // object on the heap.
+    assert(elements[i]->isInArena());
+    ::new (&data[i]) std::unique_ptr<DBusObject>(std::move(elements[i]));
+  }
+  return data;
+}
+
+DBusObjectSeq::DBusObjectSeq(
+    ParseArena &arena, std::vector<std::unique_ptr<DBusObject>> &&elements)
+    : data_(moveToArena(arena, elements)), size_(elements.size()) {}
 
 DBusObjectArray::DBusObjectArray(
     const DBusType &baseType,
     std::vector<std::unique_ptr<DBusObject>> &&elements)
-    : seq_(std::move(elements)), arrayType_(baseType) {}
+    : DBusObject('a'), seq_(std::move(elements)),
+      ownedType_(std::make_unique<DBusTypeArray>(baseType)),
+      arrayType_(*ownedType_) {}
+
+DBusObjectArray::DBusObjectArray(
+    std::vector<std::unique_ptr<DBusObject>> &&elements,
+    const DBusTypeArray &arrayType)
+    : DBusObject('a'), seq_(std::move(elements)), arrayType_(arrayType) {}
+
+DBusObjectArray::DBusObjectArray(
+    ParseArena &arena, std::vector<std::unique_ptr<DBusObject>> &&elements,
+    const DBusTypeArray &arrayType)
+    : DBusObject('a'), seq_(arena, std::move(elements)),
+      arrayType_(arrayType) {}
+
+DBusObjectArray::DBusObjectArray(const DBusType &baseType)
+    : DBusObject('a'), seq_(std::vector<std::unique_ptr<DBusObject>>()),
+      ownedType_(std::make_unique<DBusTypeArray>(baseType)),
+      arrayType_(*ownedType_) {}
 
 DBusObjectArray0::DBusObjectArray0(
     const DBusType &baseType,
@@ -111,17 +229,34 @@ DBusObjectArray::mk0(const DBusType &baseType) {
 
 DBusObjectStruct::DBusObjectStruct(
     std::vector<std::unique_ptr<DBusObject>> &&elements)
-    : seq_(std::move(elements)), structType_(seq_.elementTypes()) {}
+    : DBusObject('('), seq_(std::move(elements)),
+      ownedType_(std::make_unique<DBusTypeStruct>(seq_.elementTypes())),
+      structType_(*ownedType_) {}
 
-DBusHeaderField::DBusHeaderField(HeaderFieldName name,
-                                 std::unique_ptr<DBusObjectVariant> &&v)
-    : DBusObjectStruct(_vec(_obj(DBusObjectChar::mk(name)), std::move(v))) {}
+DBusObjectStruct::DBusObjectStruct(
+    std::vector<std::unique_ptr<DBusObject>> &&elements,
+    const DBusTypeStruct &structType)
+    : DBusObject('('), seq_(std::move(elements)), structType_(structType) {}
+
+DBusObjectStruct::DBusObjectStruct(
+    ParseArena &arena, std::vector<std::unique_ptr<DBusObject>> &&elements,
+    const DBusTypeStruct &structType)
+    : DBusObject('('), seq_(arena, std::move(elements)),
+      structType_(structType) {}
 
+// The header types are static, so they are interned.
 static const DBusTypeStruct headerFieldType(
     _vec(std::reference_wrapper<const DBusType>(DBusTypeChar::instance_),
-         std::reference_wrapper<const DBusType>(DBusTypeVariant::instance_)));
+         std::reference_wrapper<const DBusType>(DBusTypeVariant::instance_)),
+    true);
+
+// All header fields have the same type, so they share `headerFieldType`.
+DBusHeaderField::DBusHeaderField(HeaderFieldName name,
+                                 std::unique_ptr<DBusObjectVariant> &&v)
+    : DBusObjectStruct(_vec(_obj(DBusObjectChar::mk(name)), std::move(v)),
+                       headerFieldType) {}
 
-static const DBusTypeArray headerFieldsType(headerFieldType);
+static const DBusTypeArray headerFieldsType(headerFieldType, true);
 
 // The type of the header of a DBus message.
 const DBusTypeStruct headerType(
@@ -131,12 +266,23 @@ const DBusTypeStruct headerType(
          std::reference_wrapper<const DBusType>(DBusTypeChar::instance_),
          std::reference_wrapper<const DBusType>(DBusTypeUint32::instance_),
          std::reference_wrapper<const DBusType>(DBusTypeUint32::instance_),
-         std::reference_wrapper<const DBusType>(headerFieldsType)));
+         std::reference_wrapper<const DBusType>(headerFieldsType)),
+    true);
 
 DBusMessageBody::DBusMessageBody(
     std::vector<std::unique_ptr<DBusObject>> &&elements)
     : seq_(std::move(elements)) {}
 
+DBusMessageBody::DBusMessageBody(
+    std::vector<std::unique_ptr<DBusObject>> &&elements,
+    const std::shared_ptr<const DBusSignatureTypes> &types)
+    : types_(types), seq_(std::move(elements)) {}
+
+DBusMessageBody::DBusMessageBody(
+    ParseArena &arena, std::vector<std::unique_ptr<DBusObject>> &&elements,
+    const std::shared_ptr<const DBusSignatureTypes> &types)
+    : types_(types), seq_(arena, std::move(elements)) {}
+
 std::unique_ptr<DBusMessageBody> DBusMessageBody::mk0() {
   return std::make_unique<DBusMessageBody>(
       std::vector<std::unique_ptr<DBusObject>>());
@@ -152,6 +298,72 @@ DBusMessageBody::mk(std::vector<std::unique_ptr<DBusObject>> &&elements) {
   return std::make_unique<DBusMessageBody>(std::move(elements));
 }
 
+std::unique_ptr<DBusMessageBody>
+DBusMessageBody::mk(std::vector<std::unique_ptr<DBusObject>> &&elements,
+                    const std::shared_ptr<const DBusSignatureTypes> &types) {
+  return std::make_unique<DBusMessageBody>(std::move(elements), types);
+}
+
+void DBusMessage::indexHeaderFields() {
+  fieldIndex_.fill(nullptr);
+  duplicateHeaderField_ = false;
+  // A message can be constructed with any header, so don't assume that
+  // it has the standard type. (The parsers always create the standard
+  // type, so this is only a pointer comparison for a parsed message.)
+  headerIndexed_ = header_->getType().equals(headerType);
+  if (!headerIndexed_) {
+    return;
+  }
+  const DBusObjectArray &fields = getHeader().getElement(6)->toArray();
+  const size_t n = fields.numElements();
+  for (size_t i = 0; i < n; i++) {
+    const DBusObjectStruct &field = fields.getElement(i)->toStruct();
+    const uint8_t name = field.getElement(0)->toChar().getValue();
+    if (name >= fieldIndex_.size()) {
+      continue;
+    }
+    if (fieldIndex_[name]) {
+      duplicateHeaderField_ = true;
+      continue;
+    }
+    fieldIndex_[name] = &field.getElement(1)->toVariant();
+  }
+}
+
+const DBusTypeArray &DBusTypeStorage::allocArray(const DBusType &baseType) {
+  std::unique_ptr<DBusTypeArray> &t = arrays_[&baseType];
+  if (!t) {
+    t = std::make_unique<DBusTypeArray>(baseType, interned_);
+  }
+  return *t;
+}
+
+const DBusTypeDictEntry &
+DBusTypeStorage::allocDictEntry(const DBusType &keyType,
+                                const DBusType &valueType) {
+  std::unique_ptr<DBusTypeDictEntry> &t =
+      dict_entries_[std::make_pair(&keyType, &valueType)];
+  if (!t) {
+    t = std::make_unique<DBusTypeDictEntry>(keyType, valueType, interned_);
+  }
+  return *t;
+}
+
+const DBusTypeStruct &DBusTypeStorage::allocStruct(
+    std::vector<std::reference_wrapper<const DBusType>> &&fieldTypes) {
+  auto it = structs_.find(FieldTypesKey(fieldTypes));
+  if (it != structs_.end()) {
+    return *it->second;
+  }
+  // The key refers to the field types of the new struct type, which has
+  // a stable address.
+  std::unique_ptr<DBusTypeStruct> t =
+      std::make_unique<DBusTypeStruct>(std::move(fieldTypes), interned_);
+  const DBusTypeStruct &result = *t;
+  structs_.emplace(FieldTypesKey(result.getFieldTypes()), std::move(t));
+  return result;
+}
+
 const DBusType &cloneType(DBusTypeStorage &typeStorage, // Type allocator
                           const DBusType &t) {
   class CloneVisitor final : public DBusType::Visitor {
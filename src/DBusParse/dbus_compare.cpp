@@ -0,0 +1,482 @@
+// Copyright 2020-2024 Kevin Backhouse.
+//
+// This file is part of DBusParse.
+//
+// DBusParse is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// DBusParse is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with DBusParse.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "dbus.hpp"
+#include <string.h>
+
+// 64-bit hash function. The input is fed in as 64-bit words, and the
+// final mixing step is the finalizer of MurmurHash3, so that every bit of
+// the input affects every bit of the result.
+class DBusHasher final {
+  uint64_t h_;
+
+public:
+  DBusHasher() : h_(0x9e3779b97f4a7c15ull) {}
+
+  void add(uint64_t x) {
+    h_ ^= x * 0xff51afd7ed558ccdull;
+    h_ = ((h_ << 31) | (h_ >> 33)) * 0xc4ceb9fe1a85ec53ull;
+  }
+
+  // The bytes are packed into words in little-endian order, so the hash
+  // doesn't depend on the host's byte order.
+  void addString(std::string_view str) {
+    const size_t n = str.size();
+    add(n);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      uint64_t w = 0;
+      for (size_t j = 0; j < 8; j++) {
+        w |= uint64_t(uint8_t(str[i + j])) << (8 * j);
+      }
+      add(w);
+    }
+    if (i < n) {
+      uint64_t w = 0;
+      for (size_t j = 0; i + j < n; j++) {
+        w |= uint64_t(uint8_t(str[i + j])) << (8 * j);
+      }
+      add(w);
+    }
+  }
+
+  uint64_t get() const {
+    uint64_t h = h_;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+  }
+};
+
+// Generates the characters of a type's signature one at a time, using an
+// explicit stack rather than recursion.
+class DBusTypeSignatureChars final : private DBusType::Visitor {
+  // The types that haven't been visited yet, in reverse order. A null
+  // entry is a closing bracket, which is stored in `close_`.
+  struct Item {
+    const DBusType *t_;
+    char close_;
+  };
+
+  std::vector<Item> stack_;
+  char c_;
+
+  void visitChar(const DBusTypeChar &) override { c_ = 'y'; }
+  void visitBoolean(const DBusTypeBoolean &) override { c_ = 'b'; }
+  void visitUint16(const DBusTypeUint16 &) override { c_ = 'q'; }
+  void visitInt16(const DBusTypeInt16 &) override { c_ = 'n'; }
+  void visitUint32(const DBusTypeUint32 &) override { c_ = 'u'; }
+  void visitInt32(const DBusTypeInt32 &) override { c_ = 'i'; }
+  void visitUint64(const DBusTypeUint64 &) override { c_ = 't'; }
+  void visitInt64(const DBusTypeInt64 &) override { c_ = 'x'; }
+  void visitDouble(const DBusTypeDouble &) override { c_ = 'd'; }
+  void visitUnixFD(const DBusTypeUnixFD &) override { c_ = 'h'; }
+  void visitString(const DBusTypeString &) override { c_ = 's'; }
+  void visitPath(const DBusTypePath &) override { c_ = 'o'; }
+  void visitSignature(const DBusTypeSignature &) override { c_ = 'g'; }
+  void visitVariant(const DBusTypeVariant &) override { c_ = 'v'; }
+  void visitDictEntry(const DBusTypeDictEntry &t) override {
+    c_ = '{';
+    stack_.push_back(Item{nullptr, '}'});
+    stack_.push_back(Item{&t.getValueType(), 0});
+    stack_.push_back(Item{&t.getKeyType(), 0});
+  }
+  void visitArray(const DBusTypeArray &t) override {
+    c_ = 'a';
+    stack_.push_back(Item{&t.getBaseType(), 0});
+  }
+  void visitStruct(const DBusTypeStruct &t) override {
+    c_ = '(';
+    stack_.push_back(Item{nullptr, ')'});
+    const auto &fieldTypes = t.getFieldTypes();
+    for (size_t i = fieldTypes.size(); i > 0; --i) {
+      stack_.push_back(Item{&fieldTypes[i - 1].get(), 0});
+    }
+  }
+
+public:
+  explicit DBusTypeSignatureChars(const DBusType &t) {
+    stack_.push_back(Item{&t, 0});
+  }
+
+  // The type code of `t`, which is the first character of its signature.
+  static char typeCode(const DBusType &t) {
+    DBusTypeSignatureChars chars(t);
+    char c = 0;
+    chars.next(c);
+    return c;
+  }
+
+  // Returns false when the end of the signature has been reached.
+  bool next(char &c) {
+    if (stack_.empty()) {
+      return false;
+    }
+    const Item item = stack_.back();
+    stack_.pop_back();
+    if (item.t_) {
+      item.t_->accept(*this);
+      c = c_;
+    } else {
+      c = item.close_;
+    }
+    return true;
+  }
+};
+
+bool DBusType::equals(const DBusType &other) const {
+  if (this == &other) {
+    return true;
+  }
+  DBusTypeSignatureChars chars0(*this);
+  DBusTypeSignatureChars chars1(other);
+  char c0 = 0;
+  char c1 = 0;
+  while (chars0.next(c0)) {
+    if (!chars1.next(c1) || c0 != c1) {
+      return false;
+    }
+  }
+  return !chars1.next(c1);
+}
+
+uint64_t DBusType::hash() const {
+  DBusHasher h;
+  DBusTypeSignatureChars chars(*this);
+  char c = 0;
+  while (chars.next(c)) {
+    h.add(static_cast<uint8_t>(c));
+  }
+  return h.get();
+}
+
+// One step of the pre-order traversal of an object (see
+// `DBusObjectTokens`). Containers are described by their element count,
+// which is enough to make the sequence of tokens unambiguous, and by their
+// element type if they are empty arrays. (The type of a non-empty
+// container can be deduced from its elements.)
+struct DBusObjectToken {
+  char code_;
+  uint64_t value_;
+  std::string_view str_;
+  const DBusType *type_;
+};
+
+// Generates the tokens of an object (or of a message body) one at a time,
+// using an explicit stack rather than recursion. The elements of packed
+// arrays are generated directly from their values, so the same tokens are
+// generated regardless of whether an array is packed.
+class DBusObjectTokens final : private DBusObject::Visitor {
+public:
+  enum Kind { Body, Array, Struct, DictEntry, Variant, Packed };
+
+  // A container whose elements haven't all been visited yet.
+  struct Frame {
+    Kind kind_;
+    const void *container_;
+    size_t i_;
+    size_t n_;
+
+    // Only used by `Packed` frames.
+    size_t valueSize_;
+    char code_;
+  };
+
+private:
+  std::vector<Frame> stack_;
+  const DBusObject *root_;
+  DBusObjectToken token_;
+
+  void scalarToken(char code, uint64_t value) {
+    token_ = DBusObjectToken{code, value, std::string_view(), nullptr};
+  }
+
+  void stringToken(char code, std::string_view str) {
+    token_ = DBusObjectToken{code, 0, str, nullptr};
+  }
+
+  void containerToken(char code, Kind kind, const void *container, size_t n) {
+    token_ = DBusObjectToken{code, n, std::string_view(), nullptr};
+    if (n > 0) {
+      stack_.push_back(Frame{kind, container, 0, n, 0, 0});
+    }
+  }
+
+  void visitChar(const DBusObjectChar &obj) override {
+    scalarToken('y', static_cast<uint8_t>(obj.getValue()));
+  }
+  void visitBoolean(const DBusObjectBoolean &obj) override {
+    scalarToken('b', obj.getValue());
+  }
+  void visitUint16(const DBusObjectUint16 &obj) override {
+    scalarToken('q', obj.getValue());
+  }
+  void visitInt16(const DBusObjectInt16 &obj) override {
+    scalarToken('n', static_cast<uint16_t>(obj.getValue()));
+  }
+  void visitUint32(const DBusObjectUint32 &obj) override {
+    scalarToken('u', obj.getValue());
+  }
+  void visitInt32(const DBusObjectInt32 &obj) override {
+    scalarToken('i', static_cast<uint32_t>(obj.getValue()));
+  }
+  void visitUint64(const DBusObjectUint64 &obj) override {
+    scalarToken('t', obj.getValue());
+  }
+  void visitInt64(const DBusObjectInt64 &obj) override {
+    scalarToken('x', static_cast<uint64_t>(obj.getValue()));
+  }
+  void visitDouble(const DBusObjectDouble &obj) override {
+    const double d = obj.getValue();
+    uint64_t x;
+    memcpy(&x, &d, sizeof(x));
+    scalarToken('d', x);
+  }
+  void visitUnixFD(const DBusObjectUnixFD &obj) override {
+    scalarToken('h', obj.getValue());
+  }
+  void visitString(const DBusObjectString &obj) override {
+    stringToken('s', obj.getView());
+  }
+  void visitPath(const DBusObjectPath &obj) override {
+    stringToken('o', obj.getView());
+  }
+  void visitSignature(const DBusObjectSignature &obj) override {
+    stringToken('g', obj.getView());
+  }
+  void visitVariant(const DBusObjectVariant &obj) override {
+    containerToken('v', Variant, &obj, 1);
+  }
+  void visitDictEntry(const DBusObjectDictEntry &obj) override {
+    containerToken('{', DictEntry, &obj, 2);
+  }
+  void visitArray(const DBusObjectArray &obj) override {
+    const DBusType &baseType =
+        static_cast<const DBusTypeArray &>(obj.getType()).getBaseType();
+    const size_t n = obj.numElements();
+    if (n == 0) {
+      token_ = DBusObjectToken{'a', 0, std::string_view(), &baseType};
+      return;
+    }
+    size_t valueSize = 0;
+    const void *values = obj.packedValues(valueSize);
+    if (values) {
+      token_ = DBusObjectToken{'a', n, std::string_view(), nullptr};
+      const char code = DBusTypeSignatureChars::typeCode(baseType);
+      stack_.push_back(Frame{Packed, values, 0, n, valueSize, code});
+    } else {
+      containerToken('a', Array, &obj, n);
+    }
+  }
+  void visitStruct(const DBusObjectStruct &obj) override {
+    containerToken('(', Struct, &obj, obj.numFields());
+  }
+
+  // Read element `i` of a packed array as a token value.
+  static uint64_t packedValue(const Frame &f, size_t i) {
+    const char *p = static_cast<const char *>(f.container_) + i * f.valueSize_;
+    switch (f.valueSize_) {
+    case sizeof(uint8_t):
+      return *reinterpret_cast<const uint8_t *>(p);
+    case sizeof(uint16_t): {
+      uint16_t x;
+      memcpy(&x, p, sizeof(x));
+      return x;
+    }
+    case sizeof(uint32_t): {
+      uint32_t x;
+      memcpy(&x, p, sizeof(x));
+      return x;
+    }
+    default: {
+      uint64_t x;
+      memcpy(&x, p, sizeof(x));
+      return x;
+    }
+    }
+  }
+
+  static const DBusObject &element(const Frame &f, size_t i) {
+    switch (f.kind_) {
+    case Body:
+      return *static_cast<const DBusMessageBody *>(f.container_)
+                  ->getElement(i);
+    case Array:
+      return *static_cast<const DBusObjectArray *>(f.container_)
+                  ->getElement(i);
+    case Struct:
+      return *static_cast<const DBusObjectStruct *>(f.container_)
+                  ->getElement(i);
+    case DictEntry: {
+      const DBusObjectDictEntry *entry =
+          static_cast<const DBusObjectDictEntry *>(f.container_);
+      return i == 0 ? *entry->getKey() : *entry->getValue();
+    }
+    default:
+      assert(f.kind_ == Variant);
+      return *static_cast<const DBusObjectVariant *>(f.container_)
+                  ->getValue();
+    }
+  }
+
+public:
+  explicit DBusObjectTokens(const DBusObject &obj) : root_(&obj) {}
+
+  // The tokens of a body are the tokens of its elements.
+  explicit DBusObjectTokens(const DBusMessageBody &body) : root_(nullptr) {
+    if (body.numElements() > 0) {
+      stack_.push_back(Frame{Body, &body, 0, body.numElements(), 0, 0});
+    }
+  }
+
+  // If the next tokens are the remaining elements of a packed array, then
+  // return its frame. Otherwise null.
+  Frame *packedFrame() {
+    if (root_ || stack_.empty() || stack_.back().kind_ != Packed) {
+      return nullptr;
+    }
+    return &stack_.back();
+  }
+
+  // Skip the rest of the current container.
+  void popFrame() { stack_.pop_back(); }
+
+  // Returns false when there are no more tokens.
+  bool next(DBusObjectToken &token) {
+    if (root_) {
+      root_->accept(*this);
+      root_ = nullptr;
+      token = token_;
+      return true;
+    }
+    if (stack_.empty()) {
+      return false;
+    }
+    Frame &f = stack_.back();
+    const size_t i = f.i_++;
+    if (f.i_ == f.n_) {
+      // Pop the frame before visiting the element, which might push a
+      // new frame.
+      const Frame last = f;
+      stack_.pop_back();
+      return visitElement(last, i, token);
+    }
+    return visitElement(f, i, token);
+  }
+
+private:
+  bool visitElement(const Frame &f, size_t i, DBusObjectToken &token) {
+    if (f.kind_ == Packed) {
+      token = DBusObjectToken{f.code_, packedValue(f, i), std::string_view(),
+                              nullptr};
+      return true;
+    }
+    element(f, i).accept(*this);
+    token = token_;
+    return true;
+  }
+};
+
+static bool tokensEqual(DBusObjectTokens &tokens0,
+                        DBusObjectTokens &tokens1) {
+  DBusObjectToken t0{};
+  DBusObjectToken t1{};
+  while (true) {
+    // Fast path for packed arrays with the same element type.
+    DBusObjectTokens::Frame *f0 = tokens0.packedFrame();
+    DBusObjectTokens::Frame *f1 = tokens1.packedFrame();
+    if (f0 && f1 && f0->code_ == f1->code_ &&
+        f0->valueSize_ == f1->valueSize_) {
+      // The element counts have already been compared.
+      assert(f0->n_ - f0->i_ == f1->n_ - f1->i_);
+      const char *p0 = static_cast<const char *>(f0->container_);
+      const char *p1 = static_cast<const char *>(f1->container_);
+      if (memcmp(p0 + f0->i_ * f0->valueSize_, p1 + f1->i_ * f1->valueSize_,
+                 (f0->n_ - f0->i_) * f0->valueSize_) != 0) {
+        return false;
+      }
+      tokens0.popFrame();
+      tokens1.popFrame();
+      continue;
+    }
+
+    const bool more0 = tokens0.next(t0);
+    const bool more1 = tokens1.next(t1);
+    if (!more0 || !more1) {
+      return more0 == more1;
+    }
+    if (t0.code_ != t1.code_ || t0.value_ != t1.value_ || t0.str_ != t1.str_) {
+      return false;
+    }
+    if (t0.type_ && !t0.type_->equals(*t1.type_)) {
+      return false;
+    }
+  }
+}
+
+static uint64_t tokensHash(DBusObjectTokens &tokens) {
+  DBusHasher h;
+  DBusObjectToken t{};
+  while (tokens.next(t)) {
+    h.add(static_cast<uint8_t>(t.code_));
+    switch (t.code_) {
+    case 's':
+    case 'o':
+    case 'g':
+      h.addString(t.str_);
+      break;
+    default:
+      h.add(t.value_);
+      if (t.type_) {
+        h.add(t.type_->hash());
+      }
+      break;
+    }
+  }
+  return h.get();
+}
+
+bool DBusObject::equals(const DBusObject &other) const {
+  if (this == &other) {
+    return true;
+  }
+  DBusObjectTokens tokens0(*this);
+  DBusObjectTokens tokens1(other);
+  return tokensEqual(tokens0, tokens1);
+}
+
+uint64_t DBusObject::hash() const {
+  DBusObjectTokens tokens(*this);
+  return tokensHash(tokens);
+}
+
+bool DBusMessageBody::equals(const DBusMessageBody &other) const {
+  if (this == &other) {
+    return true;
+  }
+  DBusObjectTokens tokens0(*this);
+  DBusObjectTokens tokens1(other);
+  return tokensEqual(tokens0, tokens1);
+}
+
+uint64_t DBusMessageBody::hash() const {
+  DBusObjectTokens tokens(*this);
+  return tokensHash(tokens);
+}
@@ -17,6 +17,108 @@
 
 #include "dbus.hpp"
 #include "utils.hpp"
+#include <string.h>
+
+// Create an object of type `T` for the parser. If the parser has an
+// arena, then the object is allocated in it.
+template <class T, class... Args>
+static std::unique_ptr<DBusObject> mkObject(const Parse::State &p,
+                                            Args &&...args) {
+  ParseArena *arena = p.getArena().get();
+  if (arena) {
+    return DBusObject::mkInArena<T>(*arena, std::forward<Args>(args)...);
+  }
+  return std::make_unique<T>(std::forward<Args>(args)...);
+}
+
+// Same as `mkObject`, but for classes which have a separate constructor
+// for arenas, which takes the arena as an extra first argument.
+template <class T, class... Args>
+static std::unique_ptr<DBusObject> mkObjectWithArena(const Parse::State &p,
+                                                     Args &&...args) {
+  ParseArena *arena = p.getArena().get();
+  if (arena) {
+    return DBusObject::mkInArena<T>(*arena, *arena,
+                                    std::forward<Args>(args)...);
+  }
+  return std::make_unique<T>(std::forward<Args>(args)...);
+}
+
+// The arrays, structs and dict entries created by the parser share its
+// type if the type is interned (see `DBusType::isInterned`). Otherwise a
+// container owns a copy of its type, except in an arena, where it refers
+// to a copy that is owned by the arena. The copy is made for every
+// container, but the message parsers only use interned types.
+template <class T>
+static const T &arenaType(ParseArena &arena, const T &type) {
+  if (type.isInterned()) {
+    return type;
+  }
+  DBusTypeStorage *typeStorage = arena.mk<DBusTypeStorage>(true);
+  return static_cast<const T &>(cloneType(*typeStorage, type));
+}
+
+static std::unique_ptr<DBusObject>
+mkArray(const Parse::State &p,
+        std::vector<std::unique_ptr<DBusObject>> &&elements,
+        const DBusTypeArray &arrayType) {
+  ParseArena *arena = p.getArena().get();
+  if (arena) {
+    return DBusObject::mkInArena<DBusObjectArray>(
+        *arena, *arena, std::move(elements), arenaType(*arena, arrayType));
+  }
+  if (arrayType.isInterned()) {
+    return DBusObjectArray::mkWithType(arrayType, std::move(elements));
+  }
+  return DBusObjectArray::mk(arrayType.getBaseType(), std::move(elements));
+}
+
+static std::unique_ptr<DBusObject>
+mkStruct(const Parse::State &p,
+         std::vector<std::unique_ptr<DBusObject>> &&elements,
+         const DBusTypeStruct &structType) {
+  ParseArena *arena = p.getArena().get();
+  if (arena) {
+    return DBusObject::mkInArena<DBusObjectStruct>(
+        *arena, *arena, std::move(elements), arenaType(*arena, structType));
+  }
+  if (structType.isInterned()) {
+    return std::make_unique<DBusObjectStruct>(std::move(elements),
+                                              structType);
+  }
+  return std::make_unique<DBusObjectStruct>(std::move(elements));
+}
+
+static std::unique_ptr<DBusObject>
+mkDictEntry(const Parse::State &p, std::unique_ptr<DBusObject> &&key,
+            std::unique_ptr<DBusObject> &&value,
+            const DBusTypeDictEntry &dictEntryType) {
+  ParseArena *arena = p.getArena().get();
+  if (arena) {
+    return DBusObject::mkInArena<DBusObjectDictEntry>(
+        *arena, std::move(key), std::move(value),
+        arenaType(*arena, dictEntryType));
+  }
+  if (dictEntryType.isInterned()) {
+    return std::make_unique<DBusObjectDictEntry>(
+        std::move(key), std::move(value), dictEntryType);
+  }
+  return std::make_unique<DBusObjectDictEntry>(std::move(key),
+                                               std::move(value));
+}
+
+// Create a string-like object from a view into the input buffer, which
+// the parser only creates in zero-copy mode. An object in an arena can't
+// keep the buffer alive, so the string is copied into the arena instead.
+template <class T>
+static std::unique_ptr<DBusObject> mkStringView(const Parse::State &p,
+                                                std::string_view str) {
+  ParseArena *arena = p.getArena().get();
+  if (arena) {
+    return DBusObject::mkInArena<T>(*arena, *arena, str);
+  }
+  return T::mk(p.getBuffer(), str);
+}
 
 static std::unique_ptr<Parse::Cont>
 parseType(DBusTypeStorage &typeStorage, // Type allocator
@@ -206,13 +308,22 @@ parseType(DBusTypeStorage &typeStorage, // Type allocator
   return ParseChar::mk(std::make_unique<Cont>(typeStorage, std::move(cont)));
 }
 
-// Utility for parsing the correct number of alignment bytes.
+// Utility for parsing the correct number of alignment bytes, followed by
+// the continuation `C`, which is constructed from `args`. The padding is
+// usually already in the input buffer (see `ParseZeros::skip`), in which
+// case `C` is invoked on the stack, so that no continuations need to be
+// allocated for the padding.
+template <class C, class... Args>
 static std::unique_ptr<Parse::Cont>
-parse_alignment(const Parse::State &p, const DBusType &t,
-                std::unique_ptr<ParseZeros::Cont> &&cont) {
+parse_alignment(const Parse::State &p, const DBusType &t, Args &&...args) {
   const size_t pos = p.getPos();
   const size_t padding = (t.alignment() - 1) & -pos;
-  return ParseZeros::mk(p, padding, std::move(cont));
+  if (ParseZeros::skip(p, padding)) {
+    C cont(std::forward<Args>(args)...);
+    return cont.parse(p);
+  }
+  return std::make_unique<ParseZeros>(
+      padding, std::make_unique<C>(std::forward<Args>(args)...));
 }
 
 template <Endianness endianness>
@@ -236,8 +347,7 @@ std::unique_ptr<Parse::Cont> DBusType::mkObjectParser(
     }
   };
 
-  return parse_alignment(p, *this,
-                         std::make_unique<PaddingCont>(*this, std::move(cont)));
+  return parse_alignment<PaddingCont>(p, *this, *this, std::move(cont));
 }
 
 // Template instantiation. This is to make sure that the little-endian
@@ -264,7 +374,7 @@ static std::unique_ptr<Parse::Cont> DBusTypeChar_mkObjectParserImpl(
 
     virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p,
                                                char c) override {
-      return cont_->parse(p, DBusObjectChar::mk(c));
+      return cont_->parse(p, mkObject<DBusObjectChar>(p, c));
     }
   };
 
@@ -299,7 +409,7 @@ static std::unique_ptr<Parse::Cont> DBusTypeBoolean_mkObjectParserImpl(
       if (b > 1) {
         throw ParseError(p.getPos(), "Boolean value that is not 0 or 1.");
       }
-      return cont_->parse(p, DBusObjectBoolean::mk(b));
+      return cont_->parse(p, mkObject<DBusObjectBoolean>(p, b));
     }
   };
 
@@ -330,7 +440,7 @@ static std::unique_ptr<Parse::Cont> DBusTypeUint16_mkObjectParserImpl(
 
     virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p,
                                                uint16_t x) override {
-      return cont_->parse(p, DBusObjectUint16::mk(x));
+      return cont_->parse(p, mkObject<DBusObjectUint16>(p, x));
     }
   };
 
@@ -361,7 +471,8 @@ static std::unique_ptr<Parse::Cont> DBusTypeInt16_mkObjectParserImpl(
 
     virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p,
                                                uint16_t x) override {
-      return cont_->parse(p, DBusObjectInt16::mk(static_cast<int16_t>(x)));
+      return cont_->parse(
+          p, mkObject<DBusObjectInt16>(p, static_cast<int16_t>(x)));
     }
   };
 
@@ -392,7 +503,7 @@ static std::unique_ptr<Parse::Cont> DBusTypeUint32_mkObjectParserImpl(
 
     virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p,
                                                uint32_t x) override {
-      return cont_->parse(p, DBusObjectUint32::mk(x));
+      return cont_->parse(p, mkObject<DBusObjectUint32>(p, x));
     }
   };
 
@@ -423,7 +534,8 @@ static std::unique_ptr<Parse::Cont> DBusTypeInt32_mkObjectParserImpl(
 
     virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p,
                                                uint32_t x) override {
-      return cont_->parse(p, DBusObjectInt32::mk(static_cast<int32_t>(x)));
+      return cont_->parse(
+          p, mkObject<DBusObjectInt32>(p, static_cast<int32_t>(x)));
     }
   };
 
@@ -454,7 +566,7 @@ static std::unique_ptr<Parse::Cont> DBusTypeUint64_mkObjectParserImpl(
 
     virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p,
                                                uint64_t x) override {
-      return cont_->parse(p, DBusObjectUint64::mk(x));
+      return cont_->parse(p, mkObject<DBusObjectUint64>(p, x));
     }
   };
 
@@ -485,7 +597,8 @@ static std::unique_ptr<Parse::Cont> DBusTypeInt64_mkObjectParserImpl(
 
     virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p,
                                                uint64_t x) override {
-      return cont_->parse(p, DBusObjectInt64::mk(static_cast<int64_t>(x)));
+      return cont_->parse(
+          p, mkObject<DBusObjectInt64>(p, static_cast<int64_t>(x)));
     }
   };
 
@@ -522,7 +635,7 @@ static std::unique_ptr<Parse::Cont> DBusTypeDouble_mkObjectParserImpl(
       };
       Cast c;
       c.x_ = i;
-      return cont_->parse(p, DBusObjectDouble::mk(c.d_));
+      return cont_->parse(p, mkObject<DBusObjectDouble>(p, c.d_));
     }
   };
 
@@ -553,7 +666,7 @@ static std::unique_ptr<Parse::Cont> DBusTypeUnixFD_mkObjectParserImpl(
 
     virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p,
                                                uint32_t i) override {
-      return cont_->parse(p, DBusObjectUnixFD::mk(i));
+      return cont_->parse(p, mkObject<DBusObjectUnixFD>(p, i));
     }
   };
 
@@ -576,19 +689,9 @@ std::unique_ptr<Parse::Cont> DBusTypeUnixFD::mkObjectParserImpl(
 static std::unique_ptr<Parse::Cont>
 parseString(const Parse::State &p, size_t len,
             std::unique_ptr<ParseNChars::Cont> &&cont) {
-  class ZerosCont final : public ParseZeros::Cont {
-    std::string str_;
-    const std::unique_ptr<ParseNChars::Cont> cont_;
-
-  public:
-    ZerosCont(std::string &&str, std::unique_ptr<ParseNChars::Cont> &&cont)
-        : str_(std::move(str)), cont_(std::move(cont)) {}
-
-    virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p) override {
-      return cont_->parse(p, std::move(str_));
-    }
-  };
-
+  // The string is followed by a terminating zero byte. Rather than
+  // creating a separate `ParseZeros` continuation for it, we ask
+  // `ParseNChars` for one extra byte and check it here.
   class StringCont final : public ParseNChars::Cont {
     std::unique_ptr<ParseNChars::Cont> cont_;
 
@@ -598,12 +701,22 @@ parseString(const Parse::State &p, size_t len,
 
     virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p,
                                                std::string &&str) override {
-      return ParseZeros::mk(
-          p, 1, std::make_unique<ZerosCont>(std::move(str), std::move(cont_)));
+      assert(str.size() > 0);
+      ParseZeros::check(p.getPos() - 1, &str.back(), 1);
+      str.pop_back();
+      return cont_->parse(p, std::move(str));
+    }
+
+    virtual std::unique_ptr<Parse::Cont>
+    parseView(const Parse::State &p, std::string_view str) override {
+      assert(str.size() > 0);
+      ParseZeros::check(p.getPos() - 1, &str.back(), 1);
+      str.remove_suffix(1);
+      return cont_->parseView(p, str);
     }
   };
 
-  return ParseNChars::mk(p, std::string(), len,
+  return ParseNChars::mk(p, std::string(), len + 1,
                          std::make_unique<StringCont>(std::move(cont)));
 }
 
@@ -662,7 +775,13 @@ static std::unique_ptr<Parse::Cont> DBusTypeString_mkObjectParserImpl(
 
     virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p,
                                                std::string &&str) override {
-      return cont_->parse(p, DBusObjectString::mk(std::move(str)));
+      return cont_->parse(
+          p, mkObjectWithArena<DBusObjectString>(p, std::move(str)));
+    }
+
+    virtual std::unique_ptr<Parse::Cont>
+    parseView(const Parse::State &p, std::string_view str) override {
+      return cont_->parse(p, mkStringView<DBusObjectString>(p, str));
     }
   };
 
@@ -693,7 +812,13 @@ static std::unique_ptr<Parse::Cont> DBusTypePath_mkObjectParserImpl(
 
     virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p,
                                                std::string &&str) override {
-      return cont_->parse(p, DBusObjectPath::mk(std::move(str)));
+      return cont_->parse(
+          p, mkObjectWithArena<DBusObjectPath>(p, std::move(str)));
+    }
+
+    virtual std::unique_ptr<Parse::Cont>
+    parseView(const Parse::State &p, std::string_view str) override {
+      return cont_->parse(p, mkStringView<DBusObjectPath>(p, str));
     }
   };
 
@@ -724,7 +849,13 @@ static std::unique_ptr<Parse::Cont> DBusTypeSignature_mkObjectParserImpl(
 
     virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p,
                                                std::string &&str) override {
-      return cont_->parse(p, DBusObjectSignature::mk(std::move(str)));
+      return cont_->parse(
+          p, mkObjectWithArena<DBusObjectSignature>(p, std::move(str)));
+    }
+
+    virtual std::unique_ptr<Parse::Cont>
+    parseView(const Parse::State &p, std::string_view str) override {
+      return cont_->parse(p, mkStringView<DBusObjectSignature>(p, str));
     }
   };
 
@@ -755,13 +886,31 @@ static std::unique_ptr<Parse::Cont> DBusTypeVariant_mkObjectParserImpl(
 
   public:
     ObjectCont(std::unique_ptr<DBusType::ParseObjectCont<endianness>> &&cont)
-        : cont_(std::move(cont)) {}
+        : typeStorage_(true), cont_(std::move(cont)) {}
 
     DBusTypeStorage &getTypeStorage() { return typeStorage_; }
 
     virtual std::unique_ptr<Parse::Cont>
     parse(const Parse::State &p, std::unique_ptr<DBusObject> &&obj) override {
-      return cont_->parse(p, DBusObjectVariant::mk(std::move(obj)));
+      ParseArena *arena = p.getArena().get();
+      if (arena) {
+        // The arena takes ownership of the types.
+        if (typeStorage_.size() > 0) {
+          arena->mk<DBusTypeStorage>(std::move(typeStorage_));
+        }
+        return cont_->parse(p, DBusObject::mkInArena<DBusObjectVariant>(
+                                   *arena, *arena, std::move(obj)));
+      }
+      if (typeStorage_.size() == 0) {
+        // The type is a basic type, so there's nothing to keep alive.
+        return cont_->parse(p, DBusObjectVariant::mk(std::move(obj)));
+      }
+      // The object shares the types in `typeStorage_`, so the variant
+      // takes ownership of them.
+      return cont_->parse(
+          p, DBusObjectVariant::mk(std::move(obj),
+                                   std::make_unique<const DBusTypeStorage>(
+                                       std::move(typeStorage_))));
     }
   };
 
@@ -852,110 +1001,292 @@ std::unique_ptr<Parse::Cont> DBusTypeVariant::mkObjectParserImpl(
 
 template <Endianness endianness>
 static std::unique_ptr<Parse::Cont> DBusTypeDictEntry_mkObjectParserImpl(
-    const Parse::State &p, const DBusType &keyType, const DBusType &valueType,
+    const Parse::State &p, const DBusTypeDictEntry &dictEntryType,
     std::unique_ptr<DBusType::ParseObjectCont<endianness>> &&cont) {
   class ValueCont final : public DBusType::ParseObjectCont<endianness> {
+    const DBusTypeDictEntry &dictEntryType_;
     std::unique_ptr<DBusObject> key_;
     const std::unique_ptr<DBusType::ParseObjectCont<endianness>> cont_;
 
   public:
-    ValueCont(std::unique_ptr<DBusObject> &&key,
+    ValueCont(const DBusTypeDictEntry &dictEntryType,
+              std::unique_ptr<DBusObject> &&key,
               std::unique_ptr<DBusType::ParseObjectCont<endianness>> &&cont)
-        : key_(std::move(key)), cont_(std::move(cont)) {}
+        : dictEntryType_(dictEntryType), key_(std::move(key)),
+          cont_(std::move(cont)) {}
 
     virtual std::unique_ptr<Parse::Cont>
     parse(const Parse::State &p, std::unique_ptr<DBusObject> &&value) override {
+      // A dict entry in an arena is never destroyed, so it mustn't own
+      // objects on the heap.
+      assert(!p.getArena() || (key_->isInArena() && value->isInArena()));
       return cont_->parse(
-          p, DBusObjectDictEntry::mk(std::move(key_), std::move(value)));
+          p, mkDictEntry(p, std::move(key_), std::move(value), dictEntryType_));
     }
   };
 
   class KeyCont final : public DBusType::ParseObjectCont<endianness> {
-    const DBusType &valueType_;
+    const DBusTypeDictEntry &dictEntryType_;
     std::unique_ptr<DBusType::ParseObjectCont<endianness>> cont_;
 
   public:
-    KeyCont(const DBusType &valueType,
+    KeyCont(const DBusTypeDictEntry &dictEntryType,
             std::unique_ptr<DBusType::ParseObjectCont<endianness>> &&cont)
-        : valueType_(valueType), cont_(std::move(cont)) {}
+        : dictEntryType_(dictEntryType), cont_(std::move(cont)) {}
 
     virtual std::unique_ptr<Parse::Cont>
     parse(const Parse::State &p, std::unique_ptr<DBusObject> &&key) override {
-      return valueType_.mkObjectParser<endianness>(
-          p, std::make_unique<ValueCont>(std::move(key), std::move(cont_)));
+      return dictEntryType_.getValueType().mkObjectParser<endianness>(
+          p, std::make_unique<ValueCont>(dictEntryType_, std::move(key),
+                                         std::move(cont_)));
     }
   };
 
-  return keyType.mkObjectParser<endianness>(
-      p, std::make_unique<KeyCont>(valueType, std::move(cont)));
+  return dictEntryType.getKeyType().mkObjectParser<endianness>(
+      p, std::make_unique<KeyCont>(dictEntryType, std::move(cont)));
 }
 
 std::unique_ptr<Parse::Cont> DBusTypeDictEntry::mkObjectParserImpl(
     const Parse::State &p,
     std::unique_ptr<DBusType::ParseObjectCont<LittleEndian>> &&cont) const {
-  return DBusTypeDictEntry_mkObjectParserImpl(p, keyType_, valueType_,
-                                              std::move(cont));
+  return DBusTypeDictEntry_mkObjectParserImpl(p, *this, std::move(cont));
 }
 
 std::unique_ptr<Parse::Cont> DBusTypeDictEntry::mkObjectParserImpl(
     const Parse::State &p,
     std::unique_ptr<DBusType::ParseObjectCont<BigEndian>> &&cont) const {
-  return DBusTypeDictEntry_mkObjectParserImpl(p, keyType_, valueType_,
-                                              std::move(cont));
+  return DBusTypeDictEntry_mkObjectParserImpl(p, *this, std::move(cont));
 }
 
 template <Endianness endianness>
 static std::unique_ptr<Parse::Cont>
-parseArray(const Parse::State &p, const DBusType &elemType, size_t endpos,
-           std::vector<std::unique_ptr<DBusObject>> &&elements,
+parseArray(const Parse::State &p, const DBusTypeArray &arrayType,
+           size_t endpos, std::vector<std::unique_ptr<DBusObject>> &&elements,
            std::unique_ptr<DBusType::ParseObjectCont<endianness>> &&cont) {
   class Cont final : public DBusType::ParseObjectCont<endianness> {
-    const DBusType &elemType_;
+    const DBusTypeArray &arrayType_;
     const size_t endpos_;
     std::vector<std::unique_ptr<DBusObject>> elements_;
     std::unique_ptr<DBusType::ParseObjectCont<endianness>> cont_;
 
   public:
-    Cont(const DBusType &elemType, size_t endpos,
+    Cont(const DBusTypeArray &arrayType, size_t endpos,
          std::vector<std::unique_ptr<DBusObject>> &&elements,
          std::unique_ptr<DBusType::ParseObjectCont<endianness>> &&cont)
-        : elemType_(elemType), endpos_(endpos), elements_(std::move(elements)),
-          cont_(std::move(cont)) {}
+        : arrayType_(arrayType), endpos_(endpos),
+          elements_(std::move(elements)), cont_(std::move(cont)) {}
 
     virtual std::unique_ptr<Parse::Cont>
     parse(const Parse::State &p, std::unique_ptr<DBusObject> &&obj) override {
       elements_.push_back(std::move(obj));
-      return parseArray(p, elemType_, endpos_, std::move(elements_),
+      return parseArray(p, arrayType_, endpos_, std::move(elements_),
                         std::move(cont_));
     }
   };
 
   const size_t pos = p.getPos();
   if (pos < endpos) {
-    return elemType.mkObjectParser<endianness>(
-        p, std::make_unique<Cont>(elemType, endpos, std::move(elements),
+    return arrayType.getBaseType().mkObjectParser<endianness>(
+        p, std::make_unique<Cont>(arrayType, endpos, std::move(elements),
                                   std::move(cont)));
   } else if (pos == endpos) {
-    return cont->parse(p, DBusObjectArray::mk(elemType, std::move(elements)));
+    return cont->parse(p, mkArray(p, std::move(elements), arrayType));
   } else {
     throw ParseError(pos, "Incorrect array length.");
   }
 }
 
+// Convert the elements of a packed array from wire byte order to host byte
+// order, in place. If the byte orders match then there is nothing to do.
+// Otherwise, this is a simple loop which the compiler can vectorize.
+template <Endianness endianness, typename T>
+static void packedArrayFromWire(std::vector<T> &values) {
+  constexpr Endianness host =
+      __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ ? LittleEndian : BigEndian;
+  if constexpr (sizeof(T) > sizeof(char) && endianness != host) {
+    char *buf = reinterpret_cast<char *>(values.data());
+    const size_t n = values.size();
+    for (size_t i = 0; i < n; i++) {
+      char *q = buf + i * sizeof(T);
+      if constexpr (sizeof(T) == sizeof(uint16_t)) {
+        uint16_t x;
+        memcpy(&x, q, sizeof(x));
+        x = __builtin_bswap16(x);
+        memcpy(q, &x, sizeof(x));
+      } else if constexpr (sizeof(T) == sizeof(uint32_t)) {
+        uint32_t x;
+        memcpy(&x, q, sizeof(x));
+        x = __builtin_bswap32(x);
+        memcpy(q, &x, sizeof(x));
+      } else {
+        static_assert(sizeof(T) == sizeof(uint64_t));
+        uint64_t x;
+        memcpy(&x, q, sizeof(x));
+        x = __builtin_bswap64(x);
+        memcpy(q, &x, sizeof(x));
+      }
+    }
+  }
+}
+
+// Parser for an array of fixed-size elements. Rather than creating a
+// continuation and an object for every element, it copies the bytes
+// straight into a `std::vector<T>`, which becomes the storage of a
+// `DBusObjectArrayPacked`. The vector grows as the bytes arrive, so a
+// bogus array length doesn't cause a big allocation up front. `ElemType`
+// is the type of `Elem`.
+template <Endianness endianness, class Elem, class ElemType, typename T>
+class ParsePackedArray final : public Parse::Cont {
+  const DBusTypeArray &arrayType_;
+
+  // The bytes received so far.
+  std::vector<T> values_;
+  const size_t received_;
+
+  // Length of the array in bytes.
+  const size_t len_;
+
+  std::unique_ptr<DBusType::ParseObjectCont<endianness>> cont_;
+
+public:
+  // This constructor is only public for std::make_unique's benefit.
+  // Use factory method `mk()` to construct.
+  ParsePackedArray(
+      const DBusTypeArray &arrayType, std::vector<T> &&values, size_t received,
+      size_t len, std::unique_ptr<DBusType::ParseObjectCont<endianness>> &&cont)
+      : arrayType_(arrayType), values_(std::move(values)), received_(received),
+        len_(len), cont_(std::move(cont)) {}
+
+  virtual std::unique_ptr<Parse::Cont>
+  parse(const Parse::State &p, const char *buf, size_t bufsize) override {
+    assert(bufsize <= len_ - received_);
+    const size_t received = received_ + bufsize;
+    values_.resize((received + sizeof(T) - 1) / sizeof(T));
+    memcpy(reinterpret_cast<char *>(values_.data()) + received_, buf, bufsize);
+    return mk(p, arrayType_, std::move(values_), received, len_,
+              std::move(cont_));
+  }
+
+  // Factory method.
+  static std::unique_ptr<Parse::Cont>
+  mk(const Parse::State &p, const DBusTypeArray &arrayType,
+     std::vector<T> &&values, size_t received, size_t len,
+     std::unique_ptr<DBusType::ParseObjectCont<endianness>> &&cont) {
+    if (received < len) {
+      return std::make_unique<ParsePackedArray>(
+          arrayType, std::move(values), received, len, std::move(cont));
+    }
+
+    packedArrayFromWire<endianness>(values);
+    if constexpr (std::is_same<Elem, DBusObjectBoolean>::value) {
+      const size_t n = values.size();
+      for (size_t i = 0; i < n; i++) {
+        if (values[i] > 1) {
+          throw ParseError(p.getPos() - len + i * sizeof(T),
+                           "Boolean value that is not 0 or 1.");
+        }
+      }
+    }
+    ParseArena *arena = p.getArena().get();
+    if (arena) {
+      return cont->parse(
+          p, DBusObject::mkInArena<DBusObjectArrayPacked<Elem, T>>(
+                 *arena, *arena, std::move(values),
+                 arenaType(*arena, arrayType)));
+    }
+    if (arrayType.isInterned()) {
+      return cont->parse(p, std::make_unique<DBusObjectArrayPacked<Elem, T>>(
+                                std::move(values), arrayType));
+    }
+    return cont->parse(p, std::make_unique<DBusObjectArrayPacked<Elem, T>>(
+                              ElemType::instance_, std::move(values)));
+  }
+
+  uint8_t minRequiredBytes() const override { return 0; }
+  size_t maxRequiredBytes() const override { return len_ - received_; }
+};
+
+// If the element type of an array has a fixed size, then this visitor
+// creates a `ParsePackedArray` for it. Otherwise it leaves `result_` null
+// and the array is parsed one element at a time.
+template <Endianness endianness>
+class PackedArrayParserVisitor final : public DBusType::Visitor {
+  const Parse::State &p_;
+  const DBusTypeArray &arrayType_;
+  const uint32_t len_;
+  std::unique_ptr<DBusType::ParseObjectCont<endianness>> &cont_;
+  std::unique_ptr<Parse::Cont> result_;
+
+  template <class Elem, typename T, class ElemType> void mk(const ElemType &) {
+    if (len_ % sizeof(T) != 0) {
+      throw ParseError(p_.getPos(), "Incorrect array length.");
+    }
+    result_ = ParsePackedArray<endianness, Elem, ElemType, T>::mk(
+        p_, arrayType_, std::vector<T>(), 0, len_, std::move(cont_));
+  }
+
+public:
+  // The visitor should be applied to the base type of `arrayType`.
+  PackedArrayParserVisitor(
+      const Parse::State &p, const DBusTypeArray &arrayType, uint32_t len,
+      std::unique_ptr<DBusType::ParseObjectCont<endianness>> &cont)
+      : p_(p), arrayType_(arrayType), len_(len), cont_(cont) {}
+
+  std::unique_ptr<Parse::Cont> getResult() { return std::move(result_); }
+
+  void visitChar(const DBusTypeChar &t) override {
+    mk<DBusObjectChar, char>(t);
+  }
+  void visitBoolean(const DBusTypeBoolean &t) override {
+    mk<DBusObjectBoolean, uint32_t>(t);
+  }
+  void visitUint16(const DBusTypeUint16 &t) override {
+    mk<DBusObjectUint16, uint16_t>(t);
+  }
+  void visitInt16(const DBusTypeInt16 &t) override {
+    mk<DBusObjectInt16, int16_t>(t);
+  }
+  void visitUint32(const DBusTypeUint32 &t) override {
+    mk<DBusObjectUint32, uint32_t>(t);
+  }
+  void visitInt32(const DBusTypeInt32 &t) override {
+    mk<DBusObjectInt32, int32_t>(t);
+  }
+  void visitUint64(const DBusTypeUint64 &t) override {
+    mk<DBusObjectUint64, uint64_t>(t);
+  }
+  void visitInt64(const DBusTypeInt64 &t) override {
+    mk<DBusObjectInt64, int64_t>(t);
+  }
+  void visitDouble(const DBusTypeDouble &t) override {
+    mk<DBusObjectDouble, double>(t);
+  }
+  void visitUnixFD(const DBusTypeUnixFD &t) override {
+    mk<DBusObjectUnixFD, uint32_t>(t);
+  }
+  void visitString(const DBusTypeString &) override {}
+  void visitPath(const DBusTypePath &) override {}
+  void visitSignature(const DBusTypeSignature &) override {}
+  void visitVariant(const DBusTypeVariant &) override {}
+  void visitDictEntry(const DBusTypeDictEntry &) override {}
+  void visitArray(const DBusTypeArray &) override {}
+  void visitStruct(const DBusTypeStruct &) override {}
+};
+
 template <Endianness endianness>
 static std::unique_ptr<Parse::Cont> DBusTypeArray_mkObjectParserImpl(
-    const DBusType &baseType,
+    const DBusTypeArray &arrayType,
     std::unique_ptr<DBusType::ParseObjectCont<endianness>> &&cont) {
   // Continuation for parsing padding bytes.
   class PaddingCont final : public ParseZeros::Cont {
-    const DBusType &elemType_;
+    const DBusTypeArray &arrayType_;
     const uint32_t len_;
     std::unique_ptr<DBusType::ParseObjectCont<endianness>> cont_;
 
   public:
-    PaddingCont(const DBusType &elemType, uint32_t len,
+    PaddingCont(const DBusTypeArray &arrayType, uint32_t len,
                 std::unique_ptr<DBusType::ParseObjectCont<endianness>> &&cont)
-        : elemType_(elemType), len_(len), cont_(std::move(cont)) {}
+        : arrayType_(arrayType), len_(len), cont_(std::move(cont)) {}
 
     virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p) override {
       const size_t pos = p.getPos();
@@ -963,48 +1294,56 @@ static std::unique_ptr<Parse::Cont> DBusTypeArray_mkObjectParserImpl(
       if (__builtin_add_overflow(pos, len_, &endpos)) {
         throw ParseError(pos, "Array length integer overflow.");
       }
-      return parseArray(p, elemType_, endpos,
+
+      // Use the fast path if the element type has a fixed size.
+      PackedArrayParserVisitor<endianness> packed(p, arrayType_, len_, cont_);
+      arrayType_.getBaseType().accept(packed);
+      std::unique_ptr<Parse::Cont> result = packed.getResult();
+      if (result) {
+        return result;
+      }
+
+      return parseArray(p, arrayType_, endpos,
                         std::vector<std::unique_ptr<DBusObject>>(),
                         std::move(cont_));
     }
   };
 
   class LengthCont final : public ParseUint32<endianness>::Cont {
-    const DBusType &elemType_;
+    const DBusTypeArray &arrayType_;
     std::unique_ptr<DBusType::ParseObjectCont<endianness>> cont_;
 
   public:
-    LengthCont(const DBusType &elemType,
+    LengthCont(const DBusTypeArray &arrayType,
                std::unique_ptr<DBusType::ParseObjectCont<endianness>> &&cont)
-        : elemType_(elemType), cont_(std::move(cont)) {}
+        : arrayType_(arrayType), cont_(std::move(cont)) {}
 
     virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p,
                                                uint32_t len) override {
-      return parse_alignment(
-          p, elemType_,
-          std::make_unique<PaddingCont>(elemType_, len, std::move(cont_)));
+      return parse_alignment<PaddingCont>(p, arrayType_.getBaseType(),
+                                          arrayType_, len, std::move(cont_));
     }
   };
 
   // Parse the size
   return ParseUint32<endianness>::mk(
-      std::make_unique<LengthCont>(baseType, std::move(cont)));
+      std::make_unique<LengthCont>(arrayType, std::move(cont)));
 }
 
 std::unique_ptr<Parse::Cont> DBusTypeArray::mkObjectParserImpl(
     const Parse::State &,
     std::unique_ptr<DBusType::ParseObjectCont<LittleEndian>> &&cont) const {
-  return DBusTypeArray_mkObjectParserImpl(baseType_, std::move(cont));
+  return DBusTypeArray_mkObjectParserImpl(*this, std::move(cont));
 }
 
 std::unique_ptr<Parse::Cont> DBusTypeArray::mkObjectParserImpl(
     const Parse::State &,
     std::unique_ptr<DBusType::ParseObjectCont<BigEndian>> &&cont) const {
-  return DBusTypeArray_mkObjectParserImpl(baseType_, std::move(cont));
+  return DBusTypeArray_mkObjectParserImpl(*this, std::move(cont));
 }
 
 // Continuation argument to parseObjects.
-template <Endianness endianness> class ParseObjectsCont {
+template <Endianness endianness> class ParseObjectsCont : public ParseAlloc {
 protected:
   std::vector<std::unique_ptr<DBusObject>> objects_;
 
@@ -1054,20 +1393,24 @@ static std::unique_ptr<Parse::Cont>
 parseStruct(const Parse::State &p, const DBusTypeStruct &structType,
             std::unique_ptr<DBusType::ParseObjectCont<endianness>> &&cont) {
   class Cont final : public ParseObjectsCont<endianness> {
+    const DBusTypeStruct &structType_;
     const std::unique_ptr<DBusType::ParseObjectCont<endianness>> cont_;
 
   public:
-    Cont(std::unique_ptr<DBusType::ParseObjectCont<endianness>> &&cont)
-        : cont_(std::move(cont)) {}
+    Cont(const DBusTypeStruct &structType,
+         std::unique_ptr<DBusType::ParseObjectCont<endianness>> &&cont)
+        : structType_(structType), cont_(std::move(cont)) {}
 
     virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p) override {
-      return cont_->parse(p, DBusObjectStruct::mk(std::move(
-                                 ParseObjectsCont<endianness>::objects_)));
+      return cont_->parse(
+          p, mkStruct(p, std::move(ParseObjectsCont<endianness>::objects_),
+                      structType_));
     }
   };
 
-  return parseObjects<endianness>(p, structType.getFieldTypes(), 0,
-                                  std::make_unique<Cont>(std::move(cont)));
+  return parseObjects<endianness>(
+      p, structType.getFieldTypes(), 0,
+      std::make_unique<Cont>(structType, std::move(cont)));
 }
 
 std::unique_ptr<Parse::Cont> DBusTypeStruct::mkObjectParserImpl(
@@ -1082,146 +1425,1224 @@ std::unique_ptr<Parse::Cont> DBusTypeStruct::mkObjectParserImpl(
   return parseStruct(p, *this, std::move(cont));
 }
 
-std::vector<std::reference_wrapper<const DBusType>>
-DBusObjectSignature::toTypes(DBusTypeStorage &typeStorage // Type allocator
-) const {
-  class TypeCont final : public DBusType::ParseTypeCont {
-    const size_t endpos_;
-    std::vector<std::reference_wrapper<const DBusType>> &result_;
+// Continuation for the streaming parse mode, which passes a value of type
+// `X` to the event handler and then invokes the next continuation. `Base`
+// is the continuation type of the parser for `X`, for example
+// `ParseUint32<endianness>::Cont`.
+template <class Base, typename X> class EventValueCont final : public Base {
+public:
+  typedef void (*Emit)(const Parse::State &p, DBusType::EventHandler &handler,
+                       X x);
 
-  public:
-    TypeCont(size_t endpos,
-             std::vector<std::reference_wrapper<const DBusType>> &result)
-        : endpos_(endpos), result_(result) {}
+private:
+  const Emit emit_;
+  DBusType::EventHandler &handler_; // Not owned
+  const std::unique_ptr<DBusType::ParseEventCont> cont_;
 
-    virtual std::unique_ptr<Parse::Cont> parse(DBusTypeStorage &typeStorage,
-                                               const Parse::State &p,
-                                               const DBusType &t) override {
-      result_.push_back(t);
-      if (p.getPos() < endpos_) {
-        return parseType(typeStorage,
-                         std::make_unique<TypeCont>(endpos_, result_));
-      } else {
-        return ParseStop::mk();
-      }
-    }
+public:
+  EventValueCont(Emit emit, DBusType::EventHandler &handler,
+                 std::unique_ptr<DBusType::ParseEventCont> &&cont)
+      : emit_(emit), handler_(handler), cont_(std::move(cont)) {}
+
+  virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p,
+                                             X x) override {
+    emit_(p, handler_, x);
+    return cont_->parse(p);
+  }
+};
 
-    virtual std::unique_ptr<Parse::Cont>
-    parseCloseParen(DBusTypeStorage &, const Parse::State &p) override {
-      throw ParseError(p.getPos(),
-                       "Unexpected close paren while parsing signature.");
+// Same as `EventValueCont`, but for strings.
+class EventStringCont final : public ParseNChars::Cont {
+public:
+  typedef void (*Emit)(DBusType::EventHandler &handler, std::string_view str);
+
+private:
+  const Emit emit_;
+  DBusType::EventHandler &handler_; // Not owned
+  const std::unique_ptr<DBusType::ParseEventCont> cont_;
+
+public:
+  EventStringCont(Emit emit, DBusType::EventHandler &handler,
+                  std::unique_ptr<DBusType::ParseEventCont> &&cont)
+      : emit_(emit), handler_(handler), cont_(std::move(cont)) {}
+
+  virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p,
+                                             std::string &&str) override {
+    return parseView(p, str);
+  }
+
+  virtual std::unique_ptr<Parse::Cont>
+  parseView(const Parse::State &p, std::string_view str) override {
+    emit_(handler_, str);
+    return cont_->parse(p);
+  }
+};
+
+// Continuation for the streaming parse mode, which calls one of the
+// `end` methods of the event handler, like `endStruct`, and then invokes
+// the next continuation.
+class EventEndCont final : public DBusType::ParseEventCont {
+public:
+  typedef void (*Emit)(DBusType::EventHandler &handler);
+
+private:
+  const Emit emit_;
+  DBusType::EventHandler &handler_; // Not owned
+  const std::unique_ptr<DBusType::ParseEventCont> cont_;
+
+public:
+  EventEndCont(Emit emit, DBusType::EventHandler &handler,
+               std::unique_ptr<DBusType::ParseEventCont> &&cont)
+      : emit_(emit), handler_(handler), cont_(std::move(cont)) {}
+
+  virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p) override {
+    emit_(handler_);
+    return cont_->parse(p);
+  }
+};
+
+// Streaming version of `parseObjects`.
+template <Endianness endianness>
+static std::unique_ptr<Parse::Cont>
+parseObjectEvents(
+    const Parse::State &p,
+    const std::vector<std::reference_wrapper<const DBusType>> &types, size_t i,
+    DBusType::EventHandler &handler,
+    std::unique_ptr<DBusType::ParseEventCont> &&cont) {
+  class Cont final : public DBusType::ParseEventCont {
+    const std::vector<std::reference_wrapper<const DBusType>> &types_;
+    const size_t i_;
+    DBusType::EventHandler &handler_; // Not owned
+    std::unique_ptr<DBusType::ParseEventCont> cont_;
+
+  public:
+    Cont(const std::vector<std::reference_wrapper<const DBusType>> &types,
+         size_t i, DBusType::EventHandler &handler,
+         std::unique_ptr<DBusType::ParseEventCont> &&cont)
+        : types_(types), i_(i), handler_(handler), cont_(std::move(cont)) {}
+
+    virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p) override {
+      return parseObjectEvents<endianness>(p, types_, i_ + 1, handler_,
+                                           std::move(cont_));
     }
   };
 
-  std::vector<std::reference_wrapper<const DBusType>> result;
-  const size_t endpos = str_.size();
-  Parse p(parseType(typeStorage, std::make_unique<TypeCont>(endpos, result)));
+  if (i < types.size()) {
+    const DBusType &t = types[i];
+    return t.mkEventParser<endianness>(
+        p, handler, std::make_unique<Cont>(types, i, handler, std::move(cont)));
+  } else {
+    return cont->parse(p);
+  }
+}
 
-  while (true) {
-    const size_t required = p.maxRequiredBytes();
-    const size_t pos = p.getPos();
-    if (required == 0) {
-      assert(pos == endpos);
-      return result;
-    }
-    if (required > endpos - pos) {
-      throw ParseError(pos, "DBusType::fromSignature not enough bytes");
+// Streaming version of `parseArray`.
+template <Endianness endianness>
+static std::unique_ptr<Parse::Cont>
+parseArrayEvents(const Parse::State &p, const DBusType &elemType,
+                 size_t endpos, DBusType::EventHandler &handler,
+                 std::unique_ptr<DBusType::ParseEventCont> &&cont) {
+  class Cont final : public DBusType::ParseEventCont {
+    const DBusType &elemType_;
+    const size_t endpos_;
+    DBusType::EventHandler &handler_; // Not owned
+    std::unique_ptr<DBusType::ParseEventCont> cont_;
+
+  public:
+    Cont(const DBusType &elemType, size_t endpos,
+         DBusType::EventHandler &handler,
+         std::unique_ptr<DBusType::ParseEventCont> &&cont)
+        : elemType_(elemType), endpos_(endpos), handler_(handler),
+          cont_(std::move(cont)) {}
+
+    virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p) override {
+      return parseArrayEvents<endianness>(p, elemType_, endpos_, handler_,
+                                          std::move(cont_));
     }
-    p.parse(str_.c_str() + pos, required);
+  };
+
+  const size_t pos = p.getPos();
+  if (pos < endpos) {
+    return elemType.mkEventParser<endianness>(
+        p, handler,
+        std::make_unique<Cont>(elemType, endpos, handler, std::move(cont)));
+  } else if (pos == endpos) {
+    handler.endArray();
+    return cont->parse(p);
+  } else {
+    throw ParseError(pos, "Incorrect array length.");
   }
 }
 
+// Streaming version of `DBusTypeVariant_mkObjectParserImpl`.
 template <Endianness endianness>
-std::unique_ptr<Parse::Cont>
-DBusMessage::parse(std::unique_ptr<DBusMessage> &result) {
-  class BodyCont final : public ParseObjectsCont<endianness> {
+static std::unique_ptr<Parse::Cont>
+parseVariantEvents(DBusType::EventHandler &handler,
+                   std::unique_ptr<DBusType::ParseEventCont> &&cont) {
+  class EndCont final : public DBusType::ParseEventCont {
     // We need to own `typeStorage_` until the object parsing is complete
     // so that the type doesn't go out of scope too soon.
     DBusTypeStorage typeStorage_;
 
-    std::unique_ptr<DBusMessage> &result_;
-
-    // We need to own `bodyTypes_` until the object parsing is complete
-    // so that the vector doesn't go out of scope too soon.
-    const std::vector<std::reference_wrapper<const DBusType>> bodyTypes_;
-
-    // Utility for initializing `bodyTypes_` in the constructor.
-    static std::vector<std::reference_wrapper<const DBusType>>
-    getBodyTypesFromHeader(DBusTypeStorage &typeStorage,
-                           std::unique_ptr<DBusMessage> &result) {
-      const uint32_t bodySize = result->getHeader_bodySize();
-      if (bodySize == 0) {
-        // No message body, so return an empty vector.
-        return std::vector<std::reference_wrapper<const DBusType>>();
-      }
-
-      const DBusObjectSignature &bodySig =
-          result->getHeader_lookupField(MSGHDR_SIGNATURE)
-              .getValue()
-              ->toSignature();
-
-      return bodySig.toTypes(typeStorage);
-    }
+    DBusType::EventHandler &handler_; // Not owned
+    const std::unique_ptr<DBusType::ParseEventCont> cont_;
 
   public:
-    explicit BodyCont(std::unique_ptr<DBusMessage> &result)
-        : result_(result),
-          bodyTypes_(getBodyTypesFromHeader(typeStorage_, result_)) {}
+    EndCont(DBusType::EventHandler &handler,
+            std::unique_ptr<DBusType::ParseEventCont> &&cont)
+        : handler_(handler), cont_(std::move(cont)) {}
 
-    const std::vector<std::reference_wrapper<const DBusType>> &
-    getBodyTypes() const {
-      return bodyTypes_;
-    }
+    DBusTypeStorage &getTypeStorage() { return typeStorage_; }
 
-    virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &) override {
-      result_->body_ = DBusMessageBody::mk(
-          std::move(ParseObjectsCont<endianness>::objects_));
-      return ParseStop::mk();
+    virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p) override {
+      handler_.endVariant();
+      return cont_->parse(p);
     }
   };
 
-  // Continuation for parsing padding bytes.
-  class PaddingCont final : public ParseZeros::Cont {
-    std::unique_ptr<BodyCont> cont_;
+  class ZerosCont final : public ParseZeros::Cont {
+    const DBusType &t_;
+    DBusType::EventHandler &handler_; // Not owned
+    std::unique_ptr<EndCont> cont_;
 
   public:
-    PaddingCont(std::unique_ptr<BodyCont> cont) : cont_(std::move(cont)) {}
+    ZerosCont(const DBusType &t, DBusType::EventHandler &handler,
+              std::unique_ptr<EndCont> &&cont)
+        : t_(t), handler_(handler), cont_(std::move(cont)) {}
 
     virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p) override {
-      auto &bodyTypes = cont_->getBodyTypes();
-      return parseObjects<endianness>(p, bodyTypes, 0, std::move(cont_));
+      handler_.beginVariant(t_);
+      return t_.mkEventParser<endianness>(p, handler_, std::move(cont_));
     }
   };
 
-  class HeaderCont final : public DBusType::ParseObjectCont<endianness> {
-    std::unique_ptr<DBusMessage> &result_;
+  class TypeCont final : public DBusType::ParseTypeCont {
+    const size_t endpos_; // Byte position where the signature should end
+    DBusType::EventHandler &handler_; // Not owned
+    std::unique_ptr<EndCont> cont_;
 
   public:
-    HeaderCont(std::unique_ptr<DBusMessage> &result) : result_(result) {}
+    TypeCont(size_t endpos, DBusType::EventHandler &handler,
+             std::unique_ptr<EndCont> &&cont)
+        : endpos_(endpos), handler_(handler), cont_(std::move(cont)) {}
 
-    virtual std::unique_ptr<Parse::Cont>
-    parse(const Parse::State &p,
-          std::unique_ptr<DBusObject> &&header) override {
-      result_ = std::make_unique<DBusMessage>(std::move(header),
-                                              DBusMessageBody::mk0());
+    virtual std::unique_ptr<Parse::Cont> parse(DBusTypeStorage &,
+                                               const Parse::State &p,
+                                               const DBusType &t) override {
+      const size_t pos = p.getPos();
+      if (pos != endpos_) {
+        throw ParseError(pos, "Incorrect variant signature length.");
+      }
 
-      // The body is 8-byte aligned.
-      return parse_alignment(
-          p, DBusTypeUint64::instance_,
-          std::make_unique<PaddingCont>(std::make_unique<BodyCont>(result_)));
+      // Parse the terminating zero byte.
+      return ParseZeros::mk(
+          p, 1, std::make_unique<ZerosCont>(t, handler_, std::move(cont_)));
+    }
+
+    virtual std::unique_ptr<Parse::Cont>
+    parseCloseParen(DBusTypeStorage &, const Parse::State &p) override {
+      throw ParseError(
+          p.getPos(),
+          "Unexpected close paren while parsing variant signature.");
     }
   };
 
-  return headerType.mkObjectParser<endianness>(
-      Parse::State::initialState_, std::make_unique<HeaderCont>(result));
-}
+  class LengthCont final : public ParseChar::Cont {
+    DBusType::EventHandler &handler_; // Not owned
+    std::unique_ptr<EndCont> cont_;
 
-std::unique_ptr<Parse::Cont>
-DBusMessage::parseLE(std::unique_ptr<DBusMessage> &result) {
-  return parse<LittleEndian>(result);
-}
+  public:
+    LengthCont(DBusType::EventHandler &handler, std::unique_ptr<EndCont> &&cont)
+        : handler_(handler), cont_(std::move(cont)) {}
+
+    virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p,
+                                               char c) override {
+      uint8_t len = (uint8_t)c;
+
+      const size_t pos = p.getPos();
+      size_t endpos = 0;
+      if (__builtin_add_overflow(pos, len, &endpos)) {
+        throw ParseError(pos, "Signature length integer overflow.");
+      }
+
+      DBusTypeStorage &typeStorage = cont_->getTypeStorage();
+      return parseType(typeStorage, std::make_unique<TypeCont>(
+                                        endpos, handler_, std::move(cont_)));
+    }
+  };
+
+  return ParseChar::mk(std::make_unique<LengthCont>(
+      handler, std::make_unique<EndCont>(handler, std::move(cont))));
+}
+
+// Streaming version of `DBusTypeArray_mkObjectParserImpl`.
+template <Endianness endianness>
+static std::unique_ptr<Parse::Cont>
+parseArrayEvents(const DBusType &elemType, DBusType::EventHandler &handler,
+                 std::unique_ptr<DBusType::ParseEventCont> &&cont) {
+  // Continuation for parsing padding bytes.
+  class PaddingCont final : public ParseZeros::Cont {
+    const DBusType &elemType_;
+    const uint32_t len_;
+    DBusType::EventHandler &handler_; // Not owned
+    std::unique_ptr<DBusType::ParseEventCont> cont_;
+
+  public:
+    PaddingCont(const DBusType &elemType, uint32_t len,
+                DBusType::EventHandler &handler,
+                std::unique_ptr<DBusType::ParseEventCont> &&cont)
+        : elemType_(elemType), len_(len), handler_(handler),
+          cont_(std::move(cont)) {}
+
+    virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p) override {
+      const size_t pos = p.getPos();
+      size_t endpos = 0;
+      if (__builtin_add_overflow(pos, len_, &endpos)) {
+        throw ParseError(pos, "Array length integer overflow.");
+      }
+      handler_.beginArray(elemType_, len_);
+      return parseArrayEvents<endianness>(p, elemType_, endpos, handler_,
+                                          std::move(cont_));
+    }
+  };
+
+  class LengthCont final : public ParseUint32<endianness>::Cont {
+    const DBusType &elemType_;
+    DBusType::EventHandler &handler_; // Not owned
+    std::unique_ptr<DBusType::ParseEventCont> cont_;
+
+  public:
+    LengthCont(const DBusType &elemType, DBusType::EventHandler &handler,
+               std::unique_ptr<DBusType::ParseEventCont> &&cont)
+        : elemType_(elemType), handler_(handler), cont_(std::move(cont)) {}
+
+    virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p,
+                                               uint32_t len) override {
+      return parse_alignment<PaddingCont>(p, elemType_, elemType_, len,
+                                          handler_, std::move(cont_));
+    }
+  };
+
+  // Parse the size
+  return ParseUint32<endianness>::mk(
+      std::make_unique<LengthCont>(elemType, handler, std::move(cont)));
+}
+
+// Creates the streaming parser for the type that it visits. It is
+// called after the alignment padding has been parsed.
+template <Endianness endianness>
+class EventParserVisitor final : public DBusType::Visitor {
+  const Parse::State &p_;
+  DBusType::EventHandler &handler_;
+  std::unique_ptr<DBusType::ParseEventCont> &cont_;
+  std::unique_ptr<Parse::Cont> result_;
+
+  template <class Base, typename X>
+  std::unique_ptr<Base>
+  mkValueCont(typename EventValueCont<Base, X>::Emit emit) {
+    return std::make_unique<EventValueCont<Base, X>>(emit, handler_,
+                                                     std::move(cont_));
+  }
+
+  std::unique_ptr<ParseNChars::Cont>
+  mkStringCont(EventStringCont::Emit emit) {
+    return std::make_unique<EventStringCont>(emit, handler_, std::move(cont_));
+  }
+
+  std::unique_ptr<DBusType::ParseEventCont>
+  mkEndCont(EventEndCont::Emit emit) {
+    return std::make_unique<EventEndCont>(emit, handler_, std::move(cont_));
+  }
+
+public:
+  EventParserVisitor(const Parse::State &p, DBusType::EventHandler &handler,
+                     std::unique_ptr<DBusType::ParseEventCont> &cont)
+      : p_(p), handler_(handler), cont_(cont) {}
+
+  std::unique_ptr<Parse::Cont> getResult() { return std::move(result_); }
+
+  void visitChar(const DBusTypeChar &) override {
+    result_ = ParseChar::mk(mkValueCont<ParseChar::Cont, char>(
+        [](const Parse::State &, DBusType::EventHandler &h, char c) {
+          h.onChar(c);
+        }));
+  }
+
+  void visitBoolean(const DBusTypeBoolean &) override {
+    typedef typename ParseUint32<endianness>::Cont Base;
+    result_ = ParseUint32<endianness>::mk(mkValueCont<Base, uint32_t>(
+        [](const Parse::State &p, DBusType::EventHandler &h, uint32_t b) {
+          // The value of x must be either 0 or 1.
+          if (b > 1) {
+            throw ParseError(p.getPos(), "Boolean value that is not 0 or 1.");
+          }
+          h.onBoolean(b);
+        }));
+  }
+
+  void visitUint16(const DBusTypeUint16 &) override {
+    typedef typename ParseUint16<endianness>::Cont Base;
+    result_ = ParseUint16<endianness>::mk(mkValueCont<Base, uint16_t>(
+        [](const Parse::State &, DBusType::EventHandler &h, uint16_t x) {
+          h.onUint16(x);
+        }));
+  }
+
+  void visitInt16(const DBusTypeInt16 &) override {
+    typedef typename ParseUint16<endianness>::Cont Base;
+    result_ = ParseUint16<endianness>::mk(mkValueCont<Base, uint16_t>(
+        [](const Parse::State &, DBusType::EventHandler &h, uint16_t x) {
+          h.onInt16(static_cast<int16_t>(x));
+        }));
+  }
+
+  void visitUint32(const DBusTypeUint32 &) override {
+    typedef typename ParseUint32<endianness>::Cont Base;
+    result_ = ParseUint32<endianness>::mk(mkValueCont<Base, uint32_t>(
+        [](const Parse::State &, DBusType::EventHandler &h, uint32_t x) {
+          h.onUint32(x);
+        }));
+  }
+
+  void visitInt32(const DBusTypeInt32 &) override {
+    typedef typename ParseUint32<endianness>::Cont Base;
+    result_ = ParseUint32<endianness>::mk(mkValueCont<Base, uint32_t>(
+        [](const Parse::State &, DBusType::EventHandler &h, uint32_t x) {
+          h.onInt32(static_cast<int32_t>(x));
+        }));
+  }
+
+  void visitUint64(const DBusTypeUint64 &) override {
+    typedef typename ParseUint64<endianness>::Cont Base;
+    result_ = ParseUint64<endianness>::mk(mkValueCont<Base, uint64_t>(
+        [](const Parse::State &, DBusType::EventHandler &h, uint64_t x) {
+          h.onUint64(x);
+        }));
+  }
+
+  void visitInt64(const DBusTypeInt64 &) override {
+    typedef typename ParseUint64<endianness>::Cont Base;
+    result_ = ParseUint64<endianness>::mk(mkValueCont<Base, uint64_t>(
+        [](const Parse::State &, DBusType::EventHandler &h, uint64_t x) {
+          h.onInt64(static_cast<int64_t>(x));
+        }));
+  }
+
+  void visitDouble(const DBusTypeDouble &) override {
+    typedef typename ParseUint64<endianness>::Cont Base;
+    result_ = ParseUint64<endianness>::mk(mkValueCont<Base, uint64_t>(
+        [](const Parse::State &, DBusType::EventHandler &h, uint64_t x) {
+          double d;
+          memcpy(&d, &x, sizeof(d));
+          h.onDouble(d);
+        }));
+  }
+
+  void visitUnixFD(const DBusTypeUnixFD &) override {
+    typedef typename ParseUint32<endianness>::Cont Base;
+    result_ = ParseUint32<endianness>::mk(mkValueCont<Base, uint32_t>(
+        [](const Parse::State &, DBusType::EventHandler &h, uint32_t x) {
+          h.onUnixFD(x);
+        }));
+  }
+
+  void visitString(const DBusTypeString &) override {
+    result_ = parseString32<endianness>(
+        mkStringCont([](DBusType::EventHandler &h, std::string_view str) {
+          h.onString(str);
+        }));
+  }
+
+  void visitPath(const DBusTypePath &) override {
+    result_ = parseString32<endianness>(
+        mkStringCont([](DBusType::EventHandler &h, std::string_view str) {
+          h.onPath(str);
+        }));
+  }
+
+  void visitSignature(const DBusTypeSignature &) override {
+    result_ = parseString8(
+        mkStringCont([](DBusType::EventHandler &h, std::string_view str) {
+          h.onSignature(str);
+        }));
+  }
+
+  void visitVariant(const DBusTypeVariant &) override {
+    result_ = parseVariantEvents<endianness>(handler_, std::move(cont_));
+  }
+
+  void visitDictEntry(const DBusTypeDictEntry &t) override {
+    class KeyCont final : public DBusType::ParseEventCont {
+      const DBusType &valueType_;
+      DBusType::EventHandler &handler_; // Not owned
+      std::unique_ptr<DBusType::ParseEventCont> cont_;
+
+    public:
+      KeyCont(const DBusType &valueType, DBusType::EventHandler &handler,
+              std::unique_ptr<DBusType::ParseEventCont> &&cont)
+          : valueType_(valueType), handler_(handler), cont_(std::move(cont)) {}
+
+      virtual std::unique_ptr<Parse::Cont>
+      parse(const Parse::State &p) override {
+        return valueType_.mkEventParser<endianness>(p, handler_,
+                                                    std::move(cont_));
+      }
+    };
+
+    handler_.beginDictEntry();
+    result_ = t.getKeyType().mkEventParser<endianness>(
+        p_, handler_,
+        std::make_unique<KeyCont>(
+            t.getValueType(), handler_,
+            mkEndCont([](DBusType::EventHandler &h) { h.endDictEntry(); })));
+  }
+
+  void visitArray(const DBusTypeArray &t) override {
+    result_ = parseArrayEvents<endianness>(t.getBaseType(), handler_,
+                                           std::move(cont_));
+  }
+
+  void visitStruct(const DBusTypeStruct &t) override {
+    handler_.beginStruct();
+    result_ = parseObjectEvents<endianness>(
+        p_, t.getFieldTypes(), 0, handler_,
+        mkEndCont([](DBusType::EventHandler &h) { h.endStruct(); }));
+  }
+};
+
+template <Endianness endianness>
+std::unique_ptr<Parse::Cont>
+DBusType::mkEventParser(const Parse::State &p, EventHandler &handler,
+                        std::unique_ptr<ParseEventCont> &&cont) const {
+  // Continuation for parsing padding bytes.
+  class PaddingCont final : public ParseZeros::Cont {
+    // Reference to the current type.
+    const DBusType &t_;
+
+    EventHandler &handler_; // Not owned
+    std::unique_ptr<ParseEventCont> cont_;
+
+  public:
+    PaddingCont(const DBusType &t, EventHandler &handler,
+                std::unique_ptr<ParseEventCont> &&cont)
+        : t_(t), handler_(handler), cont_(std::move(cont)) {}
+
+    virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p) override {
+      EventParserVisitor<endianness> visitor(p, handler_, cont_);
+      t_.accept(visitor);
+      return visitor.getResult();
+    }
+  };
+
+  return parse_alignment<PaddingCont>(p, *this, *this, handler,
+                                      std::move(cont));
+}
+
+// Template instantiation. This is to make sure that the little-endian
+// instantiation of mkEventParser is included in the library.
+template std::unique_ptr<Parse::Cont> DBusType::mkEventParser<LittleEndian>(
+    const Parse::State &p, EventHandler &handler,
+    std::unique_ptr<ParseEventCont> &&cont) const;
+
+// Template instantiation. This is to make sure that the big-endian
+// instantiation of mkEventParser is included in the library.
+template std::unique_ptr<Parse::Cont> DBusType::mkEventParser<BigEndian>(
+    const Parse::State &p, EventHandler &handler,
+    std::unique_ptr<ParseEventCont> &&cont) const;
+
+std::vector<std::reference_wrapper<const DBusType>>
+DBusObjectSignature::toTypes(DBusTypeStorage &typeStorage // Type allocator
+) const {
+  return toTypes(typeStorage, str_.get());
+}
+
+std::vector<std::reference_wrapper<const DBusType>>
+DBusObjectSignature::toTypes(DBusTypeStorage &typeStorage, // Type allocator
+                             std::string_view str) {
+  class TypeCont final : public DBusType::ParseTypeCont {
+    const size_t endpos_;
+    std::vector<std::reference_wrapper<const DBusType>> &result_;
+
+  public:
+    TypeCont(size_t endpos,
+             std::vector<std::reference_wrapper<const DBusType>> &result)
+        : endpos_(endpos), result_(result) {}
+
+    virtual std::unique_ptr<Parse::Cont> parse(DBusTypeStorage &typeStorage,
+                                               const Parse::State &p,
+                                               const DBusType &t) override {
+      result_.push_back(t);
+      if (p.getPos() < endpos_) {
+        return parseType(typeStorage,
+                         std::make_unique<TypeCont>(endpos_, result_));
+      } else {
+        return ParseStop::mk();
+      }
+    }
+
+    virtual std::unique_ptr<Parse::Cont>
+    parseCloseParen(DBusTypeStorage &, const Parse::State &p) override {
+      throw ParseError(p.getPos(),
+                       "Unexpected close paren while parsing signature.");
+    }
+  };
+
+  std::vector<std::reference_wrapper<const DBusType>> result;
+  const size_t endpos = str.size();
+  Parse p(parseType(typeStorage, std::make_unique<TypeCont>(endpos, result)));
+
+  const size_t used = p.feed(str.data(), endpos);
+  if (p.maxRequiredBytes() != 0) {
+    throw ParseError(p.getPos(), "DBusType::fromSignature not enough bytes");
+  }
+  (void)used;
+  assert(used == endpos);
+  return result;
+}
+
+DBusSignatureTypes::DBusSignatureTypes(std::string_view signature)
+    : DBusSignatureTypes(signature, std::make_shared<DBusTypeStorage>()) {}
+
+DBusSignatureTypes::DBusSignatureTypes(
+    std::string_view signature,
+    const std::shared_ptr<DBusTypeStorage> &typeStorage)
+    : signature_(signature), typeStorage_(typeStorage),
+      types_(signature_.empty()
+                 ? std::vector<std::reference_wrapper<const DBusType>>()
+                 : DBusObjectSignature::toTypes(*typeStorage_, signature_)) {}
+
+std::shared_ptr<const DBusSignatureTypes>
+DBusSignatureCache::lookup(std::string_view signature) {
+  auto it = entries_.find(signature);
+  if (likely(it != entries_.end())) {
+    return it->second;
+  }
+
+  // Invalid signatures aren't added to the cache, but they can still
+  // leave some types in the storage, so its size is bounded too.
+  if (entries_.size() >= maxEntries_ ||
+      typeStorage_->size() >= 4 * maxEntries_) {
+    clear();
+  }
+  auto types =
+      std::make_shared<const DBusSignatureTypes>(signature, typeStorage_);
+  entries_.emplace(types->getSignature(), types);
+  return types;
+}
+
+DBusSignatureCache &DBusSignatureCache::threadLocal() {
+  static thread_local DBusSignatureCache cache;
+  return cache;
+}
+
+// The type which the spec requires for the value of header field `name`,
+// or null if `name` isn't a known field name. Basic types are singletons,
+// so the result can be compared by address.
+static const DBusType *expectedHeaderFieldType(const uint8_t name) {
+  switch (name) {
+  case MSGHDR_PATH:
+    return &DBusTypePath::instance_;
+  case MSGHDR_INTERFACE:
+  case MSGHDR_MEMBER:
+  case MSGHDR_ERROR_NAME:
+  case MSGHDR_DESTINATION:
+  case MSGHDR_SENDER:
+    return &DBusTypeString::instance_;
+  case MSGHDR_REPLY_SERIAL:
+  case MSGHDR_UNIX_FDS:
+    return &DBusTypeUint32::instance_;
+  case MSGHDR_SIGNATURE:
+    return &DBusTypeSignature::instance_;
+  default:
+    return nullptr;
+  }
+}
+
+// Check that the header has the fields which the spec requires for its
+// message type. `hasField(name)` returns true if the field is present.
+template <class F>
+static void checkRequiredHeaderFields(const size_t pos, const MessageType type,
+                                      const uint32_t bodySize, F &&hasField) {
+  auto require = [pos, &hasField](HeaderFieldName name) {
+    if (!hasField(name)) {
+      throw ParseError(pos, "Missing required header field.");
+    }
+  };
+  switch (type) {
+  case MSGTYPE_METHOD_CALL:
+    require(MSGHDR_PATH);
+    require(MSGHDR_MEMBER);
+    break;
+  case MSGTYPE_METHOD_RETURN:
+    require(MSGHDR_REPLY_SERIAL);
+    break;
+  case MSGTYPE_ERROR:
+    require(MSGHDR_ERROR_NAME);
+    require(MSGHDR_REPLY_SERIAL);
+    break;
+  case MSGTYPE_SIGNAL:
+    require(MSGHDR_PATH);
+    require(MSGHDR_INTERFACE);
+    require(MSGHDR_MEMBER);
+    break;
+  default:
+    // The spec says that unknown message types must be ignored.
+    break;
+  }
+  if (bodySize != 0) {
+    require(MSGHDR_SIGNATURE);
+  }
+}
+
+void DBusMessage::checkHeaderFields(const size_t pos) const {
+  if (duplicateHeaderField_) {
+    throw ParseError(pos, "Duplicate header field.");
+  }
+  if (fieldIndex_[MSGHDR_INVALID]) {
+    throw ParseError(pos, "Invalid header field name.");
+  }
+  for (uint8_t name = MSGHDR_PATH; name < fieldIndex_.size(); name++) {
+    const DBusObjectVariant *field = fieldIndex_[name];
+    if (field &&
+        &field->getValue()->getType() != expectedHeaderFieldType(name)) {
+      throw ParseError(pos, "Header field has the wrong type.");
+    }
+  }
+  checkRequiredHeaderFields(
+      pos, getHeader_messageType(), getHeader_bodySize(),
+      [this](HeaderFieldName name) { return fieldIndex_[name] != nullptr; });
+}
+
+void DBusMessage::setBody(
+    std::vector<std::unique_ptr<DBusObject>> &&elements,
+    const std::shared_ptr<const DBusSignatureTypes> &types) const {
+  if (arena_) {
+    // The arena destroys the body, which releases `types`, but it doesn't
+    // destroy the elements.
+    body_ = arena_->mk<DBusMessageBody>(*arena_, std::move(elements), types);
+    ownedBody_.reset();
+  } else {
+    ownedBody_ = DBusMessageBody::mk(std::move(elements), types);
+    body_ = ownedBody_.get();
+  }
+}
+
+// Get the types of the body from the SIGNATURE field of the header.
+static std::shared_ptr<const DBusSignatureTypes>
+getBodyTypesFromHeader(const DBusMessage &message) {
+  const uint32_t bodySize = message.getHeader_bodySize();
+  if (bodySize == 0) {
+    // No message body, so use the empty signature.
+    return DBusSignatureCache::threadLocal().lookup("");
+  }
+
+  // `checkHeaderFields` has checked that the field is present.
+  const DBusObjectSignature &bodySig =
+      message.getHeader_findField(MSGHDR_SIGNATURE)->getValue()->toSignature();
+
+  return DBusSignatureCache::threadLocal().lookup(bodySig.getView());
+}
+
+template <Endianness endianness>
+std::unique_ptr<Parse::Cont>
+DBusMessage::parse(std::unique_ptr<DBusMessage> &result,
+                   const Parse::State &p) {
+  class BodyCont final : public ParseObjectsCont<endianness> {
+    std::unique_ptr<DBusMessage> &result_;
+
+    // We need to hold a reference to `bodyTypes_` until the object
+    // parsing is complete so that the types don't go out of scope too
+    // soon.
+    const std::shared_ptr<const DBusSignatureTypes> bodyTypes_;
+
+  public:
+    explicit BodyCont(std::unique_ptr<DBusMessage> &result)
+        : result_(result), bodyTypes_(getBodyTypesFromHeader(*result_)) {}
+
+    const std::vector<std::reference_wrapper<const DBusType>> &
+    getBodyTypes() const {
+      return bodyTypes_->getTypes();
+    }
+
+    virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &) override {
+      // The body's objects share the types in `bodyTypes_`, so the body
+      // keeps them alive. The message's arena is the parser's, so the
+      // body is in the same arena as its objects.
+      result_->setBody(std::move(ParseObjectsCont<endianness>::objects_),
+                       bodyTypes_);
+      return ParseStop::mk();
+    }
+  };
+
+  // Continuation for parsing padding bytes.
+  class PaddingCont final : public ParseZeros::Cont {
+    std::unique_ptr<BodyCont> cont_;
+
+  public:
+    PaddingCont(std::unique_ptr<BodyCont> cont) : cont_(std::move(cont)) {}
+
+    virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p) override {
+      auto &bodyTypes = cont_->getBodyTypes();
+      return parseObjects<endianness>(p, bodyTypes, 0, std::move(cont_));
+    }
+  };
+
+  class HeaderCont final : public DBusType::ParseObjectCont<endianness> {
+    std::unique_ptr<DBusMessage> &result_;
+
+  public:
+    HeaderCont(std::unique_ptr<DBusMessage> &result) : result_(result) {}
+
+    virtual std::unique_ptr<Parse::Cont>
+    parse(const Parse::State &p,
+          std::unique_ptr<DBusObject> &&header) override {
+      result_ = std::make_unique<DBusMessage>(std::move(header),
+                                              DBusMessageBody::mk0());
+      // The message shares ownership of the arena straight away, because
+      // the header is already in it.
+      result_->arena_ = p.getArena();
+      result_->checkHeaderFields(p.getPos());
+
+      // The body is 8-byte aligned.
+      return parse_alignment<PaddingCont>(p, DBusTypeUint64::instance_,
+                                          std::make_unique<BodyCont>(result_));
+    }
+  };
+
+  return headerType.mkObjectParser<endianness>(
+      p, std::make_unique<HeaderCont>(result));
+}
+
+template std::unique_ptr<Parse::Cont>
+DBusMessage::parse<LittleEndian>(std::unique_ptr<DBusMessage> &result,
+                                 const Parse::State &p);
+
+template std::unique_ptr<Parse::Cont>
+DBusMessage::parse<BigEndian>(std::unique_ptr<DBusMessage> &result,
+                              const Parse::State &p);
+
+std::unique_ptr<Parse::Cont>
+DBusMessage::parseLE(std::unique_ptr<DBusMessage> &result) {
+  return parse<LittleEndian>(result);
+}
 
 std::unique_ptr<Parse::Cont>
 DBusMessage::parseBE(std::unique_ptr<DBusMessage> &result) {
   return parse<BigEndian>(result);
 }
+
+// Utility for detecting the byte order of a message. It parses the
+// endianness byte and calls `mk` with either
+// `std::integral_constant<Endianness, LittleEndian>` or
+// `std::integral_constant<Endianness, BigEndian>` to create the parser for
+// the message. Then it passes the endianness byte to that parser, which
+// is expecting to parse a single char, because the first field of the
+// header is the endianness byte.
+template <class F>
+static std::unique_ptr<Parse::Cont> parseEndiannessByte(F &&mk) {
+  class Cont final : public ParseChar::Cont {
+    const F mk_;
+
+  public:
+    explicit Cont(F &&mk) : mk_(std::move(mk)) {}
+
+    virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p,
+                                               char c) override {
+      std::unique_ptr<Parse::Cont> cont;
+      switch (c) {
+      case 'l':
+        cont = mk_(std::integral_constant<Endianness, LittleEndian>());
+        break;
+      case 'B':
+        cont = mk_(std::integral_constant<Endianness, BigEndian>());
+        break;
+      default:
+        throw ParseError(p.getPos() - 1, "Invalid endianness byte.");
+      }
+      assert(cont->minRequiredBytes() == sizeof(char));
+      assert(cont->maxRequiredBytes() == sizeof(char));
+      return cont->parse(p, &c, sizeof(char));
+    }
+  };
+
+  return ParseChar::mk(std::make_unique<Cont>(std::move(mk)));
+}
+
+std::unique_ptr<Parse::Cont>
+DBusMessage::parseAuto(std::unique_ptr<DBusMessage> &result) {
+  return parseEndiannessByte([&result](auto endianness) {
+    return parse<decltype(endianness)::value>(result);
+  });
+}
+
+template <Endianness endianness>
+std::unique_ptr<Parse::Cont>
+DBusMessage::parseLazy(std::unique_ptr<DBusMessage> &result,
+                       const Parse::State &p) {
+  class BodyCont final : public ParseNChars::Cont {
+    std::unique_ptr<DBusMessage> &result_;
+
+  public:
+    explicit BodyCont(std::unique_ptr<DBusMessage> &result)
+        : result_(result) {}
+
+    virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &,
+                                               std::string &&str) override {
+      // Use the aliasing constructor of `std::shared_ptr`, so that the
+      // string is kept alive by the pointer to its bytes.
+      std::shared_ptr<const std::string> body =
+          std::make_shared<const std::string>(std::move(str));
+      result_->rawBody_ = std::shared_ptr<const char>(body, body->data());
+      return ParseStop::mk();
+    }
+
+    virtual std::unique_ptr<Parse::Cont>
+    parseView(const Parse::State &p, std::string_view str) override {
+      result_->rawBody_ = std::shared_ptr<const char>(p.getBuffer(), str.data());
+      return ParseStop::mk();
+    }
+  };
+
+  // Continuation for parsing padding bytes.
+  class PaddingCont final : public ParseZeros::Cont {
+    const uint32_t bodySize_;
+    std::unique_ptr<BodyCont> cont_;
+
+  public:
+    PaddingCont(uint32_t bodySize, std::unique_ptr<BodyCont> &&cont)
+        : bodySize_(bodySize), cont_(std::move(cont)) {}
+
+    virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p) override {
+      return ParseNChars::mk(p, std::string(), bodySize_, std::move(cont_));
+    }
+  };
+
+  class HeaderCont final : public DBusType::ParseObjectCont<endianness> {
+    std::unique_ptr<DBusMessage> &result_;
+
+  public:
+    HeaderCont(std::unique_ptr<DBusMessage> &result) : result_(result) {}
+
+    virtual std::unique_ptr<Parse::Cont>
+    parse(const Parse::State &p,
+          std::unique_ptr<DBusObject> &&header) override {
+      // The body will be parsed later, so check now that the endianness
+      // byte matches the byte order that we're using.
+      const char e = endianness == LittleEndian ? 'l' : 'B';
+      const DBusObjectStruct &fields = header->toStruct();
+      if (fields.getElement(0)->toChar().getValue() != e) {
+        throw ParseError(0, "Unexpected endianness byte.");
+      }
+      const uint32_t bodySize = fields.getElement(4)->toUint32().getValue();
+
+      // The body is attached by `BodyCont`.
+      result_ = std::make_unique<DBusMessage>(std::move(header),
+                                              std::shared_ptr<const char>());
+      result_->arena_ = p.getArena();
+      result_->checkHeaderFields(p.getPos());
+
+      // The body is 8-byte aligned.
+      return parse_alignment<PaddingCont>(p, DBusTypeUint64::instance_,
+                                          bodySize,
+                                          std::make_unique<BodyCont>(result_));
+    }
+  };
+
+  return headerType.mkObjectParser<endianness>(
+      p, std::make_unique<HeaderCont>(result));
+}
+
+template std::unique_ptr<Parse::Cont>
+DBusMessage::parseLazy<LittleEndian>(std::unique_ptr<DBusMessage> &result,
+                                     const Parse::State &p);
+
+template std::unique_ptr<Parse::Cont>
+DBusMessage::parseLazy<BigEndian>(std::unique_ptr<DBusMessage> &result,
+                                  const Parse::State &p);
+
+std::unique_ptr<Parse::Cont>
+DBusMessage::parseLazyAuto(std::unique_ptr<DBusMessage> &result) {
+  return parseEndiannessByte([&result](auto endianness) {
+    return parseLazy<decltype(endianness)::value>(result);
+  });
+}
+
+// Parse the body of a message that was parsed by `parseLazy`. The parser
+// runs in zero-copy mode, so strings in the body refer to `rawBody`,
+// unless the message is in an arena, in which case the body's objects
+// are allocated in the same arena. The body starts at an 8-byte aligned
+// position in the message, so starting the byte count at zero doesn't
+// affect the alignment.
+template <Endianness endianness>
+static std::vector<std::unique_ptr<DBusObject>>
+parseBodyFromRawBytes(const DBusMessage &message,
+                      const std::shared_ptr<const char> &rawBody,
+                      const DBusSignatureTypes &bodyTypes) {
+  class Cont final : public ParseObjectsCont<endianness> {
+    std::vector<std::unique_ptr<DBusObject>> &result_;
+
+  public:
+    explicit Cont(std::vector<std::unique_ptr<DBusObject>> &result)
+        : result_(result) {}
+
+    virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &) override {
+      result_ = std::move(ParseObjectsCont<endianness>::objects_);
+      return ParseStop::mk();
+    }
+  };
+
+  // The objects are allocated in the message's arena, if it has one.
+  std::vector<std::unique_ptr<DBusObject>> result;
+  Parse p(message.getArena(), rawBody, [&](const Parse::State &s) {
+    return parseObjects<endianness>(s, bodyTypes.getTypes(), 0,
+                                    std::make_unique<Cont>(result));
+  });
+
+  const size_t bodySize = message.getHeader_bodySize();
+  const size_t used = p.feed(rawBody.get(), bodySize);
+  if (p.maxRequiredBytes() != 0) {
+    throw ParseError(p.getPos(), "Message body is shorter than its signature.");
+  }
+  if (used != bodySize) {
+    throw ParseError(used, "Message body is longer than its signature.");
+  }
+  return result;
+}
+
+void DBusMessage::parseRawBody() const {
+  const std::shared_ptr<const DBusSignatureTypes> bodyTypes =
+      getBodyTypesFromHeader(*this);
+  switch (getHeader_endianness()) {
+  case 'l':
+    setBody(parseBodyFromRawBytes<LittleEndian>(*this, rawBody_, *bodyTypes),
+            bodyTypes);
+    break;
+  case 'B':
+    setBody(parseBodyFromRawBytes<BigEndian>(*this, rawBody_, *bodyTypes),
+            bodyTypes);
+    break;
+  default:
+    // `parseLazy` has already checked the endianness byte, so this
+    // shouldn't happen.
+    throw ParseError(0, "Unexpected endianness byte.");
+  }
+}
+
+template <Endianness endianness>
+std::unique_ptr<Parse::Cont>
+DBusMessage::parseEvents(EventHandler &handler) {
+  // Forwards the events of the header to the message's handler, and
+  // watches for the SIGNATURE header field, which is needed to parse the
+  // body. The header is a struct containing an array of (byte, variant)
+  // structs, so the header fields are at nesting depth 3 and their values
+  // are at depth 4.
+  class HeaderHandler final : public DBusType::EventHandler {
+    EventHandler &handler_; // Not owned
+    size_t depth_;
+    char fieldName_;
+    std::string signature_;
+
+    // The fixed part of the header, which is needed to check that the
+    // required header fields are present.
+    size_t numChars_;
+    size_t numUint32s_;
+    MessageType messageType_;
+    uint32_t bodySize_;
+
+    // Bit mask of the header fields (with known names) which have been
+    // seen so far.
+    uint32_t seenFields_;
+    bool duplicateField_;
+    bool wrongFieldType_;
+
+  public:
+    explicit HeaderHandler(EventHandler &handler)
+        : handler_(handler), depth_(0), fieldName_(0), numChars_(0),
+          numUint32s_(0), messageType_(MSGTYPE_INVALID), bodySize_(0),
+          seenFields_(0), duplicateField_(false), wrongFieldType_(false) {}
+
+    const std::string &getSignature() const { return signature_; }
+
+    // Same checks as `DBusMessage::checkHeaderFields`.
+    void checkHeaderFields(const size_t pos) const {
+      if (duplicateField_) {
+        throw ParseError(pos, "Duplicate header field.");
+      }
+      if (seenFields_ & (1u << MSGHDR_INVALID)) {
+        throw ParseError(pos, "Invalid header field name.");
+      }
+      if (wrongFieldType_) {
+        throw ParseError(pos, "Header field has the wrong type.");
+      }
+      checkRequiredHeaderFields(pos, messageType_, bodySize_,
+                                [this](HeaderFieldName name) {
+                                  return (seenFields_ & (1u << name)) != 0;
+                                });
+    }
+
+    void onChar(char c) override {
+      if (depth_ == 1) {
+        // The second byte of the header is the message type.
+        if (numChars_ == 1) {
+          messageType_ = static_cast<MessageType>(c);
+        }
+        ++numChars_;
+      } else if (depth_ == 3) {
+        fieldName_ = c;
+        const uint8_t name = c;
+        if (name <= MSGHDR_UNIX_FDS) {
+          if (seenFields_ & (1u << name)) {
+            duplicateField_ = true;
+          }
+          seenFields_ |= 1u << name;
+        }
+      }
+      handler_.onChar(c);
+    }
+    void onBoolean(bool b) override { handler_.onBoolean(b); }
+    void onUint16(uint16_t x) override { handler_.onUint16(x); }
+    void onInt16(int16_t x) override { handler_.onInt16(x); }
+    void onUint32(uint32_t x) override {
+      if (depth_ == 1) {
+        // The first uint32 of the header is the body size.
+        if (numUint32s_ == 0) {
+          bodySize_ = x;
+        }
+        ++numUint32s_;
+      }
+      handler_.onUint32(x);
+    }
+    void onInt32(int32_t x) override { handler_.onInt32(x); }
+    void onUint64(uint64_t x) override { handler_.onUint64(x); }
+    void onInt64(int64_t x) override { handler_.onInt64(x); }
+    void onDouble(double d) override { handler_.onDouble(d); }
+    void onUnixFD(uint32_t i) override { handler_.onUnixFD(i); }
+    void onString(std::string_view str) override { handler_.onString(str); }
+    void onPath(std::string_view str) override { handler_.onPath(str); }
+    void onSignature(std::string_view str) override {
+      if (depth_ == 4 && fieldName_ == MSGHDR_SIGNATURE) {
+        signature_ = str;
+      }
+      handler_.onSignature(str);
+    }
+    void beginVariant(const DBusType &t) override {
+      if (depth_ == 3) {
+        // The value of a header field.
+        const DBusType *expected = expectedHeaderFieldType(fieldName_);
+        if (expected && &t != expected) {
+          wrongFieldType_ = true;
+        }
+      }
+      ++depth_;
+      handler_.beginVariant(t);
+    }
+    void endVariant() override {
+      --depth_;
+      handler_.endVariant();
+    }
+    void beginDictEntry() override {
+      ++depth_;
+      handler_.beginDictEntry();
+    }
+    void endDictEntry() override {
+      --depth_;
+      handler_.endDictEntry();
+    }
+    void beginArray(const DBusType &t, uint32_t len) override {
+      ++depth_;
+      handler_.beginArray(t, len);
+    }
+    void endArray() override {
+      --depth_;
+      handler_.endArray();
+    }
+    void beginStruct() override {
+      ++depth_;
+      handler_.beginStruct();
+    }
+    void endStruct() override {
+      --depth_;
+      handler_.endStruct();
+    }
+  };
+
+  class BodyCont final : public DBusType::ParseEventCont {
+    // We need to hold a reference to `bodyTypes_` until the body parsing
+    // is complete so that the types don't go out of scope too soon.
+    const std::shared_ptr<const DBusSignatureTypes> bodyTypes_;
+
+    EventHandler &handler_; // Not owned
+
+  public:
+    BodyCont(const std::string &signature, EventHandler &handler)
+        : bodyTypes_(DBusSignatureCache::threadLocal().lookup(signature)),
+          handler_(handler) {}
+
+    const std::vector<std::reference_wrapper<const DBusType>> &
+    getBodyTypes() const {
+      return bodyTypes_->getTypes();
+    }
+
+    virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &) override {
+      handler_.endMessage();
+      return ParseStop::mk();
+    }
+  };
+
+  // Continuation for parsing padding bytes.
+  class PaddingCont final : public ParseZeros::Cont {
+    EventHandler &handler_; // Not owned
+    std::unique_ptr<BodyCont> cont_;
+
+  public:
+    PaddingCont(EventHandler &handler, std::unique_ptr<BodyCont> &&cont)
+        : handler_(handler), cont_(std::move(cont)) {}
+
+    virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p) override {
+      auto &bodyTypes = cont_->getBodyTypes();
+      return parseObjectEvents<endianness>(p, bodyTypes, 0, handler_,
+                                           std::move(cont_));
+    }
+  };
+
+  // The last continuation of the header. It owns the `HeaderHandler`,
+  // which is used until the header is complete.
+  class HeaderCont final : public DBusType::ParseEventCont {
+    EventHandler &handler_; // Not owned
+    HeaderHandler headerHandler_;
+
+  public:
+    explicit HeaderCont(EventHandler &handler)
+        : handler_(handler), headerHandler_(handler) {}
+
+    HeaderHandler &getHeaderHandler() { return headerHandler_; }
+
+    virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &p) override {
+      headerHandler_.checkHeaderFields(p.getPos());
+      handler_.endHeader();
+
+      // The body is 8-byte aligned.
+      return parse_alignment<PaddingCont>(
+          p, DBusTypeUint64::instance_, handler_,
+          std::make_unique<BodyCont>(headerHandler_.getSignature(), handler_));
+    }
+  };
+
+  std::unique_ptr<HeaderCont> cont = std::make_unique<HeaderCont>(handler);
+  HeaderHandler &headerHandler = cont->getHeaderHandler();
+  return headerType.mkEventParser<endianness>(
+      Parse::State::initialState_, headerHandler, std::move(cont));
+}
+
+template std::unique_ptr<Parse::Cont>
+DBusMessage::parseEvents<LittleEndian>(EventHandler &handler);
+
+template std::unique_ptr<Parse::Cont>
+DBusMessage::parseEvents<BigEndian>(EventHandler &handler);
+
+std::unique_ptr<Parse::Cont>
+DBusMessage::parseEventsAuto(EventHandler &handler) {
+  return parseEndiannessByte([&handler](auto endianness) {
+    return parseEvents<decltype(endianness)::value>(handler);
+  });
+}
@@ -41,15 +41,17 @@ void DBusObjectDouble::print(Printer &p, size_t) const { p.printDouble(d_); }
 
 void DBusObjectUnixFD::print(Printer &p, size_t) const { p.printUint32(i_); }
 
-void DBusObjectString::print(Printer &p, size_t) const { p.printString(str_); }
+void DBusObjectString::print(Printer &p, size_t) const {
+  p.printString(std::string(str_.get()));
+}
 
 void DBusObjectSignature::print(Printer &p, size_t) const {
-  p.printString(str_);
+  p.printString(std::string(str_.get()));
 }
 
 void DBusObjectVariant::print(Printer &p, size_t indent) const {
   p.printString(_s("Variant "));
-  signature_.print(p, indent);
+  getSignature().print(p, indent);
   p.printNewline(indent);
   object_->print(p, indent);
 }
@@ -71,14 +73,14 @@ void DBusObjectSeq::print(Printer &p, size_t indent, char lbracket,
                           char rbracket) const {
   p.printChar(lbracket);
   ++indent;
-  const size_t n = elements_.size();
+  const size_t n = size_;
   if (n > 0) {
     p.printNewline(indent);
-    elements_[0]->print(p, indent);
+    data_[0]->print(p, indent);
     for (size_t i = 1; i < n; i++) {
       p.printChar(',');
       p.printNewline(indent);
-      elements_[i]->print(p, indent);
+      data_[i]->print(p, indent);
     }
   }
   --indent;
@@ -216,11 +218,11 @@ void DBusMessage::print(Printer &p, size_t indent) const {
     headerField.getElement(1)->print(p, 3);
   }
 
-  if (body_) {
+  if (body_ || rawBody_) {
     p.printNewline(0);
     p.printString(_s("Body:"));
     p.printNewline(indent);
-    body_->print(p, indent);
+    getBody().print(p, indent);
   }
 }
 
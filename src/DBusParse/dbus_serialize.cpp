@@ -64,6 +64,62 @@ std::string DBusType::toString() const {
   return result;
 }
 
+// Collects the signature of a type in a fixed size buffer, so that the
+// signature can be written after its length without serializing the
+// type twice. The spec limits signatures to 255 characters. If the
+// signature is longer than that, then `getPos()` is still its length, but
+// only the first 255 characters are kept.
+class SignatureBuffer final : public SerializerDryRunBase {
+public:
+  static const size_t maxSize_ = 255;
+
+private:
+  char buf_[maxSize_];
+
+public:
+  virtual void writeByte(char c) override {
+    const size_t pos = getPos();
+    if (pos < maxSize_) {
+      buf_[pos] = c;
+    }
+    SerializerDryRunBase::writeByte(c);
+  }
+
+  virtual void writeBytes(const char *buf, size_t bufsize) override {
+    for (size_t i = 0; i < bufsize; i++) {
+      writeByte(buf[i]);
+    }
+  }
+
+  virtual void
+  recordArraySize(const std::function<uint32_t(uint32_t)> &f) override {
+    (void)f(0xDEADBEEF);
+  }
+
+  const char *data() const { return buf_; }
+};
+
+void DBusObjectVariant::serializeSignature(Serializer &s) const {
+  if (signature_) {
+    signature_->serializeAfterPadding(s);
+    return;
+  }
+  const DBusType &t = object_->getType();
+  SignatureBuffer sig;
+  t.serialize(sig);
+  const size_t size = sig.getPos();
+  const uint8_t len = size;
+  s.writeByte(len);
+  if (size <= SignatureBuffer::maxSize_) {
+    s.writeBytes(sig.data(), size);
+  } else {
+    // Invalid signature. It doesn't fit in the buffer, so serialize the
+    // type again.
+    t.serialize(s);
+  }
+  s.writeByte('\0');
+}
+
 static void mkSignatureHelper(const DBusObjectSeq &seq, Serializer &s) {
   const size_t n = seq.length();
   for (size_t i = 0; i < n; i++) {
@@ -106,9 +162,9 @@ size_t DBusObject::serializedSize() const {
 
 void DBusMessage::serialize(Serializer &s) const {
   header_->serialize(s);
-  if (body_) {
+  if (body_ || rawBody_) {
     // The body should be 8-byte aligned.
     s.insertPadding(DBusTypeUint64::instance_.alignment());
-    body_->serialize(s);
+    getBody().serialize(s);
   }
 }
@@ -0,0 +1,91 @@
+// Copyright 2020-2024 Kevin Backhouse.
+//
+// This file is part of DBusParse.
+//
+// DBusParse is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// DBusParse is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with DBusParse.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "dbus_tape.hpp"
+#include "dbus_serialize.hpp"
+
+void DBusTape::beginVariant(const DBusType &t) {
+  begin('v');
+  // Serialize the signature straight into `strings_`, rather than into a
+  // temporary string. Types only contain ASCII characters, so the choice
+  // of LittleEndian is arbitrary, and they don't record any array sizes.
+  const std::vector<uint32_t> arraySizes;
+  const size_t offset = strings_.size();
+  SerializeToString<LittleEndian> s(arraySizes, strings_);
+  t.serialize(s);
+  const size_t size = strings_.size() - offset;
+  strings_.push_back('\0');
+  add('g', offset, size);
+}
+
+void DBusTape::clear() {
+  nodes_.clear();
+  strings_.clear();
+  open_.clear();
+  bodyIndex_ = 0;
+}
+
+template <Endianness endianness>
+std::unique_ptr<Parse::Cont> DBusTape::parseMessage(DBusTape &tape) {
+  tape.clear();
+  return DBusMessage::parseEvents<endianness>(tape);
+}
+
+template std::unique_ptr<Parse::Cont>
+DBusTape::parseMessage<LittleEndian>(DBusTape &tape);
+
+template std::unique_ptr<Parse::Cont>
+DBusTape::parseMessage<BigEndian>(DBusTape &tape);
+
+std::unique_ptr<Parse::Cont> DBusTape::parseMessageAuto(DBusTape &tape) {
+  tape.clear();
+  return DBusMessage::parseEventsAuto(tape);
+}
+
+template <Endianness endianness>
+std::unique_ptr<Parse::Cont> DBusTape::parseObject(DBusTape &tape,
+                                                   const DBusType &t) {
+  class Cont final : public DBusType::ParseEventCont {
+  public:
+    virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &) override {
+      return ParseStop::mk();
+    }
+  };
+
+  tape.clear();
+  return t.mkEventParser<endianness>(Parse::State::initialState_, tape,
+                                     std::make_unique<Cont>());
+}
+
+template std::unique_ptr<Parse::Cont>
+DBusTape::parseObject<LittleEndian>(DBusTape &tape, const DBusType &t);
+
+template std::unique_ptr<Parse::Cont>
+DBusTape::parseObject<BigEndian>(DBusTape &tape, const DBusType &t);
+
+DBusTape::Cursor DBusTape::findHeaderField(HeaderFieldName name) const {
+  // The header fields are an array of (byte, variant) structs, which is
+  // the seventh field of the header.
+  Cursor field = getHeader().getElement(6).getFirstElement();
+  for (; !field.atEnd(); field = field.next()) {
+    const Cursor fieldName = field.getFirstElement();
+    if (static_cast<uint8_t>(fieldName.getChar()) == name) {
+      return fieldName.next().getVariantValue();
+    }
+  }
+  return field;
+}
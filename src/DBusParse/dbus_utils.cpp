@@ -19,30 +19,46 @@
 #include "dbus_print.hpp"
 #include "dbus_serialize.hpp"
 #include "utils.hpp"
+#include <cstring>
+#include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
-void send_dbus_message_with_fds(const int fd, const DBusMessage &message,
-                                const size_t nfds, const int *fds) {
-  std::vector<uint32_t> arraySizes;
-  SerializerInitArraySizes s0(arraySizes);
-  message.serialize(s0);
+size_t DBusConnectionWriter::serialize(const DBusMessage &message) {
+  serializer_.reset();
+  serializeTo(serializer_, message);
+  serializer_.getIovecs(iov_);
+  return serializer_.getPos();
+}
 
-  const size_t size = s0.getPos();
-  std::unique_ptr<char[]> buf(new char[size]);
-  SerializeToBuffer<LittleEndian> s1(arraySizes, buf.get());
-  message.serialize(s1);
+// Send `iov`, which is `size` bytes in total. If `nfds` is non-zero then
+// it is sent with `sendmsg`, attaching `fds` with SCM_RIGHTS, and
+// `control` is the buffer for the ancillary data. Otherwise it is sent
+// with `writev`, so `fd` doesn't need to be a socket. Like
+// `send_dbus_message`, errors are reported on stderr.
+static void send_iovecs_with_fds(const int fd, struct iovec *iov,
+                                 const size_t iovcnt, const size_t size,
+                                 std::vector<char> &control, const size_t nfds,
+                                 const int *fds) {
+  if (nfds == 0) {
+    const ssize_t wr = writev(fd, iov, iovcnt);
+    if (wr < 0) {
+      const int err = errno;
+      fprintf(stderr, "write failed: %s\n", strerror(err));
+    } else if (static_cast<size_t>(wr) != size) {
+      fprintf(stderr, "write incomplete: %ld < %lu\n", wr, size);
+    }
+    return;
+  }
 
   struct msghdr msg = {}; // Zero initialize.
-  struct iovec io = {};
-  io.iov_base = buf.get();
-  io.iov_len = size;
-
   const size_t fds_size = nfds * sizeof(int);
-  msg.msg_iov = &io;
-  msg.msg_iovlen = 1;
+  msg.msg_iov = iov;
+  msg.msg_iovlen = iovcnt;
   msg.msg_controllen = CMSG_SPACE(fds_size);
-  msg.msg_control = malloc(msg.msg_controllen);
+  control.resize(msg.msg_controllen);
+  msg.msg_control = control.data();
 
   struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
   cmsg->cmsg_level = SOL_SOCKET;
@@ -57,27 +73,198 @@ void send_dbus_message_with_fds(const int fd, const DBusMessage &message,
   } else if (static_cast<size_t>(wr) != size) {
     fprintf(stderr, "sendmsg incomplete: %ld < %lu\n", wr, size);
   }
+}
+
+void DBusConnectionWriter::sendWithFds(const DBusMessage &message,
+                                       const size_t nfds, const int *fds) {
+  const size_t size = serialize(message);
+  send_iovecs_with_fds(fd_, iov_.data(), iov_.size(), size, control_, nfds,
+                       fds);
+}
+
+void DBusConnectionWriter::send(const DBusMessage &message) {
+  sendWithFds(message, 0, nullptr);
+}
+
+void DBusSendQueue::pushWithFds(const DBusMessage &message,
+                                const size_t nfds, const int *fds) {
+  Entry entry;
+  if (!spareBuffers_.empty()) {
+    entry.bytes_ = std::move(spareBuffers_.back());
+    spareBuffers_.pop_back();
+  }
+  serializeMessage<LittleEndian>(entry.bytes_, message);
+
+  entry.fds_.reserve(nfds);
+  for (size_t i = 0; i < nfds; i++) {
+    const int newfd = fcntl(fds[i], F_DUPFD_CLOEXEC, 0);
+    if (newfd < 0) {
+      throw ErrorWithErrno("Could not duplicate file descriptor.");
+    }
+    entry.fds_.emplace_back(newfd);
+  }
+
+  pendingBytes_ += entry.bytes_.size();
+  queue_.push_back(std::move(entry));
+}
 
-  free(msg.msg_control);
+void DBusSendQueue::consume(size_t n) {
+  pendingBytes_ -= n;
+  while (n > 0) {
+    Entry &front = queue_.front();
+    const size_t remaining = front.bytes_.size() - offset_;
+    if (n < remaining) {
+      offset_ += n;
+      return;
+    }
+    n -= remaining;
+    offset_ = 0;
+    if (spareBuffers_.size() < maxSpareBuffers_ &&
+        front.bytes_.capacity() <= maxSpareBufferSize_) {
+      front.bytes_.clear();
+      spareBuffers_.push_back(std::move(front.bytes_));
+    }
+    // Closes the file descriptors, which have been sent.
+    queue_.pop_front();
+  }
+}
+
+bool DBusSendQueue::flush() {
+  while (!queue_.empty()) {
+    const Entry &front = queue_.front();
+
+    // Send the rest of the message at the front of the queue, together
+    // with the messages after it, up to the next one which has file
+    // descriptors. That's because the file descriptors are attached to
+    // the first byte of the `sendmsg`.
+    iov_.clear();
+    iov_.push_back(
+        iovec{const_cast<char *>(front.bytes_.data()) + offset_,
+              front.bytes_.size() - offset_});
+    const size_t n = queue_.size();
+    for (size_t i = 1; i < n && iov_.size() < maxIovecs_; i++) {
+      const Entry &entry = queue_[i];
+      if (!entry.fds_.empty()) {
+        break;
+      }
+      iov_.push_back(iovec{const_cast<char *>(entry.bytes_.data()),
+                           entry.bytes_.size()});
+    }
+
+    struct msghdr msg = {}; // Zero initialize.
+    msg.msg_iov = iov_.data();
+    msg.msg_iovlen = iov_.size();
+
+    // If the first chunk of the message hasn't been sent yet, then
+    // attach the file descriptors to it.
+    const size_t nfds = offset_ == 0 ? front.fds_.size() : 0;
+    if (nfds > 0) {
+      const size_t fds_size = nfds * sizeof(int);
+      msg.msg_controllen = CMSG_SPACE(fds_size);
+      control_.resize(msg.msg_controllen);
+      msg.msg_control = control_.data();
+
+      struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(fds_size);
+      int *data = reinterpret_cast<int *>(CMSG_DATA(cmsg));
+      for (size_t i = 0; i < nfds; i++) {
+        data[i] = front.fds_[i].get();
+      }
+    }
+
+    const ssize_t wr = sendmsg(fd_, &msg, MSG_NOSIGNAL);
+    if (wr < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return false;
+      }
+      throw ErrorWithErrno("sendmsg failed");
+    }
+    consume(wr);
+  }
+  return true;
+}
+
+void send_dbus_message_with_fds(const int fd, const DBusMessage &message,
+                                const size_t nfds, const int *fds) {
+  DBusConnectionWriter(fd).sendWithFds(message, nfds, fds);
 }
 
 void send_dbus_message(const int fd, const DBusMessage &message) {
-  std::vector<uint32_t> arraySizes;
-  SerializerInitArraySizes s0(arraySizes);
-  message.serialize(s0);
+  DBusConnectionWriter(fd).send(message);
+}
 
-  const size_t size = s0.getPos();
-  std::unique_ptr<char[]> buf(new char[size]);
-  SerializeToBuffer<LittleEndian> s1(arraySizes, buf.get());
-  message.serialize(s1);
+// The maximum number of file descriptors that Linux will pass with a
+// single `sendmsg` (`SCM_MAX_FD`). The fds arrive with the first byte of
+// their message, which is before its UNIX_FDS header field has been
+// parsed, so the ancillary data buffer needs to be big enough for the
+// maximum.
+static const size_t maxUnixFdsPerRecv = 253;
+
+// Read from `fd` with `recvmsg` and append any file descriptors that were
+// passed with SCM_RIGHTS to `fds`. If `fd` isn't a socket, then this is
+// equivalent to `read`. The return value is the same as for `read`.
+static ssize_t recv_with_fds(const int fd, char *buf, const size_t bufsize,
+                             char *control, const size_t controlsize,
+                             std::deque<AutoCloseFD> &fds) {
+  struct iovec io = {buf, bufsize};
+  struct msghdr msg = {}; // Zero initialize.
+  msg.msg_iov = &io;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = controlsize;
 
-  const ssize_t wr = write(fd, buf.get(), size);
-  if (wr < 0) {
-    const int err = errno;
-    fprintf(stderr, "write failed: %s\n", strerror(err));
-  } else if (static_cast<size_t>(wr) != size) {
-    fprintf(stderr, "write incomplete: %ld < %lu\n", wr, size);
+  const ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+  if (n < 0) {
+    if (errno == ENOTSOCK) {
+      return read(fd, buf, bufsize);
+    }
+    return n;
+  }
+
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      const size_t nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      for (size_t i = 0; i < nfds; i++) {
+        int newfd;
+        memcpy(&newfd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+        fds.emplace_back(newfd);
+      }
+    }
   }
+  if (msg.msg_flags & MSG_CTRUNC) {
+    // The kernel has closed the fds which didn't fit, so the
+    // `DBusObjectUnixFD` indices of the message would be wrong.
+    throw Error("recvmsg: file descriptors were truncated");
+  }
+  return n;
+}
+
+// Move the file descriptors which belong to `message` from the front of
+// `fds` to the message. The number of fds is given by the UNIX_FDS header
+// field.
+static void attach_fds(DBusMessage &message, std::deque<AutoCloseFD> &fds,
+                       const size_t pos) {
+  const uint32_t n = message.getHeader_unixFds();
+  if (n == 0) {
+    return;
+  }
+  if (n > fds.size()) {
+    throw ParseError(pos, "Message has fewer file descriptors than its "
+                          "UNIX_FDS header field.");
+  }
+  std::vector<AutoCloseFD> messageFds;
+  messageFds.reserve(n);
+  for (uint32_t i = 0; i < n; i++) {
+    messageFds.emplace_back(std::move(fds.front()));
+    fds.pop_front();
+  }
+  message.attachFds(std::move(messageFds));
 }
 
 // Note: this is a very simplistic implementation. It expects to loop until
@@ -85,28 +272,132 @@ void send_dbus_message(const int fd, const DBusMessage &message) {
 // blocking socket.
 std::unique_ptr<DBusMessage> receive_dbus_message(const int fd) {
   std::unique_ptr<DBusMessage> message;
-  Parse p(DBusMessage::parseLE(message));
+  Parse p(DBusMessage::parseAuto(message));
+  std::deque<AutoCloseFD> fds;
+  alignas(struct cmsghdr) char control[CMSG_SPACE(maxUnixFdsPerRecv *
+                                                  sizeof(int))];
 
   while (true) {
     char buf[256];
     size_t required = p.maxRequiredBytes();
     if (required == 0) {
+      attach_fds(*message, fds, p.getPos());
       return message;
     }
     if (required > sizeof(buf)) {
       required = sizeof(buf);
     }
-    const ssize_t n = read(fd, buf, required);
-    if (n < 0 || size_t(n) < required) {
-      // Note: this error could happen by accident if `fd` is a
-      // non-blocking socket, because we might get a partial read. (See
-      // comment at top of function.)
-      throw ParseError(p.getPos(), _s("No more input. n=") + std::to_string(n));
+    // `recvmsg` can return fewer bytes than requested, because it stops
+    // after a chunk of data which has file descriptors attached.
+    size_t received = 0;
+    while (received < required) {
+      const ssize_t n = recv_with_fds(fd, buf + received, required - received,
+                                      control, sizeof(control), fds);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        // Note: this error could happen by accident if `fd` is a
+        // non-blocking socket. Use `DBusMessageReader` instead.
+        throw ParseError(p.getPos(),
+                         _s("No more input. n=") + std::to_string(n));
+      }
+      received += n;
     }
     p.parse(buf, required);
   }
 }
 
+DBusMessageReader::DBusMessageReader(const int fd, const size_t bufsize)
+    : fd_(fd), buf_(bufsize),
+      control_(CMSG_SPACE(maxUnixFdsPerRecv * sizeof(int))),
+      parse_(std::make_unique<Parse>(DBusMessage::parseAuto(message_))),
+      arenaChunkSize_(0) {}
+
+std::unique_ptr<Parse> DBusMessageReader::mkParser() {
+  if (arenaChunkSize_ == 0) {
+    return std::make_unique<Parse>(DBusMessage::parseAuto(message_));
+  }
+  // `parseAuto` doesn't create any objects until it has chosen the byte
+  // order, so it doesn't need the initial state.
+  return std::make_unique<Parse>(
+      std::make_shared<ParseArena>(arenaChunkSize_), nullptr,
+      [this](const Parse::State &) {
+        return DBusMessage::parseAuto(message_);
+      });
+}
+
+void DBusMessageReader::useArenas(const size_t chunkSize) {
+  arenaChunkSize_ = chunkSize;
+  if (parse_->getPos() == 0 && parse_->getPendingSize() == 0) {
+    parse_ = mkParser();
+  }
+}
+
+void DBusMessageReader::feed(const char *buf, size_t bufsize,
+                             const Handler &handler) {
+  while (bufsize > 0) {
+    const size_t used = parse_->feed(buf, bufsize);
+    buf += used;
+    bufsize -= used;
+    if (parse_->maxRequiredBytes() == 0) {
+      // The message is complete, so start parsing the next one.
+      attach_fds(*message_, pendingFds_, parse_->getPos());
+      handler(std::move(message_));
+      parse_ = mkParser();
+    }
+  }
+}
+
+ssize_t DBusMessageReader::readOnce(const Handler &handler) {
+  while (true) {
+    const ssize_t n = recv_with_fds(fd_, buf_.data(), buf_.size(),
+                                    control_.data(), control_.size(),
+                                    pendingFds_);
+    if (n > 0) {
+      feed(buf_.data(), n, handler);
+      return n;
+    } else if (n == 0) {
+      if (parse_->getPos() != 0 || parse_->getPendingSize() != 0) {
+        throw ParseError(parse_->getPos(),
+                         "Connection closed in the middle of a message.");
+      }
+      return 0;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return -1;
+    } else if (errno != EINTR) {
+      throw ErrorWithErrno("recvmsg failed");
+    }
+  }
+}
+
+bool DBusMessageReader::receive(const Handler &handler) {
+  while (true) {
+    const ssize_t n = readOnce(handler);
+    if (n <= 0) {
+      return n < 0;
+    }
+  }
+}
+
+bool DBusMessageReader::receive(
+    std::vector<std::unique_ptr<DBusMessage>> &messages) {
+  return receive([&messages](std::unique_ptr<DBusMessage> &&message) {
+    messages.push_back(std::move(message));
+  });
+}
+
+bool DBusMessageReader::receiveOnce(const Handler &handler) {
+  return readOnce(handler) != 0;
+}
+
+bool DBusMessageReader::receiveOnce(
+    std::vector<std::unique_ptr<DBusMessage>> &messages) {
+  return receiveOnce([&messages](std::unique_ptr<DBusMessage> &&message) {
+    messages.push_back(std::move(message));
+  });
+}
+
 void print_dbus_object(const int fd, const DBusObject &obj) {
   PrinterFD printFD(fd, 16, 2);
   obj.print(printFD);
@@ -158,17 +449,43 @@ std::unique_ptr<DBusMessage> mk_dbus_method_call_msg(
   return DBusMessage::mk(std::move(header), std::move(body));
 }
 
+void serialize_dbus_method_call_msg(
+    std::vector<char> &buf, const uint32_t serialNumber,
+    const DBusMessageBody &body, std::string_view path,
+    std::string_view interface, std::string_view destination,
+    std::string_view member, const size_t nfds, const MessageFlags flags) {
+  DBusMessageWriter<LittleEndian> w(buf, MSGTYPE_METHOD_CALL, flags,
+                                    serialNumber);
+  w.addPathField(MSGHDR_PATH, path);
+  w.addStringField(MSGHDR_INTERFACE, interface);
+  w.addStringField(MSGHDR_DESTINATION, destination);
+  w.addStringField(MSGHDR_MEMBER, member);
+  w.addSignatureField(body);
+  if (nfds > 0) {
+    w.addUint32Field(MSGHDR_UNIX_FDS, nfds);
+  }
+  w.writeBody(body);
+}
+
+// Send a message which has already been serialized.
+static void send_dbus_message_bytes(const int fd,
+                                    const std::vector<char> &bytes,
+                                    const size_t nfds, const int *fds) {
+  struct iovec iov = {const_cast<char *>(bytes.data()), bytes.size()};
+  std::vector<char> control;
+  send_iovecs_with_fds(fd, &iov, 1, bytes.size(), control, nfds, fds);
+}
+
 void dbus_method_call_with_fds(const int fd, const uint32_t serialNumber,
                                std::unique_ptr<DBusMessageBody> &&body,
                                std::string &&path, std::string &&interface,
                                std::string &&destination, std::string &&member,
                                const size_t nfds, const int *fds,
                                const MessageFlags flags) {
-  std::unique_ptr<DBusMessage> message(mk_dbus_method_call_msg(
-      serialNumber, std::move(body), std::move(path), std::move(interface),
-      std::move(destination), std::move(member), nfds, flags));
-
-  send_dbus_message_with_fds(fd, *message, nfds, fds);
+  std::vector<char> bytes;
+  serialize_dbus_method_call_msg(bytes, serialNumber, *body, path, interface,
+                                 destination, member, nfds, flags);
+  send_dbus_message_bytes(fd, bytes, nfds, fds);
 }
 
 void dbus_method_call(const int fd, const uint32_t serialNumber,
@@ -176,11 +493,10 @@ void dbus_method_call(const int fd, const uint32_t serialNumber,
                       std::string &&path, std::string &&interface,
                       std::string &&destination, std::string &&member,
                       const MessageFlags flags) {
-  std::unique_ptr<DBusMessage> message(mk_dbus_method_call_msg(
-      serialNumber, std::move(body), std::move(path), std::move(interface),
-      std::move(destination), std::move(member), 0, flags));
-
-  send_dbus_message(fd, *message);
+  std::vector<char> bytes;
+  serialize_dbus_method_call_msg(bytes, serialNumber, *body, path, interface,
+                                 destination, member, 0, flags);
+  send_dbus_message_bytes(fd, bytes, 0, nullptr);
 }
 
 std::unique_ptr<DBusMessage> mk_dbus_method_reply_msg(
@@ -212,15 +528,27 @@ std::unique_ptr<DBusMessage> mk_dbus_method_reply_msg(
   return DBusMessage::mk(std::move(header), std::move(body));
 }
 
+void serialize_dbus_method_reply_msg(std::vector<char> &buf,
+                                     const uint32_t serialNumber,
+                                     const uint32_t replySerialNumber,
+                                     const DBusMessageBody &body,
+                                     std::string_view destination) {
+  DBusMessageWriter<LittleEndian> w(buf, MSGTYPE_METHOD_RETURN,
+                                    MSGFLAGS_EMPTY, serialNumber);
+  w.addStringField(MSGHDR_DESTINATION, destination);
+  w.addSignatureField(body);
+  w.addUint32Field(MSGHDR_REPLY_SERIAL, replySerialNumber);
+  w.writeBody(body);
+}
+
 void dbus_method_reply(
     const int fd, const uint32_t serialNumber,
     const uint32_t replySerialNumber, // serial number that we are replying to
     std::unique_ptr<DBusMessageBody> &&body, std::string &&destination) {
-  std::unique_ptr<DBusMessage> message(
-      mk_dbus_method_reply_msg(serialNumber, replySerialNumber, std::move(body),
-                               std::move(destination)));
-
-  send_dbus_message(fd, *message);
+  std::vector<char> bytes;
+  serialize_dbus_method_reply_msg(bytes, serialNumber, replySerialNumber,
+                                  *body, destination);
+  send_dbus_message_bytes(fd, bytes, 0, nullptr);
 }
 
 std::unique_ptr<DBusMessage> mk_dbus_method_error_reply_msg(
@@ -249,15 +577,27 @@ std::unique_ptr<DBusMessage> mk_dbus_method_error_reply_msg(
   return DBusMessage::mk(std::move(header), DBusMessageBody::mk0());
 }
 
+void serialize_dbus_method_error_reply_msg(std::vector<char> &buf,
+                                           const uint32_t serialNumber,
+                                           const uint32_t replySerialNumber,
+                                           std::string_view destination,
+                                           std::string_view errmsg) {
+  DBusMessageWriter<LittleEndian> w(buf, MSGTYPE_ERROR, MSGFLAGS_EMPTY,
+                                    serialNumber);
+  w.addStringField(MSGHDR_DESTINATION, destination);
+  w.addUint32Field(MSGHDR_REPLY_SERIAL, replySerialNumber);
+  w.addStringField(MSGHDR_ERROR_NAME, errmsg);
+  w.finish();
+}
+
 void dbus_method_error_reply(
     const int fd, const uint32_t serialNumber,
     const uint32_t replySerialNumber, // serial number that we are replying to
     std::string &&destination, std::string &&errmsg) {
-  std::unique_ptr<DBusMessage> message(mk_dbus_method_error_reply_msg(
-      serialNumber, replySerialNumber, std::move(destination),
-      std::move(errmsg)));
-
-  send_dbus_message(fd, *message);
+  std::vector<char> bytes;
+  serialize_dbus_method_error_reply_msg(bytes, serialNumber, replySerialNumber,
+                                        destination, errmsg);
+  send_dbus_message_bytes(fd, bytes, 0, nullptr);
 }
 
 void dbus_send_hello(const int fd) {
@@ -16,7 +16,11 @@
 // along with DBusParse.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "parse.hpp"
+#include "utils.hpp"
+#include <algorithm>
 #include <assert.h>
+#include <stdint.h>
+#include <string.h>
 
 static_assert(!std::is_polymorphic<Parse::State>::value,
               "Parse::State does not have any virtual methods");
@@ -26,6 +30,190 @@ static_assert(!std::is_polymorphic<Parse>::value,
 
 const Parse::State Parse::State::initialState_(0);
 
+// The free lists are bypassed when AddressSanitizer is enabled, so that
+// it can still detect use-after-free bugs in the continuations.
+#if defined(__SANITIZE_ADDRESS__)
+#define PARSEALLOC_USE_FREE_LISTS 0
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define PARSEALLOC_USE_FREE_LISTS 0
+#endif
+#endif
+#ifndef PARSEALLOC_USE_FREE_LISTS
+#define PARSEALLOC_USE_FREE_LISTS 1
+#endif
+
+// Per-thread free lists of continuation-sized memory blocks. The size
+// classes are multiples of 16 bytes, up to 256 bytes, which is
+// comfortably larger than any of the continuations. Larger requests go
+// straight to the global allocator. Every block is allocated with the
+// global `operator new`, so it doesn't matter if a continuation is freed
+// on a different thread than the one that allocated it.
+class ParseFreeLists final {
+  struct Block {
+    Block *next_;
+  };
+
+  static const size_t sizeClassStep_ = 16;
+  static const size_t numSizeClasses_ = 16;
+
+  // Limit on the number of blocks cached per size class, so that a burst
+  // of deeply nested input doesn't pin a lot of memory forever.
+  static const size_t maxBlocksPerClass_ = 1024;
+
+  Block *heads_[numSizeClasses_];
+  size_t counts_[numSizeClasses_];
+
+public:
+  ParseFreeLists() : heads_(), counts_() {}
+
+  ~ParseFreeLists() {
+    for (size_t i = 0; i < numSizeClasses_; i++) {
+      Block *b = heads_[i];
+      while (b) {
+        Block *next = b->next_;
+        ::operator delete(b);
+        b = next;
+      }
+      heads_[i] = 0;
+      // A continuation might still be freed during thread teardown, after
+      // this destructor has run. Setting the count to the maximum makes
+      // sure that it goes back to the global allocator.
+      counts_[i] = maxBlocksPerClass_;
+    }
+  }
+
+  static size_t sizeClass(size_t size) {
+    return (size + sizeClassStep_ - 1) / sizeClassStep_;
+  }
+
+  static bool isPooled(size_t sizeclass) {
+    return PARSEALLOC_USE_FREE_LISTS && 0 < sizeclass &&
+           sizeclass <= numSizeClasses_;
+  }
+
+  void *alloc(size_t sizeclass) {
+    Block *b = heads_[sizeclass - 1];
+    if (b) {
+      heads_[sizeclass - 1] = b->next_;
+      --counts_[sizeclass - 1];
+      return b;
+    }
+    return ::operator new(sizeclass * sizeClassStep_);
+  }
+
+  void release(void *p, size_t sizeclass) {
+    if (counts_[sizeclass - 1] >= maxBlocksPerClass_) {
+      ::operator delete(p);
+      return;
+    }
+    Block *b = static_cast<Block *>(p);
+    b->next_ = heads_[sizeclass - 1];
+    heads_[sizeclass - 1] = b;
+    ++counts_[sizeclass - 1];
+  }
+};
+
+static thread_local ParseFreeLists parseFreeLists_;
+
+void *ParseAlloc::operator new(size_t size) {
+  const size_t sizeclass = ParseFreeLists::sizeClass(size);
+  if (likely(ParseFreeLists::isPooled(sizeclass))) {
+    return parseFreeLists_.alloc(sizeclass);
+  }
+  return ::operator new(size);
+}
+
+void ParseAlloc::operator delete(void *p, size_t size) {
+  const size_t sizeclass = ParseFreeLists::sizeClass(size);
+  if (likely(ParseFreeLists::isPooled(sizeclass))) {
+    parseFreeLists_.release(p, sizeclass);
+    return;
+  }
+  ::operator delete(p);
+}
+
+ParseArena::ParseArena(size_t chunkSize)
+    : chunks_(nullptr), cleanups_(nullptr), pos_(0), end_(0),
+      chunkSize_(std::max(chunkSize, 2 * sizeof(Chunk))) {
+  // Allocate the first chunk eagerly, so that `alloc` never hands out
+  // address zero.
+  Chunk *c = newChunk(chunkSize_);
+  pos_ = reinterpret_cast<uintptr_t>(c + 1);
+  end_ = reinterpret_cast<uintptr_t>(c) + chunkSize_;
+}
+
+ParseArena::~ParseArena() {
+  // The cleanups are in reverse order of creation.
+  Cleanup *cleanup = cleanups_;
+  while (cleanup) {
+    Cleanup *next = cleanup->next_;
+    cleanup->destroy_(cleanup->p_);
+    cleanup = next;
+  }
+  Chunk *c = chunks_;
+  while (c) {
+    Chunk *next = c->next_;
+    ::operator delete(c);
+    c = next;
+  }
+}
+
+ParseArena::Chunk *ParseArena::newChunk(size_t size) {
+  Chunk *c = static_cast<Chunk *>(::operator new(size));
+  c->next_ = chunks_;
+  chunks_ = c;
+  return c;
+}
+
+void *ParseArena::allocSlow(size_t size, size_t alignment) {
+  assert(alignment <= alignof(std::max_align_t));
+  // Chunks are aligned to `alignof(std::max_align_t)` by `operator new`,
+  // so this is the offset of the first suitably aligned byte.
+  const size_t offset = (sizeof(Chunk) + alignment - 1) & ~(alignment - 1);
+  if (size > chunkSize_ / 4) {
+    // Big allocations get a chunk of their own, so that the rest of the
+    // current chunk isn't wasted.
+    if (size > SIZE_MAX - offset) {
+      throw std::bad_alloc();
+    }
+    Chunk *c = newChunk(offset + size);
+    return reinterpret_cast<char *>(c) + offset;
+  }
+  if (chunkSize_ < maxChunkSize_) {
+    chunkSize_ *= 2;
+  }
+  Chunk *c = newChunk(chunkSize_);
+  const uintptr_t p = reinterpret_cast<uintptr_t>(c) + offset;
+  pos_ = p + size;
+  end_ = reinterpret_cast<uintptr_t>(c) + chunkSize_;
+  return reinterpret_cast<void *>(p);
+}
+
+void ParseArena::addCleanup(void (*destroy)(void *), void *p) {
+  Cleanup *cleanup =
+      static_cast<Cleanup *>(alloc(sizeof(Cleanup), alignof(Cleanup)));
+  cleanup->next_ = cleanups_;
+  cleanup->destroy_ = destroy;
+  cleanup->p_ = p;
+  cleanups_ = cleanup;
+}
+
+std::string_view ParseArena::copyString(std::string_view str) {
+  char *p = static_cast<char *>(alloc(str.size() + 1, 1));
+  memcpy(p, str.data(), str.size());
+  p[str.size()] = '\0';
+  return std::string_view(p, str.size());
+}
+
+size_t ParseArena::numChunks() const {
+  size_t n = 0;
+  for (const Chunk *c = chunks_; c; c = c->next_) {
+    n++;
+  }
+  return n;
+}
+
 void Parse::parse(const char *buf, size_t bufsize) {
   assert(minRequiredBytes() <= bufsize);
   assert(bufsize <= maxRequiredBytes());
@@ -35,6 +223,65 @@ void Parse::parse(const char *buf, size_t bufsize) {
   cont_ = cont_->parse(state_, buf, bufsize);
 }
 
+const char *Parse::parseWithLookahead(const char *buf, size_t bufsize,
+                                      const char *next, const char *end) {
+  // Clear the lookahead on the way out, even if parsing fails, because
+  // it points into the caller's buffer.
+  struct Clear {
+    State &state_;
+    ~Clear() {
+      state_.lookahead_ = nullptr;
+      state_.lookaheadEnd_ = nullptr;
+    }
+  } clear{state_};
+  state_.lookahead_ = next;
+  state_.lookaheadEnd_ = end;
+  parse(buf, bufsize);
+  return state_.lookahead_;
+}
+
+size_t Parse::feed(const char *buf, size_t bufsize) {
+  size_t used = 0;
+
+  if (pendingSize_ > 0) {
+    // Complete the field that was left over from the previous call. The
+    // continuation hasn't changed since then, so `minRequiredBytes()` is
+    // still greater than `pendingSize_`.
+    const size_t required = minRequiredBytes();
+    assert(pendingSize_ < required);
+    const size_t n = std::min(required - pendingSize_, bufsize);
+    memcpy(&pending_[pendingSize_], buf, n);
+    pendingSize_ += n;
+    used = n;
+    if (pendingSize_ < required) {
+      return used;
+    }
+    pendingSize_ = 0;
+    used = parseWithLookahead(pending_, required, buf + used, buf + bufsize) -
+           buf;
+  }
+
+  while (used < bufsize) {
+    const size_t required = maxRequiredBytes();
+    if (required == 0) {
+      // Parsing is complete.
+      break;
+    }
+    const size_t remaining = bufsize - used;
+    if (remaining < minRequiredBytes()) {
+      // Not enough bytes to make progress, so save them for later.
+      memcpy(pending_, buf + used, remaining);
+      pendingSize_ = remaining;
+      return bufsize;
+    }
+    const size_t n = std::min(remaining, required);
+    used = parseWithLookahead(buf + used, n, buf + used + n, buf + bufsize) -
+           buf;
+  }
+
+  return used;
+}
+
 uint8_t Parse::minRequiredBytes() const { return cont_->minRequiredBytes(); }
 
 size_t Parse::maxRequiredBytes() const { return cont_->maxRequiredBytes(); }
@@ -63,35 +310,39 @@ std::unique_ptr<Parse::Cont> ParseChar::mk(std::unique_ptr<Cont> &&cont) {
 
 std::unique_ptr<Parse::Cont>
 ParseNChars::parse(const Parse::State &p, const char *buf, size_t bufsize) {
-  (void)bufsize;
   assert(bufsize <= n_);
-  str_.append(buf, bufsize);
+  if (!p.getBuffer()) {
+    str_.append(buf, bufsize);
+  }
 
   // Parse remaining bytes.
-  return mk(p, std::move(str_), n_ - bufsize, std::move(cont_));
+  return mk(p, std::move(str_), start_, n_ - bufsize, std::move(cont_));
 }
 
 std::unique_ptr<Parse::Cont> ParseNChars::mk(const Parse::State &p,
-                                             std::string &&str, size_t n,
+                                             std::string &&str, size_t start,
+                                             size_t n,
                                              std::unique_ptr<Cont> &&cont) {
   if (n == 0) {
     // There's nothing to parse, so invoke the next continuation immediately.
+    const std::shared_ptr<const char> &buffer = p.getBuffer();
+    if (buffer) {
+      return cont->parseView(
+          p, std::string_view(buffer.get() + start, p.getPos() - start));
+    }
     return cont->parse(p, std::move(str));
   }
 
-  return std::make_unique<ParseNChars>(std::move(str), n, std::move(cont));
+  return std::make_unique<ParseNChars>(std::move(str), start, n,
+                                       std::move(cont));
 }
 
 std::unique_ptr<Parse::Cont>
 ParseZeros::parse(const Parse::State &p, const char *buf, size_t bufsize) {
   assert(bufsize <= n_);
 
-  // Check that the bytes are zero.
-  for (size_t i = 0; i < bufsize; i++) {
-    if (buf[i] != '\0') {
-      throw ParseError(p.getPos() + i, "Unexpected non-zero byte.");
-    }
-  }
+  // `p.getPos()` has already been advanced past the end of `buf`.
+  check(p.getPos() - bufsize, buf, bufsize);
 
   // Parse remaining bytes.
   return mk(p, n_ - bufsize, std::move(cont_));
@@ -99,11 +350,48 @@ ParseZeros::parse(const Parse::State &p, const char *buf, size_t bufsize) {
 
 std::unique_ptr<Parse::Cont> ParseZeros::mk(const Parse::State &p, size_t n,
                                             std::unique_ptr<Cont> &&cont) {
-  if (n == 0) {
-    // There's nothing to parse, so invoke the next continuation
+  if (skip(p, n)) {
+    // There's nothing left to parse, so invoke the next continuation
     // immediately.
     return cont->parse(p);
   }
 
   return std::make_unique<ParseZeros>(n, std::move(cont));
 }
+
+bool ParseZeros::skip(const Parse::State &p, size_t n) {
+  if (n == 0) {
+    return true;
+  }
+  const char *buf = p.takeLookahead(n);
+  if (!buf) {
+    return false;
+  }
+  // `takeLookahead` has already advanced `p.getPos()` past the bytes.
+  check(p.getPos() - n, buf, n);
+  return true;
+}
+
+void ParseZeros::check(size_t pos, const char *buf, size_t bufsize) {
+  // OR all the bytes together, a word at a time. The compiler is able to
+  // vectorize this loop.
+  uint64_t acc = 0;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= bufsize; i += sizeof(uint64_t)) {
+    uint64_t w;
+    memcpy(&w, buf + i, sizeof(w));
+    acc |= w;
+  }
+  for (; i < bufsize; i++) {
+    acc |= static_cast<uint8_t>(buf[i]);
+  }
+
+  if (unlikely(acc != 0)) {
+    // Find the offending byte, so that the error has the correct position.
+    i = 0;
+    while (buf[i] == '\0') {
+      i++;
+    }
+    throw ParseError(pos + i, "Unexpected non-zero byte.");
+  }
+}
@@ -19,29 +19,109 @@
 #include "dbus_print.hpp"
 #include "dbus_random.hpp"
 #include "dbus_serialize.hpp"
+#include "dbus_tape.hpp"
+#include "dbus_utils.hpp"
 #include "endianness.hpp"
+#include "utils.hpp"
+#include <cstring>
 #include <memory>
+#include <sys/socket.h>
 #include <unistd.h>
 
 template <Endianness endianness>
 std::unique_ptr<char[]> dbus_object_to_buffer(const DBusObject &object,
                                               size_t &size) {
-  std::vector<uint32_t> arraySizes;
-  SerializerInitArraySizes s0(arraySizes);
+  SerializerDryRun s0;
   object.serialize(s0);
   size = s0.getPos();
 
   std::unique_ptr<char[]> result(new char[size]);
-  SerializeToBuffer<endianness> s1(arraySizes, result.get());
+  SerializeToBuffer<endianness> s1(result.get());
   object.serialize(s1);
 
   return result;
 }
 
+template <Endianness endianness = LittleEndian>
+std::unique_ptr<char[]> dbus_message_to_buffer(const DBusMessage &message,
+                                               size_t &size) {
+  SerializerDryRun s0;
+  message.serialize(s0);
+  size = s0.getPos();
+
+  std::unique_ptr<char[]> result(new char[size]);
+  SerializeToBuffer<endianness> s1(result.get());
+  message.serialize(s1);
+
+  // Fix the endianness byte, which is always 'l' in the messages created
+  // by functions like `mk_dbus_method_call_msg`.
+  result[0] = endianness == LittleEndian ? 'l' : 'B';
+
+  return result;
+}
+
+// The method call which the message tests use. Only the serial number,
+// the body and the number of file descriptors vary between the tests.
+std::unique_ptr<DBusMessage>
+mk_test_message(const uint32_t serialNumber,
+                std::unique_ptr<DBusMessageBody> &&body,
+                const size_t nfds = 0) {
+  return mk_dbus_method_call_msg(serialNumber, std::move(body), _s("/a/b"),
+                                 _s("org.a"), _s("org.b"), _s("m"), nfds,
+                                 MSGFLAGS_EMPTY);
+}
+
+// Check that `message` serializes to the `size` bytes in `buf`. Throws
+// an `Error` with message `what` if not.
+void check_message_bytes(const DBusMessage &message, const char *buf,
+                         const size_t size, const char *what) {
+  size_t size1 = 0;
+  std::unique_ptr<char[]> buf1 = dbus_message_to_buffer(message, size1);
+  if (size != size1 || memcmp(buf, buf1.get(), size) != 0) {
+    throw Error(what);
+  }
+}
+
+// The two ends of a connected unix socket, which the tests use in place
+// of a connection to the bus.
+struct SocketPair {
+  AutoCloseFD sender_;
+  AutoCloseFD receiver_;
+};
+
+// `flags` are or'ed into the socket type, for example `SOCK_NONBLOCK`.
+SocketPair mk_socketpair(const int flags = 0) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | flags, 0, fds) < 0) {
+    throw ErrorWithErrno("socketpair failed");
+  }
+  return SocketPair{AutoCloseFD(fds[0]), AutoCloseFD(fds[1])};
+}
+
+// The ways in which `parse_dbus_object_from_buffer` can give the input
+// to the parser.
+enum class FeedMode {
+  // Loop over `maxRequiredBytes()` and `parse()`, like
+  // `receive_dbus_message`.
+  Exact,
+  // Call `feed()` with chunks of varying sizes, so that fields are
+  // regularly split across calls.
+  Chunked,
+  // Call `feed()` once with the whole buffer, so that all the padding is
+  // checked without creating a continuation (see `ParseZeros::skip`).
+  Whole
+};
+
+// If `zeroCopyBuffer` is not null then the parser is run in zero-copy
+// mode, and `buf` must be equal to `zeroCopyBuffer.get()`. If `arena` is
+// not null then the object is allocated in it, so the caller must keep
+// the arena alive until the object has been deleted.
 template <Endianness endianness>
-std::unique_ptr<DBusObject> parse_dbus_object_from_buffer(const DBusType &t,
-                                                          const char *buf,
-                                                          const size_t buflen) {
+std::unique_ptr<DBusObject> parse_dbus_object_from_buffer(
+    const DBusType &t, const char *buf, const size_t buflen,
+    const FeedMode mode = FeedMode::Exact,
+    const std::shared_ptr<const char> &zeroCopyBuffer = nullptr,
+    const std::shared_ptr<ParseArena> &arena = nullptr) {
   class Cont final : public DBusType::ParseObjectCont<endianness> {
     std::unique_ptr<DBusObject> &result_;
 
@@ -56,25 +136,319 @@ std::unique_ptr<DBusObject> parse_dbus_object_from_buffer(const DBusType &t,
   };
 
   std::unique_ptr<DBusObject> result;
-  Parse p(t.mkObjectParser<endianness>(Parse::State::initialState_,
-                                       std::make_unique<Cont>(result)));
+  Parse p(arena, zeroCopyBuffer, [&](const Parse::State &s) {
+    return t.mkObjectParser<endianness>(s, std::make_unique<Cont>(result));
+  });
 
-  while (true) {
-    const size_t required = p.maxRequiredBytes();
-    const size_t pos = p.getPos();
-    if (required == 0) {
-      assert(pos == buflen);
-      return result;
+  if (mode == FeedMode::Exact) {
+    while (true) {
+      const size_t required = p.maxRequiredBytes();
+      const size_t pos = p.getPos();
+      if (required == 0) {
+        assert(pos == buflen);
+        return result;
+      }
+      if (required > buflen - pos) {
+        throw ParseError(pos,
+                         "parse_dbus_object_from_buffer: not enough bytes");
+      }
+      p.parse(buf + pos, required);
     }
-    if (required > buflen - pos) {
-      throw ParseError(pos, "parse_dbus_object_from_buffer: not enough bytes");
+  }
+
+  size_t pos = 0;
+  size_t chunksize = mode == FeedMode::Whole ? buflen : 1;
+  while (pos < buflen && p.maxRequiredBytes() != 0) {
+    const size_t n = std::min(chunksize, buflen - pos);
+    pos += p.feed(buf + pos, n);
+    if (mode == FeedMode::Chunked) {
+      chunksize = chunksize % 13 + 1;
     }
-    p.parse(buf + pos, required);
+  }
+  if (p.maxRequiredBytes() != 0) {
+    throw ParseError(p.getPos(),
+                     "parse_dbus_object_from_buffer: not enough bytes");
+  }
+  if (pos != buflen) {
+    throw ParseError(pos, "parse_dbus_object_from_buffer: too many bytes");
   }
 
   return result;
 }
 
+// Event handler which rebuilds the `DBusObject` from the events, so that
+// the streaming parser can be checked against the object parser.
+class EventObjectBuilder final : public DBusType::EventHandler {
+  struct Frame {
+    // The element type, if this frame is an array.
+    const DBusType *elemType_;
+    std::vector<std::unique_ptr<DBusObject>> objects_;
+  };
+
+  std::vector<Frame> stack_;
+
+  void add(std::unique_ptr<DBusObject> &&obj) {
+    stack_.back().objects_.push_back(std::move(obj));
+  }
+
+  void begin(const DBusType *elemType) {
+    stack_.push_back(Frame{elemType, {}});
+  }
+
+  Frame end() {
+    Frame frame = std::move(stack_.back());
+    stack_.pop_back();
+    return frame;
+  }
+
+public:
+  EventObjectBuilder() { begin(nullptr); }
+
+  std::unique_ptr<DBusObject> getResult() {
+    if (stack_.size() != 1 || stack_[0].objects_.size() != 1) {
+      throw Error("EventObjectBuilder: unbalanced events.");
+    }
+    return std::move(stack_[0].objects_[0]);
+  }
+
+  void onChar(char c) override { add(DBusObjectChar::mk(c)); }
+  void onBoolean(bool b) override { add(DBusObjectBoolean::mk(b)); }
+  void onUint16(uint16_t x) override { add(DBusObjectUint16::mk(x)); }
+  void onInt16(int16_t x) override { add(DBusObjectInt16::mk(x)); }
+  void onUint32(uint32_t x) override { add(DBusObjectUint32::mk(x)); }
+  void onInt32(int32_t x) override { add(DBusObjectInt32::mk(x)); }
+  void onUint64(uint64_t x) override { add(DBusObjectUint64::mk(x)); }
+  void onInt64(int64_t x) override { add(DBusObjectInt64::mk(x)); }
+  void onDouble(double d) override { add(DBusObjectDouble::mk(d)); }
+  void onUnixFD(uint32_t i) override { add(DBusObjectUnixFD::mk(i)); }
+  void onString(std::string_view str) override {
+    add(DBusObjectString::mk(std::string(str)));
+  }
+  void onPath(std::string_view str) override {
+    add(DBusObjectPath::mk(std::string(str)));
+  }
+  void onSignature(std::string_view str) override {
+    add(DBusObjectSignature::mk(std::string(str)));
+  }
+  void beginVariant(const DBusType &) override { begin(nullptr); }
+  void endVariant() override {
+    add(DBusObjectVariant::mk(std::move(end().objects_.at(0))));
+  }
+  void beginDictEntry() override { begin(nullptr); }
+  void endDictEntry() override {
+    Frame frame = end();
+    add(DBusObjectDictEntry::mk(std::move(frame.objects_.at(0)),
+                                std::move(frame.objects_.at(1))));
+  }
+  void beginArray(const DBusType &elemType, uint32_t) override {
+    begin(&elemType);
+  }
+  void endArray() override {
+    Frame frame = end();
+    add(DBusObjectArray::mk(*frame.elemType_, std::move(frame.objects_)));
+  }
+  void beginStruct() override { begin(nullptr); }
+  void endStruct() override {
+    add(DBusObjectStruct::mk(std::move(end().objects_)));
+  }
+};
+
+// Parse `buf` with the streaming parser and rebuild the object.
+template <Endianness endianness>
+std::unique_ptr<DBusObject> parse_dbus_events_from_buffer(const DBusType &t,
+                                                          const char *buf,
+                                                          const size_t buflen) {
+  class Cont final : public DBusType::ParseEventCont {
+  public:
+    virtual std::unique_ptr<Parse::Cont> parse(const Parse::State &) override {
+      return ParseStop::mk();
+    }
+  };
+
+  EventObjectBuilder builder;
+  Parse p(t.mkEventParser<endianness>(Parse::State::initialState_, builder,
+                                      std::make_unique<Cont>()));
+  if (p.feed(buf, buflen) != buflen || p.maxRequiredBytes() != 0) {
+    throw ParseError(p.getPos(), "parse_dbus_events_from_buffer: bad length");
+  }
+  return builder.getResult();
+}
+
+// Visitor which checks that a `DBusTape` contains the same values as a
+// `DBusObject`, starting at the cursor's position.
+class TapeChecker final : public DBusObject::Visitor {
+  DBusTape::Cursor cursor_;
+
+  void check(bool b) {
+    if (!b) {
+      throw Error("Tape doesn't match the object.");
+    }
+  }
+
+  // Check the elements of a container, and step over it.
+  void checkElements(size_t n,
+                     const std::function<const DBusObject &(size_t)> &get) {
+    check(cursor_.numElements() == n);
+    const DBusTape::Cursor container = cursor_;
+    cursor_ = cursor_.getFirstElement();
+    for (size_t i = 0; i < n; i++) {
+      get(i).accept(*this);
+    }
+    check(cursor_.atEnd());
+    cursor_ = container.next();
+  }
+
+public:
+  explicit TapeChecker(const DBusTape::Cursor &cursor) : cursor_(cursor) {}
+
+  const DBusTape::Cursor &getCursor() const { return cursor_; }
+
+  template <class T, class V> void checkValue(V value, const T &obj) {
+    check(value == obj.getValue());
+    cursor_ = cursor_.next();
+  }
+
+  void visitChar(const DBusObjectChar &obj) override {
+    checkValue(cursor_.getChar(), obj);
+  }
+  void visitBoolean(const DBusObjectBoolean &obj) override {
+    checkValue(cursor_.getBoolean(), obj);
+  }
+  void visitUint16(const DBusObjectUint16 &obj) override {
+    checkValue(cursor_.getUint16(), obj);
+  }
+  void visitInt16(const DBusObjectInt16 &obj) override {
+    checkValue(cursor_.getInt16(), obj);
+  }
+  void visitUint32(const DBusObjectUint32 &obj) override {
+    checkValue(cursor_.getUint32(), obj);
+  }
+  void visitInt32(const DBusObjectInt32 &obj) override {
+    checkValue(cursor_.getInt32(), obj);
+  }
+  void visitUint64(const DBusObjectUint64 &obj) override {
+    checkValue(cursor_.getUint64(), obj);
+  }
+  void visitInt64(const DBusObjectInt64 &obj) override {
+    checkValue(cursor_.getInt64(), obj);
+  }
+  void visitDouble(const DBusObjectDouble &obj) override {
+    // Compare the bits, because the value might be a NaN.
+    const double d0 = cursor_.getDouble();
+    const double d1 = obj.getValue();
+    check(memcmp(&d0, &d1, sizeof(double)) == 0);
+    cursor_ = cursor_.next();
+  }
+  void visitUnixFD(const DBusObjectUnixFD &obj) override {
+    checkValue(cursor_.getUnixFD(), obj);
+  }
+  void visitString(const DBusObjectString &obj) override {
+    check(cursor_.getTypeCode() == 's');
+    checkValue(cursor_.getString(), obj);
+  }
+  void visitPath(const DBusObjectPath &obj) override {
+    check(cursor_.getTypeCode() == 'o');
+    checkValue(cursor_.getString(), obj);
+  }
+  void visitSignature(const DBusObjectSignature &obj) override {
+    check(cursor_.getTypeCode() == 'g');
+    checkValue(cursor_.getString(), obj);
+  }
+  void visitVariant(const DBusObjectVariant &obj) override {
+    check(cursor_.getVariantSignature() == obj.getSignature().getValue());
+    const DBusTape::Cursor variant = cursor_;
+    cursor_ = cursor_.getVariantValue();
+    obj.getValue()->accept(*this);
+    check(cursor_.atEnd());
+    cursor_ = variant.next();
+  }
+  void visitDictEntry(const DBusObjectDictEntry &obj) override {
+    check(cursor_.getTypeCode() == '{');
+    checkElements(2, [&obj](size_t i) -> const DBusObject & {
+      return i == 0 ? *obj.getKey() : *obj.getValue();
+    });
+  }
+  void visitArray(const DBusObjectArray &obj) override {
+    check(cursor_.getTypeCode() == 'a');
+    checkElements(obj.numElements(), [&obj](size_t i) -> const DBusObject & {
+      return *obj.getElement(i);
+    });
+  }
+  void visitStruct(const DBusObjectStruct &obj) override {
+    check(cursor_.getTypeCode() == '(');
+    checkElements(obj.numFields(), [&obj](size_t i) -> const DBusObject & {
+      return *obj.getElement(i);
+    });
+  }
+};
+
+// True if the signature contains an array of empty structs, such as
+// `a()` or `a(()())`. Its elements serialize to zero bytes, so the array
+// is always empty when it is parsed.
+static bool hasEmptyStructArray(const std::string &sig) {
+  for (size_t i = 0; i < sig.size(); i++) {
+    if (sig[i] != 'a') {
+      continue;
+    }
+    size_t depth = 0;
+    for (size_t j = i + 1; j < sig.size(); j++) {
+      if (sig[j] == '(') {
+        ++depth;
+      } else if (sig[j] == ')' && depth > 0) {
+        if (--depth == 0) {
+          return true;
+        }
+      } else {
+        break;
+      }
+    }
+  }
+  return false;
+}
+
+// Same as above, but also checks the types of the values of variants.
+static bool hasEmptyStructArray(const DBusObject &obj) {
+  const std::string sig = obj.getType().toString();
+  if (hasEmptyStructArray(sig)) {
+    return true;
+  }
+  if (sig.find('v') == std::string::npos) {
+    return false;
+  }
+  switch (sig[0]) {
+  case 'v':
+    return hasEmptyStructArray(*obj.toVariant().getValue());
+  case '{':
+    return hasEmptyStructArray(*obj.toDictEntry().getKey()) ||
+           hasEmptyStructArray(*obj.toDictEntry().getValue());
+  case 'a':
+    for (size_t i = 0; i < obj.toArray().numElements(); i++) {
+      if (hasEmptyStructArray(*obj.toArray().getElement(i))) {
+        return true;
+      }
+    }
+    return false;
+  case '(':
+    for (size_t i = 0; i < obj.toStruct().numFields(); i++) {
+      if (hasEmptyStructArray(*obj.toStruct().getElement(i))) {
+        return true;
+      }
+    }
+    return false;
+  default:
+    return false;
+  }
+}
+
+// Check that `a` and `b` are equal, and have the same hash.
+static void check_equal(const DBusObject &a, const DBusObject &b,
+                        const char *msg) {
+  if (a != b || a.hash() != b.hash() || !(a.getType() == b.getType()) ||
+      a.getType().hash() != b.getType().hash()) {
+    throw Error(msg);
+  }
+}
+
 #define DEBUGPRINT 0
 
 // This function checks the serializer and parser for consistency.
@@ -84,9 +458,9 @@ std::unique_ptr<DBusObject> parse_dbus_object_from_buffer(const DBusType &t,
 // 2. Parse `buf0`. The new object is called `parsedObject`.
 // 3. Serialize `parsedObject` to a buffer named `buf1`.
 // 4. Check that `buf0` and `buf1` are identical.
+// 5. Check that `object` and `parsedObject` are equal.
 //
-// It would also be valuable to compare `object` and `parsedObject` for
-// equality, but `DBusObject` doesn't currently have an `operator==`.
+// The other parse modes are then checked in the same way.
 template <Endianness endianness>
 void check_serialize_and_parse(const DBusType &t, const DBusObject &object) {
   if (DEBUGPRINT) {
@@ -121,9 +495,1306 @@ void check_serialize_and_parse(const DBusType &t, const DBusObject &object) {
   if (memcmp(buf0.get(), buf1.get(), size0) != 0) {
     throw Error("Serialized strings don't match.");
   }
+  if (!hasEmptyStructArray(object)) {
+    check_equal(object, *parsedObject, "Parsed object isn't equal.");
+  }
+
+  // Repeat the check with the input given to `feed()` in chunks.
+  std::unique_ptr<DBusObject> chunkedObject =
+      parse_dbus_object_from_buffer<endianness>(t, buf0.get(), size0,
+                                                FeedMode::Chunked);
+  size_t size5 = 0;
+  std::unique_ptr<char[]> buf5 =
+      dbus_object_to_buffer<endianness>(*chunkedObject, size5);
+  if (size0 != size5 || memcmp(buf0.get(), buf5.get(), size0) != 0) {
+    throw Error("Chunked serialized strings don't match.");
+  }
+  check_equal(*parsedObject, *chunkedObject, "Chunked object isn't equal.");
+
+  // Repeat the check with the whole input given to `feed()` at once.
+  std::unique_ptr<DBusObject> wholeObject =
+      parse_dbus_object_from_buffer<endianness>(t, buf0.get(), size0,
+                                                FeedMode::Whole);
+  check_equal(*parsedObject, *wholeObject, "Whole-buffer object isn't equal.");
+
+  // Check that the single-pass serializer gives the same result, with
+  // both the virtual and the statically dispatched serialization methods.
+  // (`vec.data()` may be null if the object serializes to zero bytes,
+  // so skip `memcmp` in that case.)
+  std::vector<char> vec;
+  SerializeToVector<endianness> sv(vec);
+  parsedObject->serialize(sv);
+  if (vec.size() != size0 ||
+      (size0 != 0 && memcmp(buf0.get(), vec.data(), size0) != 0)) {
+    throw Error("Single-pass serialized strings don't match.");
+  }
+  vec.clear();
+  serializeTo(sv, *parsedObject);
+  if (vec.size() != size0 ||
+      (size0 != 0 && memcmp(buf0.get(), vec.data(), size0) != 0)) {
+    throw Error("Statically dispatched serialized strings don't match.");
+  }
+  SerializerDryRun dryRun;
+  serializeTo(dryRun, *parsedObject);
+  if (dryRun.getPos() != size0) {
+    throw Error("Statically dispatched dry run size doesn't match.");
+  }
+  std::unique_ptr<char[]> buf6(new char[size0]);
+  SerializeToBuffer<endianness> sb(buf6.get());
+  serializeTo(sb, *parsedObject);
+  if (sb.getPos() != size0 || memcmp(buf0.get(), buf6.get(), size0) != 0) {
+    throw Error("Statically dispatched buffer strings don't match.");
+  }
+
+  // Repeat the check with the streaming parser.
+  std::unique_ptr<DBusObject> eventObject =
+      parse_dbus_events_from_buffer<endianness>(t, buf0.get(), size0);
+  size_t size3 = 0;
+  std::unique_ptr<char[]> buf3 =
+      dbus_object_to_buffer<endianness>(*eventObject, size3);
+  if (size0 != size3 || memcmp(buf0.get(), buf3.get(), size0) != 0) {
+    throw Error("Streaming parser serialized strings don't match.");
+  }
+  check_equal(*parsedObject, *eventObject,
+              "Streaming parser object isn't equal.");
+
+  // Repeat the check with the object allocated in an arena. A small
+  // chunk size makes sure that the arena has to grow.
+  std::shared_ptr<ParseArena> arena = std::make_shared<ParseArena>(64);
+  std::unique_ptr<DBusObject> arenaObject =
+      parse_dbus_object_from_buffer<endianness>(
+          t, buf0.get(), size0, FeedMode::Chunked, nullptr, arena);
+  size_t size4 = 0;
+  std::unique_ptr<char[]> buf4 =
+      dbus_object_to_buffer<endianness>(*arenaObject, size4);
+  if (size0 != size4 || memcmp(buf0.get(), buf4.get(), size0) != 0) {
+    throw Error("Arena serialized strings don't match.");
+  }
+  check_equal(*parsedObject, *arenaObject, "Arena object isn't equal.");
+  arenaObject.reset();
+
+  // Check the tape representation against the parsed object. (Not
+  // `object`, because an array of empty structs has no elements once it
+  // has been serialized.)
+  DBusTape tape;
+  {
+    Parse p(DBusTape::parseObject<endianness>(tape, t));
+    if (p.feed(buf0.get(), size0) != size0 || p.maxRequiredBytes() != 0) {
+      throw Error("DBusTape::parseObject didn't consume the whole object.");
+    }
+  }
+  TapeChecker checker(tape.begin());
+  parsedObject->accept(checker);
+  if (!checker.getCursor().atEnd()) {
+    throw Error("Tape has extra values.");
+  }
+
+  // Repeat the check with a parser in zero-copy mode. The parsed object
+  // shares ownership of the buffer, so it should still be valid after
+  // the local reference is dropped.
+  std::shared_ptr<const char> shared0(buf0.release(),
+                                      std::default_delete<char[]>());
+  std::unique_ptr<DBusObject> zeroCopyObject =
+      parse_dbus_object_from_buffer<endianness>(
+          t, shared0.get(), size0, FeedMode::Chunked, shared0);
+  shared0.reset();
+
+  size_t size2 = 0;
+  std::unique_ptr<char[]> buf2 =
+      dbus_object_to_buffer<endianness>(*zeroCopyObject, size2);
+  if (size1 != size2 || memcmp(buf1.get(), buf2.get(), size1) != 0) {
+    throw Error("Zero-copy serialized strings don't match.");
+  }
+  check_equal(*parsedObject, *zeroCopyObject, "Zero-copy object isn't equal.");
+}
+
+// Check that the value of a string can always be read with `getView()`,
+// but only with `getValue()` if the object owns the string.
+void check_string_views() {
+  const std::unique_ptr<DBusObjectString> owned = DBusObjectString::mk("abc");
+  const std::string &value = owned->getValue();
+  if (value != "abc" || owned->getView().data() != value.data()) {
+    throw Error("Unexpected owned string.");
+  }
+
+  char *raw = new char[4];
+  memcpy(raw, "abc", 4);
+  const std::shared_ptr<const char> buffer(raw, std::default_delete<char[]>());
+  const std::unique_ptr<DBusObjectPath> view =
+      DBusObjectPath::mk(buffer, std::string_view(buffer.get(), 3));
+  if (view->getView() != "abc" || view->getView().data() != buffer.get()) {
+    throw Error("Unexpected string view.");
+  }
+  bool rejected = false;
+  try {
+    view->getValue();
+  } catch (Error &) {
+    rejected = true;
+  }
+  if (!rejected) {
+    throw Error("getValue() didn't reject a string view.");
+  }
+}
+
+// Check that an array of `uint16_t` is parsed into a packed array, and
+// that its elements can still be accessed individually.
+template <Endianness endianness> void check_packed_array() {
+  const DBusTypeArray t(DBusTypeUint16::instance_);
+  std::unique_ptr<DBusObject> object = DBusObjectArray::mk1(
+      _vec<std::unique_ptr<DBusObject>>(DBusObjectUint16::mk(0x1234),
+                                        DBusObjectUint16::mk(0xfedc)));
+
+  size_t size = 0;
+  std::unique_ptr<char[]> buf =
+      dbus_object_to_buffer<endianness>(*object, size);
+  std::unique_ptr<DBusObject> parsedObject =
+      parse_dbus_object_from_buffer<endianness>(t, buf.get(), size);
+
+  typedef DBusObjectArrayPacked<DBusObjectUint16, uint16_t> Packed;
+  const Packed *packed = dynamic_cast<const Packed *>(parsedObject.get());
+  if (!packed || packed->getValues() != std::vector<uint16_t>{0x1234, 0xfedc}) {
+    throw Error("Array was not parsed into a packed array.");
+  }
+  const DBusObjectArray &arr = parsedObject->toArray();
+  if (arr.numElements() != 2 ||
+      arr.getElement(1)->toUint16().getValue() != 0xfedc) {
+    throw Error("Unexpected packed array element.");
+  }
+}
+
+// Check that a non-zero byte in the padding or in a string terminator is
+// rejected, and that the error reports the position of that byte.
+template <Endianness endianness> void check_nonzero_padding() {
+  const DBusTypeStruct t(
+      _vec(std::reference_wrapper<const DBusType>(DBusTypeChar::instance_),
+           std::reference_wrapper<const DBusType>(DBusTypeString::instance_)));
+  std::unique_ptr<DBusObject> object = DBusObjectStruct::mk(
+      _vec(_obj(DBusObjectChar::mk('x')), _obj(DBusObjectString::mk("abc"))));
+
+  size_t size = 0;
+  std::unique_ptr<char[]> buf =
+      dbus_object_to_buffer<endianness>(*object, size);
+
+  // Byte 3 is padding before the string length. Byte 11 is the zero
+  // byte at the end of the string.
+  for (const size_t badpos : {size_t(3), size_t(11)}) {
+    buf[badpos] = 1;
+    for (const FeedMode mode :
+         {FeedMode::Exact, FeedMode::Chunked, FeedMode::Whole}) {
+      try {
+        parse_dbus_object_from_buffer<endianness>(t, buf.get(), size, mode);
+        throw Error("Non-zero byte was not rejected.");
+      } catch (ParseError &e) {
+        if (e.getPos() != badpos) {
+          throw Error("Non-zero byte was reported at the wrong position.");
+        }
+      }
+    }
+    buf[badpos] = 0;
+  }
+}
+
+// Check that `DBusMessage::parseEvents` finds the body signature in the
+// header and reports the body.
+void check_message_events() {
+  class Handler final : public DBusMessage::EventHandler {
+  public:
+    std::vector<std::string> strings_;
+    bool endHeader_ = false;
+    bool endMessage_ = false;
+
+    void onString(std::string_view str) override {
+      strings_.push_back(std::string(str));
+    }
+    void endHeader() override { endHeader_ = true; }
+    void endMessage() override { endMessage_ = true; }
+  };
+
+  std::unique_ptr<DBusMessage> message =
+      mk_test_message(1, DBusMessageBody::mk1(DBusObjectString::mk("body")));
+
+  size_t size = 0;
+  std::unique_ptr<char[]> buf = dbus_message_to_buffer(*message, size);
+
+  Handler handler;
+  Parse p(DBusMessage::parseEvents<LittleEndian>(handler));
+  if (p.feed(buf.get(), size) != size || p.maxRequiredBytes() != 0) {
+    throw Error("parseEvents didn't consume the whole message.");
+  }
+  if (!handler.endHeader_ || !handler.endMessage_ ||
+      handler.strings_ != std::vector<std::string>{"org.a", "org.b", "m",
+                                                   "body"}) {
+    throw Error("Unexpected events from parseEvents.");
+  }
+}
+
+// Check that `DBusMessage::parseLazy` keeps the body as raw bytes until
+// it is needed, and that the message round-trips.
+void check_lazy_message() {
+  std::unique_ptr<DBusMessage> message = mk_test_message(
+      1, DBusMessageBody::mk(_vec(_obj(DBusObjectString::mk("body")),
+                                  _obj(DBusObjectUint32::mk(7)))));
+
+  size_t size0 = 0;
+  std::unique_ptr<char[]> buf0 = dbus_message_to_buffer(*message, size0);
+
+  std::unique_ptr<DBusMessage> lazy;
+  Parse p(DBusMessage::parseLazy<LittleEndian>(lazy));
+  if (p.feed(buf0.get(), size0) != size0 || p.maxRequiredBytes() != 0) {
+    throw Error("parseLazy didn't consume the whole message.");
+  }
+  // The body is at the end of the message.
+  const std::string_view rawBody = lazy->getRawBody();
+  if (rawBody.size() != lazy->getHeader_bodySize() ||
+      rawBody != std::string_view(buf0.get() + size0 - rawBody.size(),
+                                  rawBody.size())) {
+    throw Error("Unexpected raw body.");
+  }
+  if (lazy->getBody().getElement(0)->toString().getView() != "body" ||
+      lazy->getBody().getElement(1)->toUint32().getValue() != 7) {
+    throw Error("Unexpected lazily parsed body.");
+  }
+
+  check_message_bytes(*lazy, buf0.get(), size0,
+                      "Lazily parsed message doesn't match.");
+}
+
+// Check that `DBusMessage::parseAuto` detects the byte order.
+template <Endianness endianness> void check_parse_auto() {
+  std::unique_ptr<DBusMessage> message = mk_test_message(
+      0x1234, DBusMessageBody::mk1(DBusObjectUint32::mk(0xabcdef)));
+
+  size_t size = 0;
+  std::unique_ptr<char[]> buf =
+      dbus_message_to_buffer<endianness>(*message, size);
+
+  std::unique_ptr<DBusMessage> parsed;
+  Parse p(DBusMessage::parseAuto(parsed));
+  if (p.feed(buf.get(), size) != size || p.maxRequiredBytes() != 0) {
+    throw Error("parseAuto didn't consume the whole message.");
+  }
+  if (parsed->getHeader_serialNumber() != 0x1234 ||
+      parsed->getBody().getElement(0)->toUint32().getValue() != 0xabcdef) {
+    throw Error("parseAuto parsed the wrong values.");
+  }
+
+  // `serializeMessage` uses the statically dispatched serializer, which
+  // should give the same bytes (apart from the endianness byte).
+  std::vector<char> vec;
+  serializeMessage<endianness>(vec, *parsed);
+  vec[0] = buf[0];
+  if (vec.size() != size || memcmp(vec.data(), buf.get(), size) != 0) {
+    throw Error("serializeMessage gave the wrong bytes.");
+  }
+
+  buf[0] = 'x';
+  try {
+    Parse p2(DBusMessage::parseAuto(parsed));
+    p2.feed(buf.get(), size);
+    throw Error("parseAuto accepted an invalid endianness byte.");
+  } catch (ParseError &) {
+  }
+}
+
+// Check that `DBusSignatureCache` returns the same types for repeated
+// lookups, and that it doesn't grow beyond its maximum size.
+void check_signature_cache() {
+  DBusSignatureCache cache(2);
+  std::shared_ptr<const DBusSignatureTypes> t1 = cache.lookup("ua{sv}");
+  std::shared_ptr<const DBusSignatureTypes> t2 = cache.lookup("ua{sv}");
+  if (t1 != t2 || t1->getTypes().size() != 2 ||
+      t1->getTypes()[1].get().toString() != "a{sv}") {
+    throw Error("DBusSignatureCache returned the wrong types.");
+  }
+
+  try {
+    cache.lookup("a{s");
+    throw Error("DBusSignatureCache accepted an invalid signature.");
+  } catch (ParseError &) {
+  }
+  if (cache.size() != 1) {
+    throw Error("DBusSignatureCache cached an invalid signature.");
+  }
+
+  if (!cache.lookup("")->getTypes().empty()) {
+    throw Error("The empty signature should have zero types.");
+  }
+
+  // The cache is full, so this clears it. `t1` is still valid.
+  cache.lookup("(ii)");
+  if (cache.size() != 1 || cache.lookup("ua{sv}") == t1 ||
+      t1->getSignature() != "ua{sv}") {
+    throw Error("DBusSignatureCache didn't evict its entries.");
+  }
+}
+
+// Check that `DBusTypeStorage` only allocates one object per distinct type.
+void check_type_storage() {
+  DBusTypeStorage typeStorage;
+  const std::vector<std::reference_wrapper<const DBusType>> types =
+      DBusObjectSignature::toTypes(typeStorage, "a{sv}(ia{sv})a{sv}a{sa{sv}}");
+  const DBusTypeStruct &structType =
+      static_cast<const DBusTypeStruct &>(types[1].get());
+  if (&types[0].get() != &types[2].get() ||
+      &structType.getFieldTypes()[1].get() != &types[0].get()) {
+    throw Error("DBusTypeStorage allocated a type twice.");
+  }
+  // a{sv}, {sv}, (ia{sv}), a{sa{sv}}, {sa{sv}}
+  if (typeStorage.size() != 5) {
+    throw Error("DBusTypeStorage has the wrong number of types.");
+  }
+  if (&cloneType(typeStorage, types[3]) != &types[3].get() ||
+      typeStorage.size() != 5) {
+    throw Error("cloneType allocated a type which was already stored.");
+  }
+}
+
+// Check that `SerializeToIovec` references large byte strings in place,
+// and that the concatenation of its `iovec`s is the serialized message.
+void check_serialize_to_iovec() {
+  const std::string big(1000, 'x');
+  std::unique_ptr<DBusMessage> message = mk_test_message(
+      0x1234,
+      DBusMessageBody::mk(_vec<std::unique_ptr<DBusObject>>(
+          DBusObjectString::mk(std::string(big)),
+          DBusObjectArrayPacked<DBusObjectChar, char>::mk(
+              DBusTypeChar::instance_, std::vector<char>(big.size(), 'y')))));
+
+  std::vector<char> expected;
+  serializeMessage<LittleEndian>(expected, *message);
+
+  SerializeToIovec<LittleEndian> s;
+  serializeTo(s, *message);
+  const std::vector<struct iovec> iov = s.getIovecs();
+  std::vector<char> actual;
+  for (const struct iovec &v : iov) {
+    const char *p = static_cast<const char *>(v.iov_base);
+    actual.insert(actual.end(), p, p + v.iov_len);
+  }
+  if (actual != expected || s.getPos() != expected.size()) {
+    throw Error("SerializeToIovec gave the wrong bytes.");
+  }
+
+  // The two large payloads should be referenced in place.
+  const std::string_view str =
+      message->getBody().getElement(0)->toString().getValue();
+  if (iov.size() != 4 || iov[1].iov_base != str.data() ||
+      iov[1].iov_len != str.size() + 1) {
+    throw Error("SerializeToIovec copied a large string.");
+  }
+
+  // Send the message through a socket and check that it arrives intact.
+  auto [sender, receiver] = mk_socketpair();
+  send_dbus_message(sender.get(), *message);
+  std::unique_ptr<DBusMessage> received =
+      receive_dbus_message(receiver.get());
+  std::vector<char> receivedBytes;
+  serializeMessage<LittleEndian>(receivedBytes, *received);
+  if (receivedBytes != expected) {
+    throw Error("Message was corrupted by send_dbus_message.");
+  }
+
+  // Send it twice more with a `DBusConnectionWriter`, which reuses its
+  // buffers for the second message.
+  DBusConnectionWriter writer(sender.get());
+  for (size_t i = 0; i < 2; i++) {
+    writer.send(*message);
+    received = receive_dbus_message(receiver.get());
+    receivedBytes.clear();
+    serializeMessage<LittleEndian>(receivedBytes, *received);
+    if (receivedBytes != expected) {
+      throw Error("Message was corrupted by DBusConnectionWriter.");
+    }
+  }
+}
+
+// Check that `DBusSendQueue` handles partial writes on a non-blocking
+// socket, and that file descriptors are sent with their message.
+void check_send_queue() {
+  auto [sender, receiver] = mk_socketpair(SOCK_NONBLOCK);
+
+  // Attach a file descriptor to the first message.
+  int pipefds[2];
+  if (pipe(pipefds) < 0) {
+    throw ErrorWithErrno("pipe failed");
+  }
+  AutoCloseFD pipeRead(pipefds[0]);
+  AutoCloseFD pipeWrite(pipefds[1]);
+
+  // Queue enough data that it won't fit in the socket buffer.
+  const size_t numMessages = 64;
+  DBusSendQueue queue(sender.get());
+  for (size_t i = 0; i < numMessages; i++) {
+    std::unique_ptr<DBusMessage> message = mk_test_message(
+        i,
+        DBusMessageBody::mk1(DBusObjectArrayPacked<DBusObjectChar, char>::mk(
+            DBusTypeChar::instance_, std::vector<char>(0x10000, char(i)))),
+        i == 0 ? 1 : 0);
+    queue.pushWithFds(*message, i == 0 ? 1 : 0, &pipefds[1]);
+  }
+
+  if (queue.flush()) {
+    throw Error("DBusSendQueue should not fit in the socket buffer.");
+  }
+
+  std::vector<char> received;
+  size_t numFdsReceived = 0;
+  while (true) {
+    char buf[0x4000];
+    struct iovec io = {buf, sizeof(buf)};
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg = {};
+    msg.msg_iov = &io;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    const ssize_t n = recvmsg(receiver.get(), &msg, 0);
+    if (n > 0) {
+      struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+      if (cmsg && cmsg->cmsg_type == SCM_RIGHTS) {
+        if (!received.empty()) {
+          throw Error("File descriptor wasn't sent with the first chunk.");
+        }
+        int fd;
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+        close(fd);
+        numFdsReceived++;
+      }
+      received.insert(received.end(), buf, buf + n);
+    } else if (queue.flush()) {
+      break;
+    }
+  }
+  while (true) {
+    char buf[0x4000];
+    const ssize_t n = read(receiver.get(), buf, sizeof(buf));
+    if (n <= 0) {
+      break;
+    }
+    received.insert(received.end(), buf, buf + n);
+  }
+
+  if (numFdsReceived != 1 || queue.pendingBytes() != 0) {
+    throw Error("DBusSendQueue sent the wrong number of fds.");
+  }
+
+  // Parse the received messages.
+  size_t pos = 0;
+  for (size_t i = 0; i < numMessages; i++) {
+    std::unique_ptr<DBusMessage> message;
+    Parse p(DBusMessage::parseAuto(message));
+    pos += p.feed(&received[pos], received.size() - pos);
+    if (p.maxRequiredBytes() != 0 ||
+        message->getHeader_serialNumber() != i) {
+      throw Error("DBusSendQueue sent a corrupted message.");
+    }
+  }
+  if (pos != received.size()) {
+    throw Error("DBusSendQueue sent too many bytes.");
+  }
+}
+
+// Check that `DBusMessageReader` can receive messages which are split
+// across several reads, without blocking.
+void check_message_reader() {
+  auto [sender, receiver] = mk_socketpair(SOCK_NONBLOCK);
+
+  std::vector<char> bytes;
+  const size_t numMessages = 3;
+  for (size_t i = 0; i < numMessages; i++) {
+    std::unique_ptr<DBusMessage> message = mk_test_message(
+        i, DBusMessageBody::mk1(DBusObjectString::mk(std::string(i, 'x'))));
+    // Each message is aligned relative to its own start.
+    std::vector<char> messageBytes;
+    serializeMessage<LittleEndian>(messageBytes, *message);
+    bytes.insert(bytes.end(), messageBytes.begin(), messageBytes.end());
+  }
+
+  // Send the messages in small chunks, so that the messages are split
+  // across reads. A small buffer size forces a message to be split even
+  // within a single `receive`.
+  DBusMessageReader reader(receiver.get(), 7);
+  std::vector<std::unique_ptr<DBusMessage>> messages;
+  const size_t chunkSize = 50;
+  for (size_t pos = 0; pos < bytes.size(); pos += chunkSize) {
+    const size_t n = std::min(chunkSize, bytes.size() - pos);
+    if (write(sender.get(), &bytes[pos], n) != ssize_t(n)) {
+      throw ErrorWithErrno("write failed");
+    }
+    if (!reader.receive(messages)) {
+      throw Error("DBusMessageReader reported a closed connection.");
+    }
+  }
+
+  if (messages.size() != numMessages) {
+    throw Error("DBusMessageReader received the wrong number of messages.");
+  }
+  for (size_t i = 0; i < numMessages; i++) {
+    if (messages[i]->getHeader_serialNumber() != i ||
+        messages[i]->getBody().getElement(0)->toString().getValue().size() !=
+            i) {
+      throw Error("DBusMessageReader received a corrupted message.");
+    }
+  }
+
+  // Closing the connection in the middle of a message is an error.
+  if (write(sender.get(), bytes.data(), 10) != 10) {
+    throw ErrorWithErrno("write failed");
+  }
+  close(sender.release());
+  try {
+    reader.receive(messages);
+    throw Error("DBusMessageReader accepted a truncated message.");
+  } catch (ParseError &) {
+  }
+}
+
+// Check that file descriptors which are passed with SCM_RIGHTS are
+// attached to the message that they were sent with.
+void check_receive_fds() {
+  auto [sender, receiver] = mk_socketpair(SOCK_NONBLOCK);
+
+  int pipefds[2];
+  if (pipe(pipefds) < 0) {
+    throw ErrorWithErrno("pipe failed");
+  }
+  AutoCloseFD pipeRead(pipefds[0]);
+  AutoCloseFD pipeWrite(pipefds[1]);
+
+  // Message i is sent with i copies of the pipe's write end.
+  const size_t numMessages = 3;
+  const int sendFds[numMessages] = {pipefds[1], pipefds[1], pipefds[1]};
+  DBusSendQueue queue(sender.get());
+  for (size_t i = 0; i < numMessages; i++) {
+    std::vector<std::unique_ptr<DBusObject>> elements;
+    for (size_t j = 0; j < i; j++) {
+      elements.push_back(DBusObjectUnixFD::mk(j));
+    }
+    std::unique_ptr<DBusMessage> message =
+        mk_test_message(i, DBusMessageBody::mk(std::move(elements)), i);
+    queue.pushWithFds(*message, i, sendFds);
+  }
+  if (!queue.flush()) {
+    throw Error("DBusSendQueue didn't fit in the socket buffer.");
+  }
+
+  DBusMessageReader reader(receiver.get());
+  std::vector<std::unique_ptr<DBusMessage>> messages;
+  reader.receive(messages);
+  if (messages.size() != numMessages) {
+    throw Error("DBusMessageReader received the wrong number of messages.");
+  }
+  for (size_t i = 0; i < numMessages; i++) {
+    const DBusMessage &message = *messages[i];
+    if (message.getHeader_unixFds() != i || message.getFds().size() != i) {
+      throw Error("DBusMessageReader attached the wrong number of fds.");
+    }
+    for (size_t j = 0; j < i; j++) {
+      const uint32_t index =
+          message.getBody().getElement(j)->toUnixFD().getValue();
+      const char c = 'a' + j;
+      if (write(message.getFd(index), &c, 1) != 1) {
+        throw ErrorWithErrno("write to received fd failed");
+      }
+      char r;
+      if (read(pipeRead.get(), &r, 1) != 1 || r != c) {
+        throw Error("Received fd isn't connected to the pipe.");
+      }
+    }
+  }
+
+  // The blocking receive path also attaches fds.
+  std::unique_ptr<DBusMessage> message =
+      mk_test_message(0, DBusMessageBody::mk1(DBusObjectUnixFD::mk(0)), 1);
+  send_dbus_message_with_fds(sender.get(), *message, 1, &pipefds[1]);
+  std::unique_ptr<DBusMessage> received = receive_dbus_message(receiver.get());
+  std::vector<AutoCloseFD> receivedFds = received->takeFds();
+  if (receivedFds.size() != 1 || !received->getFds().empty() ||
+      write(receivedFds[0].get(), "z", 1) != 1) {
+    throw Error("receive_dbus_message didn't attach the fd.");
+  }
+  char r;
+  if (read(pipeRead.get(), &r, 1) != 1 || r != 'z') {
+    throw Error("Received fd isn't connected to the pipe.");
+  }
+}
+
+// Check that `DBusMessageReader::receiveOnce` returns a whole batch of
+// messages from a single read, and carries a partial message over to the
+// next call.
+void check_receive_batch() {
+  auto [sender, receiver] = mk_socketpair();
+
+  std::vector<char> bytes;
+  const size_t numMessages = 100;
+  for (size_t i = 0; i <= numMessages; i++) {
+    std::unique_ptr<DBusMessage> message =
+        mk_test_message(i, DBusMessageBody::mk1(DBusObjectUint32::mk(i)));
+    std::vector<char> messageBytes;
+    serializeMessage<LittleEndian>(messageBytes, *message);
+    bytes.insert(bytes.end(), messageBytes.begin(), messageBytes.end());
+  }
+
+  // Send everything except the last 5 bytes.
+  const size_t split = bytes.size() - 5;
+  if (write(sender.get(), bytes.data(), split) != ssize_t(split)) {
+    throw ErrorWithErrno("write failed");
+  }
+
+  DBusMessageReader reader(receiver.get());
+  std::vector<std::unique_ptr<DBusMessage>> messages;
+  if (!reader.receiveOnce(messages) || messages.size() != numMessages) {
+    throw Error("receiveOnce didn't return the whole batch.");
+  }
+  for (size_t i = 0; i < numMessages; i++) {
+    if (messages[i]->getHeader_serialNumber() != i) {
+      throw Error("receiveOnce returned a corrupted message.");
+    }
+  }
+
+  if (write(sender.get(), &bytes[split], 5) != 5) {
+    throw ErrorWithErrno("write failed");
+  }
+  size_t count = 0;
+  reader.receiveOnce([&count](std::unique_ptr<DBusMessage> &&message) {
+    if (message->getBody().getElement(0)->toUint32().getValue() !=
+        numMessages) {
+      throw Error("receiveOnce lost the partial message.");
+    }
+    count++;
+  });
+  if (count != 1) {
+    throw Error("receiveOnce didn't complete the partial message.");
+  }
+
+  close(sender.release());
+  if (reader.receiveOnce(messages)) {
+    throw Error("receiveOnce didn't report the closed connection.");
+  }
+}
+
+// Check that the `serialize_dbus_method_*_msg` functions produce the
+// same bytes as serializing the messages that are built by the
+// corresponding `mk_dbus_method_*_msg` functions.
+void check_message_writer() {
+  auto mkBody = []() {
+    return DBusMessageBody::mk(_vec<std::unique_ptr<DBusObject>>(
+        DBusObjectString::mk(_s("hello")), DBusObjectUint64::mk(7),
+        DBusObjectArray::mk1(_vec<std::unique_ptr<DBusObject>>(
+            DBusObjectDouble::mk(1.5), DBusObjectDouble::mk(2.5)))));
+  };
+
+  // The prefix checks that the alignment is relative to the start of
+  // the vector, like `serializeMessage`.
+  for (size_t prefix = 0; prefix < 16; prefix += 3) {
+    for (size_t nfds = 0; nfds < 2; nfds++) {
+      std::vector<char> expected(prefix, 'x');
+      serializeMessage<LittleEndian>(
+          expected, *mk_dbus_method_call_msg(
+                        1234, mkBody(), _s("/a/b"), _s("org.a"), _s("org.b"),
+                        _s("m"), nfds, MSGFLAGS_NO_AUTO_START));
+      std::vector<char> actual(prefix, 'x');
+      serialize_dbus_method_call_msg(actual, 1234, *mkBody(), "/a/b", "org.a",
+                                     "org.b", "m", nfds,
+                                     MSGFLAGS_NO_AUTO_START);
+      if (actual != expected) {
+        throw Error("serialize_dbus_method_call_msg output is wrong.");
+      }
+    }
+
+    std::vector<char> expected(prefix, 'x');
+    serializeMessage<LittleEndian>(
+        expected, *mk_dbus_method_reply_msg(5, 6, mkBody(), _s(":1.1")));
+    std::vector<char> actual(prefix, 'x');
+    serialize_dbus_method_reply_msg(actual, 5, 6, *mkBody(), ":1.1");
+    if (actual != expected) {
+      throw Error("serialize_dbus_method_reply_msg output is wrong.");
+    }
+
+    expected.assign(prefix, 'x');
+    serializeMessage<LittleEndian>(
+        expected,
+        *mk_dbus_method_error_reply_msg(5, 6, _s(":1.1"), _s("org.a.Error")));
+    actual.assign(prefix, 'x');
+    serialize_dbus_method_error_reply_msg(actual, 5, 6, ":1.1", "org.a.Error");
+    if (actual != expected) {
+      throw Error("serialize_dbus_method_error_reply_msg output is wrong.");
+    }
+  }
+
+  // Check that a message sent by `dbus_method_reply` can be received.
+  auto [sender, receiver] = mk_socketpair();
+  dbus_method_reply(sender.get(), 5, 6, mkBody(), _s(":1.1"));
+  std::unique_ptr<DBusMessage> received = receive_dbus_message(receiver.get());
+  if (received->getHeader_messageType() != MSGTYPE_METHOD_RETURN ||
+      received->getBody().getElement(1)->toUint64().getValue() != 7) {
+    throw Error("dbus_method_reply sent a corrupted message.");
+  }
+}
+
+// Check the header field index, and that all three message parsers
+// reject duplicate and missing header fields.
+void check_header_fields() {
+  std::unique_ptr<DBusMessage> message =
+      mk_test_message(1, DBusMessageBody::mk0(), 2);
+  if (message->getHeader_findField(MSGHDR_MEMBER)
+              ->getValue()
+              ->toString()
+              .getValue() != "m" ||
+      message->getHeader_findField(MSGHDR_SENDER) != nullptr ||
+      message->getHeader_findField(100) != nullptr ||
+      message->getHeader_unixFds() != 2) {
+    throw Error("Header field index is wrong.");
+  }
+
+  // Build a method call message with the given header fields.
+  auto mkBytes = [](std::vector<std::unique_ptr<DBusObject>> &&fields) {
+    std::unique_ptr<DBusMessage> message = DBusMessage::mk(
+        DBusObjectStruct::mk(_vec<std::unique_ptr<DBusObject>>(
+            DBusObjectChar::mk('l'), DBusObjectChar::mk(MSGTYPE_METHOD_CALL),
+            DBusObjectChar::mk(MSGFLAGS_EMPTY), DBusObjectChar::mk(1),
+            DBusObjectUint32::mk(0), DBusObjectUint32::mk(1),
+            DBusObjectArray::mk1(std::move(fields)))),
+        DBusMessageBody::mk0());
+    std::vector<char> bytes;
+    serializeMessage<LittleEndian>(bytes, *message);
+    return bytes;
+  };
+  auto mkField = [](HeaderFieldName name, const char *str) {
+    return DBusHeaderField::mk(name,
+                               DBusObjectVariant::mk(DBusObjectString::mk(str)));
+  };
+
+  // Check that each parser throws a `ParseError` with message `msg`.
+  auto checkRejected = [](const std::vector<char> &bytes, const char *msg) {
+    std::unique_ptr<DBusMessage> result;
+    DBusMessage::EventHandler handler;
+    std::unique_ptr<Parse::Cont> parsers[3] = {
+        DBusMessage::parseAuto(result), DBusMessage::parseLazyAuto(result),
+        DBusMessage::parseEvents<LittleEndian>(handler)};
+    for (auto &cont : parsers) {
+      Parse p(std::move(cont));
+      try {
+        p.feed(bytes.data(), bytes.size());
+        throw Error(_s("Parser accepted a bad header: ") + msg);
+      } catch (ParseError &e) {
+        if (strcmp(e.what(), msg) != 0) {
+          throw Error(_s("Unexpected parse error: ") + e.what());
+        }
+      }
+    }
+  };
+
+  checkRejected(mkBytes(_vec<std::unique_ptr<DBusObject>>(
+                    mkField(MSGHDR_MEMBER, "m"), mkField(MSGHDR_MEMBER, "n"))),
+                "Duplicate header field.");
+  checkRejected(
+      mkBytes(_vec<std::unique_ptr<DBusObject>>(mkField(MSGHDR_MEMBER, "m"))),
+      "Missing required header field.");
+  checkRejected(
+      mkBytes(_vec<std::unique_ptr<DBusObject>>(
+          DBusHeaderField::mk(MSGHDR_PATH,
+                              DBusObjectVariant::mk(DBusObjectPath::mk("/a"))),
+          mkField(MSGHDR_MEMBER, "m"), mkField(MSGHDR_UNIX_FDS, "2"))),
+      "Header field has the wrong type.");
+
+  // A message can be constructed with a non-standard header, but its
+  // fields can't be looked up.
+  std::unique_ptr<DBusMessage> odd = DBusMessage::mk(
+      DBusObjectStruct::mk(_vec<std::unique_ptr<DBusObject>>(
+          DBusObjectChar::mk('l'), DBusObjectChar::mk(MSGTYPE_METHOD_CALL),
+          DBusObjectChar::mk(MSGFLAGS_EMPTY), DBusObjectChar::mk(1),
+          DBusObjectUint32::mk(0), DBusObjectUint32::mk(1),
+          DBusObjectString::mk("not an array"))),
+      DBusMessageBody::mk0());
+  try {
+    odd->getHeader_findField(MSGHDR_PATH);
+    throw Error("Found a field in a non-standard header.");
+  } catch (ObjectCastError &) {
+  }
+
+  // Fields with unknown names are ignored, even if they are repeated.
+  // (`HeaderFieldName` can't represent an unknown name, so these fields
+  // are built as plain structs rather than with `DBusHeaderField`.) Use
+  // a name above 127 to check that it isn't compared as a signed char.
+  auto mkUnknownField = [](const char *str) {
+    return DBusObjectStruct::mk(_vec<std::unique_ptr<DBusObject>>(
+        DBusObjectChar::mk(static_cast<char>(200)),
+        DBusObjectVariant::mk(DBusObjectString::mk(str))));
+  };
+  std::vector<char> bytes = mkBytes(_vec<std::unique_ptr<DBusObject>>(
+      mkUnknownField("x"), mkUnknownField("y"),
+      DBusHeaderField::mk(MSGHDR_PATH,
+                          DBusObjectVariant::mk(DBusObjectPath::mk("/a"))),
+      mkField(MSGHDR_MEMBER, "m")));
+  std::unique_ptr<DBusMessage> result;
+  Parse p(DBusMessage::parseAuto(result));
+  if (p.feed(bytes.data(), bytes.size()) != bytes.size() ||
+      p.maxRequiredBytes() != 0 ||
+      result->getHeader_findField(200)
+              ->getValue()
+              ->toString()
+              .getValue() != "x") {
+    throw Error("Unknown header fields weren't ignored.");
+  }
+}
+
+// Check that parsed objects share their types instead of owning a copy,
+// and that the types outlive the signature cache.
+void check_shared_types() {
+  auto mkPair = [](const char *str, uint32_t x) {
+    return DBusObjectStruct::mk(
+        _vec(_obj(DBusObjectString::mk(str)), _obj(DBusObjectUint32::mk(x))));
+  };
+  std::unique_ptr<DBusMessage> message = mk_test_message(
+      1, DBusMessageBody::mk(
+             _vec(_obj(DBusObjectArray::mk1(_vec<std::unique_ptr<DBusObject>>(
+                      mkPair("x", 1), mkPair("y", 2)))),
+                  _obj(DBusObjectVariant::mk(mkPair("z", 3))))));
+
+  size_t size0 = 0;
+  std::unique_ptr<char[]> buf0 = dbus_message_to_buffer(*message, size0);
+
+  std::unique_ptr<DBusMessage> parsed;
+  Parse p(DBusMessage::parse<LittleEndian>(parsed));
+  p.feed(buf0.get(), size0);
+
+  // Drop the interned body types. The message keeps its own reference.
+  DBusSignatureCache::threadLocal().clear();
+
+  const DBusMessageBody &body = parsed->getBody();
+  const DBusObjectArray &array = body.getElement(0)->toArray();
+  const DBusTypeArray &arrayType =
+      static_cast<const DBusTypeArray &>(array.getType());
+  if (&array.getElement(0)->getType() != &array.getElement(1)->getType() ||
+      &array.getElement(0)->getType() != &arrayType.getBaseType()) {
+    throw Error("Array elements don't share their type.");
+  }
+  const DBusObject &inner = *body.getElement(1)->toVariant().getValue();
+  if (inner.getType().toString() != "(su)" ||
+      inner.toStruct().getElement(0)->toString().getValue() != "z") {
+    throw Error("Unexpected variant contents.");
+  }
+
+  check_message_bytes(*parsed, buf0.get(), size0,
+                      "Parsed message doesn't match.");
+}
+
+// The parser only shares interned types with the objects that it creates,
+// so the objects can outlive a type that isn't interned.
+void check_short_lived_type() {
+  const DBusTypeStruct byteStructType(
+      _vec(std::reference_wrapper<const DBusType>(DBusTypeChar::instance_)));
+  std::unique_ptr<DBusObject> object = DBusObjectStruct::mk(
+      _vec(_obj(DBusObjectArray::mk1(_vec<std::unique_ptr<DBusObject>>(
+               DBusObjectDictEntry::mk(
+                   DBusObjectString::mk("x"),
+                   DBusObjectStruct::mk(_vec(_obj(DBusObjectUint32::mk(1)))))))),
+           _obj(DBusObjectArray::mk1(_vec<std::unique_ptr<DBusObject>>(
+               DBusObjectUint16::mk(2), DBusObjectUint16::mk(3)))),
+           _obj(DBusObjectArray::mk0(byteStructType))));
+
+  size_t size0 = 0;
+  std::unique_ptr<char[]> buf0 =
+      dbus_object_to_buffer<LittleEndian>(*object, size0);
+
+  std::shared_ptr<ParseArena> arena = std::make_shared<ParseArena>();
+  std::unique_ptr<DBusObject> parsed;
+  std::unique_ptr<DBusObject> arenaParsed;
+  {
+    DBusTypeStorage typeStorage;
+    const DBusType &t = cloneType(typeStorage, object->getType());
+    if (t.isInterned()) {
+      throw Error("The type shouldn't be interned.");
+    }
+    parsed = parse_dbus_object_from_buffer<LittleEndian>(t, buf0.get(), size0);
+    arenaParsed = parse_dbus_object_from_buffer<LittleEndian>(
+        t, buf0.get(), size0, FeedMode::Chunked, nullptr, arena);
+  }
+
+  check_equal(*object, *parsed, "Parsed object isn't equal.");
+  check_equal(*object, *arenaParsed, "Arena object isn't equal.");
+  size_t size1 = 0;
+  std::unique_ptr<char[]> buf1 =
+      dbus_object_to_buffer<LittleEndian>(*arenaParsed, size1);
+  if (size0 != size1 || memcmp(buf0.get(), buf1.get(), size0) != 0) {
+    throw Error("Arena serialized strings don't match.");
+  }
+}
+
+// The signature of a variant is created on demand, so check that the
+// serialized bytes are the same before and after it has been created.
+void check_variant_signature() {
+  std::unique_ptr<DBusObject> variant = DBusObjectVariant::mk(
+      DBusObjectArray::mk1(_vec<std::unique_ptr<DBusObject>>(
+          DBusObjectStruct::mk(_vec(_obj(DBusObjectString::mk("x")),
+                                    _obj(DBusObjectUint32::mk(1)))))));
+  std::vector<char> bytes0;
+  SerializeToVector<LittleEndian> s0(bytes0);
+  variant->serialize(s0);
+
+  if (variant->toVariant().getSignature().getValue() != "a(su)") {
+    throw Error("Unexpected variant signature.");
+  }
+  std::vector<char> bytes1;
+  SerializeToVector<LittleEndian> s1(bytes1);
+  serializeTo(s1, *variant);
+  if (bytes0 != bytes1 || bytes0.size() < 7 ||
+      std::string_view(bytes0.data(), 7) !=
+          std::string_view("\005a(su)\0", 7)) {
+    throw Error("Unexpected serialized variant.");
+  }
+}
+
+// `SerializeVisitor` dispatches on the type codes, so check that they
+// agree with the virtual methods.
+void check_type_codes() {
+  DBusTypeStorage typeStorage;
+  const std::vector<std::reference_wrapper<const DBusType>> types =
+      DBusObjectSignature::toTypes(typeStorage, "ybqnuitxdhsogva(y){sv}");
+  for (const DBusType &t : types) {
+    if (t.typeCode() != t.toString()[0] ||
+        typeCodeAlignment(t.typeCode()) != t.alignment()) {
+      throw Error("Type code doesn't match the type.");
+    }
+  }
+  std::unique_ptr<DBusObject> object = DBusObjectStruct::mk(
+      _vec(_obj(DBusObjectDouble::mk(1.0)),
+           _obj(DBusObjectArrayPacked<DBusObjectInt16, int16_t>::mk(
+               DBusTypeInt16::instance_, std::vector<int16_t>(3, -1)))));
+  if (object->typeCode() != '(' ||
+      object->toStruct().getElement(0)->typeCode() != 'd' ||
+      object->toStruct().getElement(1)->typeCode() != 'a') {
+    throw Error("Object type code doesn't match the type.");
+  }
+}
+
+// Check that a message which is parsed with an arena is allocated in it,
+// and that it serializes to the same bytes as the original.
+void check_arena_message() {
+  std::unique_ptr<DBusObject> entry = DBusObjectDictEntry::mk(
+      DBusObjectString::mk("k"),
+      DBusObjectVariant::mk(DBusObjectStruct::mk(_vec(
+          _obj(DBusObjectPath::mk("/p")), _obj(DBusObjectUint32::mk(7))))));
+  std::unique_ptr<DBusMessage> message = mk_test_message(
+      1, DBusMessageBody::mk(
+             _vec(_obj(DBusObjectString::mk("body")),
+                  _obj(DBusObjectArray::mk1(
+                      _vec<std::unique_ptr<DBusObject>>(std::move(entry)))),
+                  _obj(DBusObjectArray::mk1(_vec<std::unique_ptr<DBusObject>>(
+                      DBusObjectUint32::mk(1), DBusObjectUint32::mk(2)))))));
+
+  size_t size0 = 0;
+  std::unique_ptr<char[]> buf0 = dbus_message_to_buffer(*message, size0);
+
+  std::unique_ptr<DBusMessage> parsed;
+  {
+    Parse p(std::make_shared<ParseArena>(64), nullptr,
+            [&](const Parse::State &s) {
+              return DBusMessage::parse<LittleEndian>(parsed, s);
+            });
+    p.feed(buf0.get(), size0);
+  }
+  if (!parsed->getArena() || parsed->getArena()->numChunks() < 2) {
+    throw Error("Message doesn't own a grown arena.");
+  }
+  const DBusMessageBody &body = parsed->getBody();
+  const DBusObject &dict = *body.getElement(1);
+  const DBusObject &variant =
+      *dict.toArray().getElement(0)->toDictEntry().getValue();
+  const DBusObject &packed = *body.getElement(2);
+  if (!parsed->getHeader().isInArena() || !dict.isInArena() ||
+      !variant.isInArena() || !packed.isInArena()) {
+    throw Error("Parsed objects weren't allocated in the arena.");
+  }
+  if (body.getElement(0)->toString().getView() != "body" ||
+      variant.toVariant().getSignature().getView() != "(ou)" ||
+      !variant.toVariant().getSignature().isInArena() ||
+      packed.toArray().getElement(1)->toUint32().getValue() != 2) {
+    throw Error("Unexpected arena message contents.");
+  }
+
+  // Keep the serialized message, because `buf0` is corrupted below.
+  size_t size1 = 0;
+  std::unique_ptr<char[]> buf1 = dbus_message_to_buffer(*parsed, size1);
+  if (size0 != size1 || memcmp(buf0.get(), buf1.get(), size0) != 0) {
+    throw Error("Arena message doesn't match.");
+  }
+
+  // Deleting the message doesn't destroy anything in the arena, not even
+  // the body, so it is still valid for as long as the arena is.
+  {
+    const std::shared_ptr<ParseArena> arena = parsed->getArena();
+    const DBusMessageBody *arenaBody = &parsed->getBody();
+    parsed.reset();
+    if (arenaBody->numElements() != 3 ||
+        arenaBody->getElement(0)->toString().getView() != "body") {
+      throw Error("Deleting the message destroyed the arena's objects.");
+    }
+  }
+
+  // A lazily parsed body is allocated in the message's arena, even though
+  // the header was parsed in zero-copy mode.
+  std::unique_ptr<DBusMessage> lazy;
+  {
+    Parse p(std::make_shared<ParseArena>(), nullptr,
+            [&](const Parse::State &s) {
+              return DBusMessage::parseLazy<LittleEndian>(lazy, s);
+            });
+    p.feed(buf0.get(), size0);
+  }
+  if (!lazy->getBody().getElement(1)->isInArena()) {
+    throw Error("Lazily parsed body wasn't allocated in the arena.");
+  }
+  check_message_bytes(*lazy, buf0.get(), size0,
+                      "Lazily parsed arena message doesn't match.");
+
+  // An empty struct is created before the parser has read any input. The
+  // body `(()s)` starts with one, so check that it is in the arena too,
+  // rather than on the heap, where it would leak when the message is
+  // deleted.
+  std::vector<std::unique_ptr<DBusObject>> noFields;
+  std::unique_ptr<DBusMessage> emptyStructMessage = mk_test_message(
+      1, DBusMessageBody::mk1(DBusObjectStruct::mk(
+             _vec(_obj(DBusObjectStruct::mk(std::move(noFields))),
+                  _obj(DBusObjectString::mk("s"))))));
+  size_t size3 = 0;
+  std::unique_ptr<char[]> buf3 =
+      dbus_message_to_buffer(*emptyStructMessage, size3);
+  std::unique_ptr<DBusMessage> lazyEmptyStruct;
+  {
+    Parse p(std::make_shared<ParseArena>(), nullptr,
+            [&](const Parse::State &s) {
+              return DBusMessage::parseLazy<LittleEndian>(lazyEmptyStruct, s);
+            });
+    p.feed(buf3.get(), size3);
+  }
+  const DBusObjectStruct &emptyStructBody =
+      lazyEmptyStruct->getBody().getElement(0)->toStruct();
+  if (!emptyStructBody.isInArena() ||
+      !emptyStructBody.getElement(0)->isInArena() ||
+      emptyStructBody.getElement(1)->toString().getView() != "s") {
+    throw Error("Empty struct wasn't allocated in the arena.");
+  }
+
+  // If the parser fails part way through, the objects which it has
+  // already created are deleted with the parser. The string "/p" is near
+  // the end of the message, so corrupt its terminating NUL.
+  char *path = static_cast<char *>(memmem(buf0.get(), size0, "/p", 3));
+  if (!path) {
+    throw Error("Couldn't find the path in the message.");
+  }
+  path[2] = 'x';
+  try {
+    std::unique_ptr<DBusMessage> bad;
+    Parse p(std::make_shared<ParseArena>(64), nullptr,
+            [&](const Parse::State &s) {
+              return DBusMessage::parse<LittleEndian>(bad, s);
+            });
+    p.feed(buf0.get(), size0);
+    throw Error("Parsed an invalid message.");
+  } catch (ParseError &) {
+  }
+
+  // Messages which are received by `DBusMessageReader`.
+  auto [sender, receiver] = mk_socketpair(SOCK_NONBLOCK);
+  DBusMessageReader reader(receiver.get());
+  reader.useArenas();
+  std::vector<std::unique_ptr<DBusMessage>> messages;
+  for (size_t i = 0; i < 2; i++) {
+    if (write(sender.get(), buf1.get(), size1) != ssize_t(size1)) {
+      throw ErrorWithErrno("write failed");
+    }
+  }
+  reader.receive(messages);
+  if (messages.size() != 2 || !messages[0]->getArena() ||
+      !messages[1]->getArena() ||
+      messages[0]->getArena() == messages[1]->getArena()) {
+    throw Error("DBusMessageReader didn't use an arena per message.");
+  }
+}
+
+// Check that a message which is parsed into a `DBusTape` contains the
+// same values as the `DBusMessage`, and that the tape can be reused.
+template <Endianness endianness> void check_tape_message() {
+  std::unique_ptr<DBusMessage> message = mk_test_message(
+      7, DBusMessageBody::mk(
+             _vec(_obj(DBusObjectString::mk("body")),
+                  _obj(DBusObjectVariant::mk(DBusObjectStruct::mk(
+                      _vec(_obj(DBusObjectPath::mk("/p")),
+                           _obj(DBusObjectDouble::mk(1.5)))))),
+                  _obj(DBusObjectArray::mk1(_vec<std::unique_ptr<DBusObject>>(
+                      DBusObjectUint32::mk(1), DBusObjectUint32::mk(2)))))));
+
+  size_t size0 = 0;
+  std::unique_ptr<char[]> buf0 =
+      dbus_message_to_buffer<endianness>(*message, size0);
+
+  // Compare with the parsed message, because the endianness byte of
+  // `message` is always 'l'.
+  std::unique_ptr<DBusMessage> parsed;
+  Parse(DBusMessage::parseAuto(parsed)).feed(buf0.get(), size0);
+
+  DBusTape tape;
+  for (size_t i = 0; i < 2; i++) {
+    Parse p(DBusTape::parseMessageAuto(tape));
+    if (p.feed(buf0.get(), size0) != size0 || p.maxRequiredBytes() != 0) {
+      throw Error("DBusTape::parseMessageAuto didn't consume the message.");
+    }
+  }
+
+  TapeChecker headerChecker(tape.getHeader());
+  parsed->getHeader().accept(headerChecker);
+  TapeChecker bodyChecker(tape.getBody());
+  const DBusMessageBody &body = parsed->getBody();
+  for (size_t i = 0; i < body.numElements(); i++) {
+    body.getElement(i)->accept(bodyChecker);
+  }
+  if (!headerChecker.getCursor().atEnd() ||
+      !bodyChecker.getCursor().atEnd()) {
+    throw Error("Tape has extra values.");
+  }
+
+  if (tape.getHeader().getElement(5).getUint32() != 7 ||
+      tape.findHeaderField(MSGHDR_MEMBER).getString() != "m" ||
+      tape.findHeaderField(MSGHDR_PATH).getTypeCode() != 'o' ||
+      !tape.findHeaderField(MSGHDR_ERROR_NAME).atEnd()) {
+    throw Error("Unexpected tape header.");
+  }
+  const DBusTape::Cursor variant = tape.getBody().next();
+  if (variant.getVariantSignature() != "(od)" ||
+      variant.getVariantValue().getElement(1).getDouble() != 1.5 ||
+      variant.next().getElement(1).getUint32() != 2 ||
+      !variant.next().next().atEnd()) {
+    throw Error("Unexpected tape body.");
+  }
+  try {
+    variant.getUint32();
+    throw Error("Cursor didn't check the type.");
+  } catch (ObjectCastError &) {
+  }
+  try {
+    variant.next().getVariantValue();
+    throw Error("Cursor didn't check for a variant.");
+  } catch (ObjectCastError &) {
+  }
+  const DBusTape::Cursor end = variant.next().next();
+  try {
+    end.getTypeCode();
+    throw Error("Cursor didn't check for the end.");
+  } catch (std::out_of_range &) {
+  }
+  try {
+    end.next();
+    throw Error("Cursor stepped past the end.");
+  } catch (std::out_of_range &) {
+  }
+}
+
+// Check the cases of `DBusObject::equals` that the round trip tests don't
+// reach: objects which aren't equal, and objects which are stored
+// differently but are equal.
+void check_equality() {
+  auto mkPair = [](const char *str, uint32_t x) {
+    return DBusObjectStruct::mk(
+        _vec(_obj(DBusObjectString::mk(str)), _obj(DBusObjectUint32::mk(x))));
+  };
+  if (*mkPair("x", 1) != *mkPair("x", 1) ||
+      mkPair("x", 1)->hash() != mkPair("x", 1)->hash() ||
+      *mkPair("x", 1) == *mkPair("x", 2) ||
+      *mkPair("x", 1) == *mkPair("y", 1) ||
+      *mkPair("x", 1) == *DBusObjectVariant::mk(mkPair("x", 1))) {
+    throw Error("Unexpected struct equality.");
+  }
+  if (*DBusObjectInt32::mk(-1) == *DBusObjectUint32::mk(0xFFFFFFFF) ||
+      *DBusObjectString::mk("/") == *DBusObjectPath::mk("/")) {
+    throw Error("Objects of different types are equal.");
+  }
+
+  // Empty arrays are only distinguished by their type.
+  if (*DBusObjectArray::mk0(DBusTypeString::instance_) ==
+      *DBusObjectArray::mk0(DBusTypeInt32::instance_)) {
+    throw Error("Empty arrays of different types are equal.");
+  }
+
+  // The hash only depends on the values, so it is stable. (If this
+  // changes, then hashes which have been stored elsewhere are invalid.)
+  if (mkPair("x", 1)->hash() != 0x9be105a21acdb092ull ||
+      DBusTypeUint32::instance_.hash() == DBusTypeInt32::instance_.hash()) {
+    throw Error("Unexpected hash.");
+  }
+
+  // A packed array is equal to the same array of individual objects.
+  std::unique_ptr<DBusObject> boxed =
+      DBusObjectArray::mk1(_vec<std::unique_ptr<DBusObject>>(
+          DBusObjectInt16::mk(-2), DBusObjectInt16::mk(3)));
+  std::unique_ptr<DBusObject> packed =
+      DBusObjectArrayPacked<DBusObjectInt16, int16_t>::mk(
+          DBusTypeInt16::instance_, std::vector<int16_t>{-2, 3});
+  std::unique_ptr<DBusObject> packed2 =
+      DBusObjectArrayPacked<DBusObjectInt16, int16_t>::mk(
+          DBusTypeInt16::instance_, std::vector<int16_t>{-2, 4});
+  check_equal(*boxed, *packed, "Packed array isn't equal.");
+  if (*packed == *packed2 || *boxed == *packed2) {
+    throw Error("Unexpected packed array equality.");
+  }
+
+  // Types from different storages are compared structurally.
+  auto mkType = [](DBusTypeStorage &storage, const DBusType &fieldType)
+      -> const DBusType & {
+    return storage.allocArray(
+        storage.allocStruct(std::vector<std::reference_wrapper<const DBusType>>{
+            DBusTypeString::instance_, fieldType}));
+  };
+  DBusTypeStorage storage0;
+  DBusTypeStorage storage1;
+  const DBusType &t0 = mkType(storage0, DBusTypeUint32::instance_);
+  const DBusType &t1 = mkType(storage1, DBusTypeUint32::instance_);
+  const DBusType &t2 = mkType(storage1, DBusTypeInt32::instance_);
+  if (&t0 == &t1 || t0 != t1 || t0.hash() != t1.hash() || t0 == t2) {
+    throw Error("Unexpected type equality.");
+  }
+
+  std::unique_ptr<DBusMessageBody> body0 =
+      DBusMessageBody::mk(_vec(_obj(mkPair("x", 1)), _obj(mkPair("y", 2))));
+  std::unique_ptr<DBusMessageBody> body1 =
+      DBusMessageBody::mk(_vec(_obj(mkPair("x", 1)), _obj(mkPair("y", 2))));
+  std::unique_ptr<DBusMessageBody> body2 =
+      DBusMessageBody::mk(_vec(_obj(mkPair("x", 1))));
+  if (*body0 != *body1 || body0->hash() != body1->hash() ||
+      *body0 == *body2 || *body2 == *DBusMessageBody::mk0()) {
+    throw Error("Unexpected body equality.");
+  }
 }
 
 int main() {
+  check_equality();
+  check_tape_message<LittleEndian>();
+  check_tape_message<BigEndian>();
+  check_arena_message();
+  check_variant_signature();
+  check_type_codes();
+  check_shared_types();
+  check_short_lived_type();
+  check_header_fields();
+  check_message_writer();
+  check_receive_batch();
+  check_receive_fds();
+  check_message_reader();
+  check_send_queue();
+  check_serialize_to_iovec();
+  check_type_storage();
+  check_signature_cache();
+  check_parse_auto<LittleEndian>();
+  check_parse_auto<BigEndian>();
+  check_message_events();
+  check_lazy_message();
+  check_string_views();
+  check_packed_array<LittleEndian>();
+  check_packed_array<BigEndian>();
+  check_nonzero_padding<LittleEndian>();
+  check_nonzero_padding<BigEndian>();
+
   for (size_t i = 0; i < 100000; i++) {
     DBusRandomMersenne r(i, 1000);
     DBusTypeStorage typeStorage;